@@ -20,6 +20,7 @@
 ## @itemize
 ## @item @var{outputImage}: reconstructed image
 ## @end itemize
+## @seealso{image_reconstruction}
 ## @end deftypefn
 
 % *************************************************
@@ -21,6 +21,7 @@
 ## @itemize
 ## @item @var{outputImage}: reconstructed image
 ## @end itemize
+## @seealso{image_reconstruction_3d}
 ## @end deftypefn
 
 % *************************************************
@@ -57,7 +57,24 @@ function retval = pre_install (install_data)
   rebuild_pm_demod =                                      0 | force_build;
   rebuild_delay_map=                                      0 | force_build;
   rebuild_signal_das=                                     0 | force_build;
-  rebuild_signal_fdmas=                                   1 | force_build;
+  rebuild_signal_fdmas=                                   0 | force_build;
+  rebuild_signal_bf_plan=                                 0 | force_build;
+  rebuild_signal_bf_image=                                0 | force_build;
+  rebuild_image_reconstruction=                           0 | force_build;
+  rebuild_image_reconstruction_3d=                        0 | force_build;
+  rebuild_signal_omega_k=                                 0 | force_build;
+  rebuild_signal_ffbp=                                    0 | force_build;
+  rebuild_signal_multires_image=                          0 | force_build;
+  rebuild_signal_bf_points=                               0 | force_build;
+  rebuild_signal_clutter_filter=                          0 | force_build;
+  rebuild_signal_range_doppler=                           0 | force_build;
+  rebuild_signal_cfar=                                    0 | force_build;
+  rebuild_signal_tracker=                                 0 | force_build;
+  rebuild_signal_blobs=                                   0 | force_build;
+  rebuild_signal_virtual_sum=                             0 | force_build;
+  rebuild_signal_bf_incremental=                          0 | force_build;
+  # Build beamforming kernels for the host ISA (enables AVX2/AVX-512 gathers)
+  native_simd_beamforming=                                1;
 if exclude_build==0
 
   if rebuild_antenna_create==1
@@ -180,26 +197,144 @@ if exclude_build==0
     printf("Done \n");
   endif;
 
+   if native_simd_beamforming==1
+    default_cxxflags = getenv("CXXFLAGS");
+    setenv("CXXFLAGS", [strtrim(mkoctfile("-p", "CXXFLAGS")) " -march=native"]);
+   endif;
+
    if rebuild_delay_map==1
     clear build_delay_map
     printf("Making Delay Map...\n");
-    mkoctfile build_delay_map.cpp uwb_toolbox_utils.cpp
+    mkoctfile build_delay_map.cpp beamforming_utils.cpp uwb_toolbox_utils.cpp
     printf("Done \n");
   endif;
 
    if rebuild_signal_das==1
     clear signal_das
     printf("Making Delay-and-Sum...\n");
-    mkoctfile signal_das.cpp uwb_toolbox_utils.cpp
+    mkoctfile signal_das.cpp beamforming_utils.cpp uwb_toolbox_utils.cpp
     printf("Done \n");
   endif;
-##
-##  if rebuild_signal_fdmas==1
-##    clear signal_fdmas
-##    printf("Making Delay-Multiply-and-Sum...\n");
-##    mkoctfile signal_fdmas.cpp uwb_toolbox_utils.cpp
-##    printf("Done \n");
-##  endif;
+
+   if rebuild_signal_fdmas==1
+    clear signal_fdmas
+    printf("Making Delay-Multiply-and-Sum...\n");
+    mkoctfile signal_fdmas.cpp beamforming_utils.cpp uwb_toolbox_utils.cpp
+    printf("Done \n");
+  endif;
+
+   if rebuild_signal_bf_plan==1
+    clear signal_bf_plan
+    printf("Making Beamforming Plan...\n");
+    mkoctfile signal_bf_plan.cpp beamforming_utils.cpp uwb_toolbox_utils.cpp
+    printf("Done \n");
+  endif;
+
+   if rebuild_signal_bf_image==1
+    clear signal_bf_image
+    printf("Making Matrix-free Imaging...\n");
+    mkoctfile signal_bf_image.cpp beamforming_utils.cpp uwb_toolbox_utils.cpp
+    printf("Done \n");
+  endif;
+
+   if rebuild_image_reconstruction==1
+    clear image_reconstruction
+    printf("Making Image Reconstruction...\n");
+    mkoctfile image_reconstruction.cpp beamforming_utils.cpp uwb_toolbox_utils.cpp
+    printf("Done \n");
+  endif;
+
+   if rebuild_image_reconstruction_3d==1
+    clear image_reconstruction_3d
+    printf("Making Image Reconstruction 3D...\n");
+    mkoctfile image_reconstruction_3d.cpp beamforming_utils.cpp uwb_toolbox_utils.cpp
+    printf("Done \n");
+  endif;
+
+   if rebuild_signal_omega_k==1
+    clear signal_omega_k
+    printf("Making Omega-K Imaging...\n");
+    mkoctfile signal_omega_k.cpp beamforming_utils.cpp uwb_toolbox_utils.cpp
+    printf("Done \n");
+  endif;
+
+   if rebuild_signal_ffbp==1
+    clear signal_ffbp
+    printf("Making signal_ffbp...\n");
+    mkoctfile signal_ffbp.cpp beamforming_utils.cpp uwb_toolbox_utils.cpp
+    printf("Done \n");
+  endif;
+
+   if rebuild_signal_multires_image==1
+    clear signal_multires_image
+    printf("Making signal_multires_image...\n");
+    mkoctfile signal_multires_image.cpp beamforming_utils.cpp uwb_toolbox_utils.cpp
+    printf("Done \n");
+  endif;
+
+   if rebuild_signal_bf_points==1
+    clear signal_bf_points
+    printf("Making signal_bf_points...\n");
+    mkoctfile signal_bf_points.cpp beamforming_utils.cpp uwb_toolbox_utils.cpp
+    printf("Done \n");
+  endif;
+
+   if rebuild_signal_clutter_filter==1
+    clear signal_clutter_filter
+    printf("Making signal_clutter_filter...\n");
+    mkoctfile signal_clutter_filter.cpp uwb_toolbox_utils.cpp
+    printf("Done \n");
+  endif;
+
+   if rebuild_signal_range_doppler==1
+    clear signal_range_doppler
+    printf("Making signal_range_doppler...\n");
+    mkoctfile signal_range_doppler.cpp uwb_toolbox_utils.cpp
+    printf("Done \n");
+  endif;
+
+   if rebuild_signal_cfar==1
+    clear signal_cfar
+    printf("Making signal_cfar...\n");
+    mkoctfile signal_cfar.cpp beamforming_utils.cpp uwb_toolbox_utils.cpp
+    printf("Done \n");
+  endif;
+
+   if rebuild_signal_tracker==1
+    clear signal_tracker
+    printf("Making signal_tracker...\n");
+    mkoctfile signal_tracker.cpp uwb_toolbox_utils.cpp
+    printf("Done \n");
+  endif;
+
+   if rebuild_signal_blobs==1
+    clear signal_blobs
+    printf("Making signal_blobs...\n");
+    mkoctfile signal_blobs.cpp uwb_toolbox_utils.cpp
+    printf("Done \n");
+  endif;
+
+   if rebuild_signal_virtual_sum==1
+    clear signal_virtual_sum
+    printf("Making signal_virtual_sum...\n");
+    mkoctfile signal_virtual_sum.cpp uwb_toolbox_utils.cpp
+    printf("Done \n");
+  endif;
+
+   if rebuild_signal_bf_incremental==1
+    clear signal_bf_incremental
+    printf("Making signal_bf_incremental...\n");
+    mkoctfile signal_bf_incremental.cpp beamforming_utils.cpp uwb_toolbox_utils.cpp
+    printf("Done \n");
+  endif;
+
+   if native_simd_beamforming==1
+    if isempty(default_cxxflags)
+      unsetenv("CXXFLAGS");
+    else
+      setenv("CXXFLAGS", default_cxxflags);
+    endif;
+   endif;
   printf("-----------------------------------\n");
   printf("ARIA Modules Control \n");
   printf("------------------------------------\n");
@@ -0,0 +1,375 @@
+/* Copyright (C) 2024 ARIA Sensing
+ *
+ * */
+#ifndef ARIA_BEAMFORMING_H
+#define ARIA_BEAMFORMING_H
+
+#include <octave/oct.h>
+#include <octave/ov-struct.h>
+#include <functional>
+#include <vector>
+#include <algorithm>
+
+// Result of the time-support search: bracketing samples of a delay
+struct search_return
+{
+	double _tmin;
+	double _tmax;
+	octave_idx_type _itmin;
+	search_return (double tmin,double tmax, octave_idx_type itmin) : _tmin(tmin), _tmax(tmax), _itmin(itmin) {}
+};
+
+search_return binary_search_time(const NDArray& time_array, double time);
+
+// Lower sample index and linear interpolation weight of a delay.
+// Out of support delays are clamped to the first/last sample.
+void bf_sample_position(const NDArray& time_array, double delay, octave_idx_type& i0, double& w);
+
+// Uniform time support (t0 + n*ts): detection and arithmetic sample position
+bool bf_uniform_time(const NDArray& time_array, double& t0, double& ts);
+
+template <typename T>
+inline void bf_sample_position_uniform(T t0, T inv_ts, octave_idx_type n_samples, T delay, octave_idx_type& i0, T& w)
+{
+	T t = (delay-t0)*inv_ts;
+	if (t < T(0)) t = T(0);
+	if (t > (T)(n_samples-1)) t = n_samples-1;
+	T tf = std::floor(t);
+	if (tf > (T)(n_samples-2)) tf = n_samples-2;
+	i0 = (octave_idx_type)tf;
+	w  = t-tf;
+}
+
+// Double and single precision kernels share the same code
+template <typename T> struct bf_traits;
+
+template <> struct bf_traits<double>
+{
+	typedef NDArray			real_array;
+	typedef ComplexNDArray	complex_array;
+	static real_array		real_value(const octave_value& v)	{ return v.array_value(); }
+	static complex_array	complex_value(const octave_value& v){ return v.complex_array_value(); }
+};
+
+template <> struct bf_traits<float>
+{
+	typedef FloatNDArray		real_array;
+	typedef FloatComplexNDArray complex_array;
+	static real_array		real_value(const octave_value& v)	{ return v.float_array_value(); }
+	static complex_array	complex_value(const octave_value& v){ return v.float_complex_array_value(); }
+};
+
+// Delay-and-sum projection of a single channel sample
+template <typename T>
+inline T bf_project(const std::complex<T>* iq_ch, octave_idx_type i0, T w, const std::complex<T>& phase)
+{
+	std::complex<T> c0 = iq_ch[i0];
+	std::complex<T> c1 = iq_ch[i0+1];
+	std::complex<T> cin = c0 + (c1-c0)*w;
+	return cin.real() * phase.real() + cin.imag() * phase.imag();
+}
+
+// Fractional-delay interpolation of the baseband samples.
+// BF_INTERP_LINEAR uses the two bracketing samples; BF_INTERP_LAGRANGE (cubic, 4 taps) and
+// BF_INTERP_SINC (Kaiser windowed sinc, 8 taps) read polyphase coefficient tables indexed
+// by the quantized fraction; BF_INTERP_FARROW evaluates the cubic Lagrange kernel at the
+// exact fraction with the Farrow polynomial structure.
+enum bf_interp {BF_INTERP_LINEAR, BF_INTERP_LAGRANGE, BF_INTERP_SINC, BF_INTERP_FARROW};
+
+#define BF_INTERP_PHASES 256
+
+template <typename T>
+struct bf_interp_table
+{
+	bf_interp		interp;
+	int				taps;		// taps start at i0 - taps/2 + 1
+	std::vector<T>	coef;		// (taps x (BF_INTERP_PHASES+1)), empty for linear and Farrow
+};
+
+// Tables are built on first use and shared by all the calls
+template <typename T>
+const bf_interp_table<T>& bf_get_interp_table(bf_interp interp);
+
+// Projection of a channel sample with the selected interpolator; the taps are clamped
+// to the time support, so every kernel keeps the i0 / w sample positions of the linear case
+template <typename T>
+inline T bf_project_interp(const std::complex<T>* iq_ch, octave_idx_type n_samples, octave_idx_type i0, T w,
+						   const std::complex<T>& phase, const bf_interp_table<T>& table)
+{
+	if (table.interp==BF_INTERP_LINEAR)
+		return bf_project(iq_ch, i0, w, phase);
+
+	T				 farrow[4];
+	const T*		 h;
+	if (table.interp==BF_INTERP_FARROW)
+	{
+		// Cubic Lagrange on taps -1..2, coefficients as polynomials in w (Horner)
+		farrow[0] = w*(w*(T(-1)/6*w + T(0.5)) - T(1)/3);
+		farrow[1] = w*(w*(T(0.5)*w - T(1)) - T(0.5)) + T(1);
+		farrow[2] = w*(w*(T(-0.5)*w + T(0.5)) + T(1));
+		farrow[3] = w*(w*(T(1)/6*w) - T(1)/6);
+		h = farrow;
+	}
+	else
+	{
+		octave_idx_type p = (octave_idx_type)(w*BF_INTERP_PHASES + T(0.5));
+		h = table.coef.data() + p*table.taps;
+	}
+	octave_idx_type first = i0 - table.taps/2 + 1;
+	std::complex<T> cin	  = 0;
+	if ((first >= 0)&&(first+table.taps <= n_samples))
+	{
+		for (int k=0; k < table.taps; k++)
+			cin += h[k]*iq_ch[first+k];
+	}
+	else
+	{
+		for (int k=0; k < table.taps; k++)
+		{
+			octave_idx_type i = std::min(std::max(first+k, (octave_idx_type)0), n_samples-1);
+			cin += h[k]*iq_ch[i];
+		}
+	}
+	return cin.real() * phase.real() + cin.imag() * phase.imag();
+}
+
+// Channel combination
+// BF_FDMAS multiplies ring-adjacent channels (i, i+1 mod N),
+// BF_FDMAS_FULL sums the signed-sqrt products of all the channel pairs.
+enum bf_mode {BF_DAS, BF_FDMAS, BF_FDMAS_FULL};
+
+// F-DMAS combination of the projected samples (ring-adjacent pairs)
+template <typename T>
+inline T bf_fdmas_combine(const T* samples, octave_idx_type n_samples)
+{
+	T acc = 0;
+	for (octave_idx_type i=0; i < n_samples ; i++)
+	{
+		octave_idx_type j = i+1;
+		if (j == n_samples) j=0;
+		T prod = samples[i]*samples[j];
+		T ksign= prod > 0 ? 1 : -1;
+		acc += std::sqrt(std::fabs(prod))*ksign;
+	}
+	return acc;
+}
+
+// F-DMAS combination over all pairs i<j in O(N): ((sum s^)^2 - sum s^^2)/2, s^ = sign(s)sqrt(|s|)
+template <typename T>
+inline T bf_fdmas_full_combine(const T* samples, octave_idx_type n_samples)
+{
+	T sum	 = 0;
+	T sum_sq = 0;
+	for (octave_idx_type i=0; i < n_samples ; i++)
+	{
+		T a = std::fabs(samples[i]);
+		T r = std::sqrt(a);
+		sum	   += samples[i] < 0 ? -r : r;
+		sum_sq += a;
+	}
+	return T(0.5)*(sum*sum - sum_sq);
+}
+
+template <typename T>
+inline T bf_combine(bf_mode mode, const T* samples, octave_idx_type n_ch)
+{
+	// A single channel has no pairs: F-DMAS returns the DAS projection
+	if ((mode==BF_DAS)||(n_ch==1))
+	{
+		T acc = 0;
+		for (octave_idx_type c=0; c < n_ch; c++)
+			acc += samples[c];
+		return acc;
+	}
+	if (mode==BF_FDMAS_FULL)
+		return bf_fdmas_full_combine(samples, n_ch);
+	return bf_fdmas_combine(samples, n_ch);
+}
+
+// Threading: fn(begin, end) is called over [0, n_items) in chunks of chunk items.
+// Thread counts given by the user are clamped to a few per hardware thread.
+int  bf_default_threads();
+bool bf_threads_from_value(const octave_value& value, int& n_threads);
+
+void bf_parallel_for(octave_idx_type n_items, octave_idx_type chunk, int n_threads,
+					 const std::function<void(octave_idx_type, octave_idx_type)>& fn);
+
+// Coherence weighting of the combined voxel value
+// BF_WEIGHT_CF  : coherence factor (sum s)^2 / (N sum s^2)
+// BF_WEIGHT_SCF : sign coherence factor 1 - sqrt(1 - (sum sign(s) / N)^2)
+enum bf_weight {BF_WEIGHT_NONE, BF_WEIGHT_CF, BF_WEIGHT_SCF};
+
+template <typename T>
+inline T bf_coherence(bf_weight weight, const T* samples, octave_idx_type n_ch)
+{
+	T sum	 = 0;
+	T sum_sq = 0;
+	T sum_sgn= 0;
+	for (octave_idx_type c=0; c < n_ch; c++)
+	{
+		sum		+= samples[c];
+		sum_sq	+= samples[c]*samples[c];
+		sum_sgn += samples[c] < 0 ? -1 : 1;
+	}
+	if (weight==BF_WEIGHT_CF)
+		return sum_sq > 0 ? sum*sum/(n_ch*sum_sq) : T(0);
+	T b = sum_sgn/n_ch;
+	return T(1) - std::sqrt(std::max(T(0), T(1) - b*b));
+}
+
+// Optional trailing arguments of the imaging functions:
+// a number is the thread count, a string a keyword ("ring"/"full" select the F-DMAS pairs,
+// "das"/"fdmas" select the algorithm when select_algorithm is set, "cf"/"scf" the weighting,
+// "linear"/"lagrange"/"sinc"/"farrow" the fractional-delay interpolator)
+struct bf_options
+{
+	int			n_threads;
+	bf_mode		mode;
+	bf_weight	weight;
+	bf_interp	interp;
+};
+bool bf_parse_options(const octave_value_list& args, int first, bf_mode default_mode, bool select_algorithm, bf_options& opts);
+
+// Combined and weighted voxel value
+template <typename T>
+inline T bf_combine(const bf_options& opts, const T* samples, octave_idx_type n_ch)
+{
+	T value = bf_combine(opts.mode, samples, n_ch);
+	if (opts.weight!=BF_WEIGHT_NONE)
+		value *= bf_coherence(opts.weight, samples, n_ch);
+	return value;
+}
+
+// Image kernels (delay map and phase factor in (voxels x channels) layout)
+template <typename T>
+void bf_image_search(const typename bf_traits<T>::complex_array& iq_signals, const NDArray& time,
+					 const typename bf_traits<T>::real_array& delay_map, const typename bf_traits<T>::complex_array& phase_fact,
+					 const bf_options& opts, typename bf_traits<T>::real_array& out);
+template <typename T>
+void bf_image_uniform(const typename bf_traits<T>::complex_array& iq_signals,
+					  const typename bf_traits<T>::real_array& delay_map, const typename bf_traits<T>::complex_array& phase_fact,
+					  double t0, double ts, const bf_options& opts, typename bf_traits<T>::real_array& out);
+
+// Frames of a batched (time x n_tx x n_rx x frames) BB data stack, 1 for a single frame
+octave_idx_type bf_frames(const dim_vector& iq_dims);
+
+// signal_das / signal_fdmas with time support, delay map and phase factor:
+// converts the arguments to precision T and runs the matching kernel.
+// Batched BB data returns the (x, y, z, frames) image stack; the arguments
+// are converted once and every frame is a view of the stack.
+template <typename T>
+octave_value bf_image_maps(const octave_value& signals, const NDArray& time, const octave_value& delay_map,
+						   const octave_value& phase_fact, const bf_options& opts);
+
+// Separable one-way tables of build_delay_map (..., "oneway"): (x, y, z, n_tx + n_rx)
+// one-way delays and unit phasors, tx antennas first
+bool bf_is_oneway_map(const octave_value& delay_map, octave_idx_type n_tx, octave_idx_type n_rx);
+template <typename T>
+void bf_image_oneway(const typename bf_traits<T>::complex_array& iq_signals, const NDArray& time,
+					 const typename bf_traits<T>::real_array& delay_ow, const typename bf_traits<T>::complex_array& phase_ow,
+					 octave_idx_type n_tx, octave_idx_type n_rx, const bf_options& opts, typename bf_traits<T>::real_array& out);
+template <typename T>
+octave_value bf_image_oneway_maps(const octave_value& signals, const NDArray& time, const octave_value& delay_map,
+								  const octave_value& phase_fact, octave_idx_type n_tx, octave_idx_type n_rx, const bf_options& opts);
+
+//---------------------------------------------------
+// Matrix-free imaging
+// Delays and phase factors are computed on the fly from the voxel axes and the
+// antenna positions, with the same expressions as build_delay_map:
+// delay = (|p-tx| + |p-rx|)/C0, phase_fact = delay*exp(j*2*pi*freq*delay)
+struct bf_geometry
+{
+	NDArray x;
+	NDArray y;
+	NDArray z;
+	double	freq;
+	NDArray pos_tx; // n_tx x 3
+	NDArray pos_rx; // n_rx x 3
+};
+
+template <typename T>
+void bf_image_geometry(const typename bf_traits<T>::complex_array& iq_signals, const NDArray& time, const bf_geometry& geom,
+					   const bf_options& opts, typename bf_traits<T>::real_array& out);
+
+// Same projection at an arbitrary list of points (M x 3), out has M elements
+template <typename T>
+void bf_image_points(const typename bf_traits<T>::complex_array& iq_signals, const NDArray& time, double freq,
+					 const NDArray& pos_tx, const NDArray& pos_rx, const NDArray& points,
+					 const bf_options& opts, typename bf_traits<T>::real_array& out);
+
+//---------------------------------------------------
+// Beamforming plan
+// Sample index, interpolation weight and phase factor are stored
+// for every (voxel, tx, rx) with the channels (tx + n_tx*rx) along
+// the first dimension, so that every voxel is a contiguous gather.
+// Voxels are stored in tile order (blocks of 8 x 8 x 8 voxels): voxel
+// maps the k-th entry of the tables to its linear index in the map.
+template <typename T>
+struct bf_plan
+{
+	octave_idx_type nx;
+	octave_idx_type ny;
+	octave_idx_type nz;
+	int				n_tx;
+	int				n_rx;
+	octave_idx_type n_samples;
+	int32NDArray	index;							// (n_tx*n_rx) x voxels
+	typename bf_traits<T>::real_array	 frac;		// (n_tx*n_rx) x voxels
+	typename bf_traits<T>::complex_array phase;		// (n_tx*n_rx) x voxels
+	int32NDArray	voxel;							// 1 x voxels
+};
+
+template <typename T>
+bf_plan<T>		bf_build_plan(const NDArray& time, const typename bf_traits<T>::real_array& delay_map,
+							  const typename bf_traits<T>::complex_array& phase_fact, int n_threads);
+template <typename T>
+octave_value	bf_plan_to_value(const bf_plan<T>& plan);
+template <typename T>
+bool			bf_plan_from_value(const octave_value& value, bf_plan<T>& plan);
+bool			bf_is_plan(const octave_value& value);
+bool			bf_plan_is_single(const octave_value& value);
+
+template <typename T>
+void bf_image_plan(const typename bf_traits<T>::complex_array& iq_signals, const bf_plan<T>& plan,
+				   const bf_options& opts, typename bf_traits<T>::real_array& out);
+
+// signal_das / signal_fdmas with a plan, in the precision of the plan
+template <typename T>
+octave_value bf_image_plan_value(const octave_value& signals, const octave_value& plan_value, const bf_options& opts);
+
+//---------------------------------------------------
+// Cycle sequence imaging (imageReconstruction / imageReconstruction_3D)
+// Each acquisition cycle has one active tx and one active rx antenna.
+// Voxels are rho * dir, with dir a unit vector: rho_first selects the
+// (rho x dir) output layout, otherwise the layout is (dir x rho).
+struct bf_radar_cycles
+{
+	double			fadc;		// ADC sampling rate
+	double			fc;			// carrier frequency
+	NDArray			pos_tx;		// n_tx_ant x 3
+	NDArray			pos_rx;		// n_rx_ant x 3
+	NDArray			delay_tx;	// fixed tx to antenna delays
+	NDArray			delay_rx;	// fixed rx to antenna delays
+	Array<int>		tx;			// active tx of every cycle
+	Array<int>		rx;			// active rx of every cycle
+};
+
+struct bf_polar_grid
+{
+	NDArray rho;
+	NDArray dir;		// n_dir x 3
+	bool	rho_first;
+};
+
+// Reads the hradar structure and checks it against the number of streams
+bool bf_radar_cycles_from_value(const octave_value& hradar, octave_idx_type n_streams, bf_radar_cycles& cycles);
+// "DAS", "DMAS", "DAS_SR", "DMAS_SR" (empty selects "DAS")
+bool bf_parse_reconstruction(const octave_value& algorithm, bool& das, bool& sr);
+
+// streams is (n_cycles x n_samples). Out of support delays give a null projection.
+// DAS is normalized by the number of cycles, DMAS sums p_a * conj(p_b) over a < b,
+// _SR multiplies by |sum p|^2 / (N sum |p|^2).
+void bf_image_cycles(const ComplexNDArray& streams, const bf_radar_cycles& cycles, const bf_polar_grid& grid,
+					 bool das, bool sr, int n_threads, ComplexNDArray& out);
+
+#endif // ARIA_BEAMFORMING_H
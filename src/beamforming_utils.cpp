@@ -0,0 +1,1313 @@
+/* Copyright (C) 2024 Alessio Cacciatori
+##
+## This program is free software: you can redistribute it and/or modify
+## it under the terms of the GNU General Public License as published by
+## the Free Software Foundation, either version 3 of the License, or
+## (at your option) any later version.
+##
+## This program is distributed in the hope that it will be useful,
+## but WITHOUT ANY WARRANTY; without even the implied warranty of
+## MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+## GNU General Public License for more details.
+##
+## You should have received a copy of the GNU General Public License
+## along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <octave/oct.h>
+#include <octave/ov-struct.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+#include "aria_uwb_toolbox.h"
+#include "aria_beamforming.h"
+
+// Voxels processed per block by the uniform time support kernels
+#define BF_BLOCK 256
+
+// Voxel tiles: the grid is traversed in BF_TILE^3 blocks, x fastest inside a block, so that
+// the delays of neighbouring voxels are close and the sample window of every channel
+// stays in L1/L2 across the tile. Threads work on whole tiles.
+#define BF_TILE 8
+
+// Upper bound of the worker threads, per hardware thread: more only adds
+// scheduling overhead to the memory bound kernels
+#define BF_THREADS_PER_CORE 4
+
+struct bf_tiles
+{
+	octave_idx_type nx, ny, nz;
+	octave_idx_type tx, ty, tz;		// tiles along x, y, z
+
+	bf_tiles(octave_idx_type n_x, octave_idx_type n_y, octave_idx_type n_z)
+		: nx(n_x), ny(n_y), nz(n_z),
+		  tx((n_x+BF_TILE-1)/BF_TILE), ty((n_y+BF_TILE-1)/BF_TILE), tz((n_z+BF_TILE-1)/BF_TILE) {}
+
+	octave_idx_type count() const { return tx*ty*tz; }
+
+	// Tiles per bf_parallel_for chunk, about BF_BLOCK voxels
+	octave_idx_type chunk() const
+	{
+		octave_idx_type vox = std::min(nx, (octave_idx_type)BF_TILE)*std::min(ny, (octave_idx_type)BF_TILE)*
+							  std::min(nz, (octave_idx_type)BF_TILE);
+		return std::max((octave_idx_type)1, (octave_idx_type)BF_BLOCK/vox);
+	}
+
+	// fn(v) for the linear (column-major) voxel indices of tile k
+	template <typename F>
+	void for_each(octave_idx_type k, F fn) const
+	{
+		octave_idx_type x0 = (k % tx)*BF_TILE;
+		octave_idx_type y0 = ((k / tx) % ty)*BF_TILE;
+		octave_idx_type z0 = (k / (tx*ty))*BF_TILE;
+		octave_idx_type x1 = std::min(x0+BF_TILE, nx);
+		octave_idx_type y1 = std::min(y0+BF_TILE, ny);
+		octave_idx_type z1 = std::min(z0+BF_TILE, nz);
+		for (octave_idx_type z=z0; z < z1; z++)
+			for (octave_idx_type y=y0; y < y1; y++)
+				for (octave_idx_type x=x0; x < x1; x++)
+					fn(x + nx*(y + ny*z));
+	}
+};
+
+search_return binary_search_time(const NDArray& time_array, double time)
+{
+	octave_idx_type i_min = 0;
+	octave_idx_type i_max = time_array.numel()-1;
+	double t_max = time_array.xelem(i_max);
+	double t_min = time_array.xelem(0);
+
+	if (time > t_max) return			search_return(t_max,t_max,i_max);
+	if (time < t_min) return			search_return(t_min,t_min,-1);
+
+	while (i_max - i_min > 1)
+	{
+		octave_idx_type i_half = (i_max + i_min)>>1;
+
+		double t_half = time_array.xelem(i_half);
+
+		if (time < t_half)
+		{
+			i_max = i_half;
+			t_max = t_half;
+		}
+		else
+		{
+			i_min = i_half;
+			t_min = t_half;
+		}
+	}
+
+	return search_return(t_min, t_max, i_min);
+}
+
+void bf_sample_position(const NDArray& time_array, double delay, octave_idx_type& i0, double& w)
+{
+	octave_idx_type time_index_max = time_array.numel()-1;
+	search_return sr = binary_search_time(time_array, delay);
+	if (sr._itmin==-1)
+	{
+		i0 = 0;
+		w  = 0.0;
+		return;
+	}
+	if (sr._itmin >= time_index_max)
+	{
+		i0 = time_index_max-1;
+		w  = 1.0;
+		return;
+	}
+	i0 = sr._itmin;
+	w  = (delay-sr._tmin)/(sr._tmax-sr._tmin);
+}
+
+bool bf_uniform_time(const NDArray& time_array, double& t0, double& ts)
+{
+	octave_idx_type n = time_array.numel();
+	if (n < 2)
+		return false;
+	t0 = time_array.xelem(0);
+	ts = (time_array.xelem(n-1)-t0)/(double)(n-1);
+	if (ts <= 0.0)
+		return false;
+	// Allow for the rounding of n/fadc style supports
+	double tol = 1e-6*ts;
+	for (octave_idx_type i=1; i < n-1; i++)
+		if (fabs(time_array.xelem(i)-(t0+i*ts)) > tol)
+			return false;
+	return true;
+}
+
+//---------------------------------------------------
+// Thread pool
+// Workers are started on first use and kept for the lifetime of the oct-file,
+// so consecutive frames do not pay the thread creation cost.
+class bf_thread_pool
+{
+public:
+	static bf_thread_pool& instance()
+	{
+		static bf_thread_pool pool;
+		return pool;
+	}
+
+	~bf_thread_pool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stop = true;
+		}
+		_cv_start.notify_all();
+		for (std::thread& worker : _workers)
+			worker.join();
+	}
+
+	void parallel_for(octave_idx_type n_items, octave_idx_type chunk, int n_threads,
+					  const std::function<void(octave_idx_type, octave_idx_type)>& fn)
+	{
+		std::lock_guard<std::mutex> job_lock(_job_mutex);
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			while ((int)_workers.size() < n_threads-1)
+				_workers.emplace_back(&bf_thread_pool::worker_loop, this, (int)_workers.size(), _generation);
+			_job		 = &fn;
+			_n_items	 = n_items;
+			_chunk		 = chunk;
+			_next		 = 0;
+			_participants= n_threads-1;
+			_running	 = n_threads-1;
+			_generation++;
+		}
+		_cv_start.notify_all();
+		run_chunks();
+
+		std::unique_lock<std::mutex> lock(_mutex);
+		_cv_done.wait(lock, [this]{ return _running==0; });
+		_job = nullptr;
+	}
+
+private:
+	bf_thread_pool() {}
+
+	void run_chunks()
+	{
+		for (;;)
+		{
+			octave_idx_type begin = _next.fetch_add(_chunk);
+			if (begin >= _n_items)
+				break;
+			(*_job)(begin, std::min(begin+_chunk, _n_items));
+		}
+	}
+
+	void worker_loop(int id, unsigned generation)
+	{
+		for (;;)
+		{
+			{
+				std::unique_lock<std::mutex> lock(_mutex);
+				_cv_start.wait(lock, [&]{ return _stop || (_generation!=generation); });
+				if (_stop)
+					return;
+				generation = _generation;
+				if (id >= _participants)
+					continue;
+			}
+			run_chunks();
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				if (--_running==0)
+					_cv_done.notify_one();
+			}
+		}
+	}
+
+	std::vector<std::thread>	_workers;
+	std::mutex					_job_mutex;
+	std::mutex					_mutex;
+	std::condition_variable		_cv_start;
+	std::condition_variable		_cv_done;
+	const std::function<void(octave_idx_type, octave_idx_type)>* _job = nullptr;
+	std::atomic<octave_idx_type> _next{0};
+	octave_idx_type				_n_items = 0;
+	octave_idx_type				_chunk = 1;
+	int							_participants = 0;
+	int							_running = 0;
+	unsigned					_generation = 0;
+	bool						_stop = false;
+};
+
+int bf_default_threads()
+{
+	unsigned n = std::thread::hardware_concurrency();
+	return n > 0 ? (int)n : 1;
+}
+
+bool bf_threads_from_value(const octave_value& value, int& n_threads)
+{
+	double n = value.is_real_scalar() ? value.double_value() : 0.0;
+	if (!((n >= 1.0)&&(n==std::floor(n))))
+	{
+		error("n_threads must be a positive integer");
+		return false;
+	}
+	n_threads = (int)std::min(n, (double)(BF_THREADS_PER_CORE*bf_default_threads()));
+	return true;
+}
+
+bool bf_parse_options(const octave_value_list& args, int first, bf_mode default_mode, bool select_algorithm, bf_options& opts)
+{
+	opts.n_threads	= bf_default_threads();
+	opts.mode		= default_mode;
+	opts.weight		= BF_WEIGHT_NONE;
+	opts.interp		= BF_INTERP_LINEAR;
+	for (int i=first; i < args.length(); i++)
+	{
+		if (!args(i).is_string())
+		{
+			if (!bf_threads_from_value(args(i), opts.n_threads))
+				return false;
+			continue;
+		}
+		std::string key = args(i).string_value();
+		if (select_algorithm && ((key=="das")||(key=="fdmas")))
+		{
+			opts.mode = key=="das" ? BF_DAS : BF_FDMAS;
+			continue;
+		}
+		if ((key=="ring")||(key=="full"))
+		{
+			if ((default_mode==BF_DAS)&&(!select_algorithm))
+			{
+				error("\"%s\" only applies to F-DMAS", key.c_str());
+				return false;
+			}
+			opts.mode = key=="ring" ? BF_FDMAS : BF_FDMAS_FULL;
+			continue;
+		}
+		if ((key=="cf")||(key=="scf"))
+		{
+			opts.weight = key=="cf" ? BF_WEIGHT_CF : BF_WEIGHT_SCF;
+			continue;
+		}
+		if ((key=="linear")||(key=="lagrange")||(key=="sinc")||(key=="farrow"))
+		{
+			opts.interp = key=="linear" ? BF_INTERP_LINEAR : (key=="lagrange" ? BF_INTERP_LAGRANGE :
+						  (key=="sinc" ? BF_INTERP_SINC : BF_INTERP_FARROW));
+			continue;
+		}
+		error("invalid option \"%s\"", key.c_str());
+		return false;
+	}
+	return true;
+}
+
+void bf_parallel_for(octave_idx_type n_items, octave_idx_type chunk, int n_threads,
+					 const std::function<void(octave_idx_type, octave_idx_type)>& fn)
+{
+	if (chunk < 1)
+		chunk = 1;
+	octave_idx_type n_chunks = (n_items+chunk-1)/chunk;
+	if (n_threads > n_chunks)
+		n_threads = n_chunks;
+	if (n_threads <= 1)
+	{
+		for (octave_idx_type begin=0; begin < n_items; begin+=chunk)
+			fn(begin, std::min(begin+chunk, n_items));
+		return;
+	}
+	bf_thread_pool::instance().parallel_for(n_items, chunk, n_threads, fn);
+}
+
+
+//---------------------------------------------------
+// Fractional-delay tables
+// Row p holds the taps for the fraction p/BF_INTERP_PHASES, rows are normalized to unit DC gain
+static double bf_bessel_i0(double x)
+{
+	double sum	= 1.0;
+	double term = 1.0;
+	for (int k=1; k < 50; k++)
+	{
+		term *= (x/(2.0*k))*(x/(2.0*k));
+		sum  += term;
+		if (term < 1e-17*sum)
+			break;
+	}
+	return sum;
+}
+
+template <typename T>
+static bf_interp_table<T> bf_build_interp_table(bf_interp interp)
+{
+	bf_interp_table<T> table;
+	table.interp = interp;
+	table.taps	 = interp==BF_INTERP_LINEAR ? 2 : (interp==BF_INTERP_SINC ? 8 : 4);
+	if ((interp==BF_INTERP_LINEAR)||(interp==BF_INTERP_FARROW))
+		return table;
+
+	// Kaiser window, beta = 6: sidelobes below -60 dB
+	const double beta = 6.0;
+	double		 half = table.taps/2;
+	table.coef.resize(table.taps*(BF_INTERP_PHASES+1));
+	for (int p=0; p <= BF_INTERP_PHASES; p++)
+	{
+		double mu = (double)p/BF_INTERP_PHASES;
+		double h[8];
+		double sum = 0;
+		for (int k=0; k < table.taps; k++)
+		{
+			// Tap position relative to the interpolation instant
+			double x = k - (table.taps/2 - 1) - mu;
+			if (interp==BF_INTERP_LAGRANGE)
+			{
+				h[k] = 1.0;
+				for (int m=0; m < table.taps; m++)
+					if (m!=k)
+						h[k] *= (mu - (m - (table.taps/2 - 1)))/(double)(k - m);
+			}
+			else
+			{
+				double sinc = fabs(x) < 1e-12 ? 1.0 : sin(M_PI*x)/(M_PI*x);
+				double r	= x/half;
+				h[k] = r*r < 1.0 ? sinc*bf_bessel_i0(beta*sqrt(1.0 - r*r))/bf_bessel_i0(beta) : 0.0;
+			}
+			sum += h[k];
+		}
+		for (int k=0; k < table.taps; k++)
+			table.coef[p*table.taps + k] = (T)(h[k]/sum);
+	}
+	return table;
+}
+
+template <typename T>
+const bf_interp_table<T>& bf_get_interp_table(bf_interp interp)
+{
+	static const bf_interp_table<T> tables[] = {bf_build_interp_table<T>(BF_INTERP_LINEAR), bf_build_interp_table<T>(BF_INTERP_LAGRANGE),
+												 bf_build_interp_table<T>(BF_INTERP_SINC), bf_build_interp_table<T>(BF_INTERP_FARROW)};
+	return tables[interp];
+}
+
+
+//---------------------------------------------------
+// Uniform time support
+// Project n voxels of a single channel: s[v] = Re(iq(delay[v]) * conj(phase[v]))
+// Sample indices are computed arithmetically and the two bracketing samples
+// are fetched with gathers when AVX2/AVX-512 are enabled at compile time.
+template <typename T>
+static void bf_project_uniform_scalar(const std::complex<T>* iq_ch, octave_idx_type n_samples, T t0, T inv_ts,
+									  const T* delay, const std::complex<T>* phase, octave_idx_type v, octave_idx_type n, T* s)
+{
+	for (; v < n; v++)
+	{
+		octave_idx_type i0;
+		T				w;
+		bf_sample_position_uniform(t0, inv_ts, n_samples, delay[v], i0, w);
+		s[v] = bf_project(iq_ch, i0, w, phase[v]);
+	}
+}
+
+static void bf_project_uniform_block(const Complex* iq_ch, octave_idx_type n_samples, double t0, double inv_ts,
+									 const double* delay, const Complex* phase, octave_idx_type n, double* s)
+{
+	octave_idx_type v = 0;
+#if defined(__AVX512F__)
+	{
+		const double* base = reinterpret_cast<const double*>(iq_ch);
+		const double* pph  = reinterpret_cast<const double*>(phase);
+		__m512d vt0   = _mm512_set1_pd(t0);
+		__m512d vinv  = _mm512_set1_pd(inv_ts);
+		__m512d vzero = _mm512_setzero_pd();
+		__m512d vmax  = _mm512_set1_pd((double)(n_samples-1));
+		__m512d vlast = _mm512_set1_pd((double)(n_samples-2));
+		__m512i even  = _mm512_set_epi64(14,12,10,8,6,4,2,0);
+		__m512i odd   = _mm512_set_epi64(15,13,11,9,7,5,3,1);
+		for (; v + 8 <= n; v += 8)
+		{
+			__m512d t  = _mm512_mul_pd(_mm512_sub_pd(_mm512_loadu_pd(delay+v), vt0), vinv);
+			t = _mm512_min_pd(_mm512_max_pd(t, vzero), vmax);
+			__m512d tf = _mm512_min_pd(_mm512_roundscale_pd(t, _MM_FROUND_TO_NEG_INF|_MM_FROUND_NO_EXC), vlast);
+			__m512d w  = _mm512_sub_pd(t, tf);
+			__m512i idx= _mm512_slli_epi64(_mm512_cvtepi32_epi64(_mm512_cvtpd_epi32(tf)), 1);
+			__m512d re0= _mm512_i64gather_pd(idx, base,   8);
+			__m512d im0= _mm512_i64gather_pd(idx, base+1, 8);
+			__m512d re1= _mm512_i64gather_pd(idx, base+2, 8);
+			__m512d im1= _mm512_i64gather_pd(idx, base+3, 8);
+			__m512d re = _mm512_add_pd(re0, _mm512_mul_pd(_mm512_sub_pd(re1, re0), w));
+			__m512d im = _mm512_add_pd(im0, _mm512_mul_pd(_mm512_sub_pd(im1, im0), w));
+			__m512d p0 = _mm512_loadu_pd(pph+2*v);
+			__m512d p1 = _mm512_loadu_pd(pph+2*v+8);
+			__m512d pre= _mm512_permutex2var_pd(p0, even, p1);
+			__m512d pim= _mm512_permutex2var_pd(p0, odd,  p1);
+			_mm512_storeu_pd(s+v, _mm512_add_pd(_mm512_mul_pd(re, pre), _mm512_mul_pd(im, pim)));
+		}
+	}
+#elif defined(__AVX2__)
+	{
+		const double* base = reinterpret_cast<const double*>(iq_ch);
+		const double* pph  = reinterpret_cast<const double*>(phase);
+		__m256d vt0   = _mm256_set1_pd(t0);
+		__m256d vinv  = _mm256_set1_pd(inv_ts);
+		__m256d vzero = _mm256_setzero_pd();
+		__m256d vmax  = _mm256_set1_pd((double)(n_samples-1));
+		__m256d vlast = _mm256_set1_pd((double)(n_samples-2));
+		for (; v + 4 <= n; v += 4)
+		{
+			__m256d t  = _mm256_mul_pd(_mm256_sub_pd(_mm256_loadu_pd(delay+v), vt0), vinv);
+			t = _mm256_min_pd(_mm256_max_pd(t, vzero), vmax);
+			__m256d tf = _mm256_min_pd(_mm256_floor_pd(t), vlast);
+			__m256d w  = _mm256_sub_pd(t, tf);
+			__m256i idx= _mm256_slli_epi64(_mm256_cvtepi32_epi64(_mm256_cvtpd_epi32(tf)), 1);
+			__m256d re0= _mm256_i64gather_pd(base,   idx, 8);
+			__m256d im0= _mm256_i64gather_pd(base+1, idx, 8);
+			__m256d re1= _mm256_i64gather_pd(base+2, idx, 8);
+			__m256d im1= _mm256_i64gather_pd(base+3, idx, 8);
+			__m256d re = _mm256_add_pd(re0, _mm256_mul_pd(_mm256_sub_pd(re1, re0), w));
+			__m256d im = _mm256_add_pd(im0, _mm256_mul_pd(_mm256_sub_pd(im1, im0), w));
+			// (r0 i0 r1 i1),(r2 i2 r3 i3) -> (r0 r1 r2 r3),(i0 i1 i2 i3)
+			__m256d p0 = _mm256_loadu_pd(pph+2*v);
+			__m256d p1 = _mm256_loadu_pd(pph+2*v+4);
+			__m256d pre= _mm256_permute4x64_pd(_mm256_unpacklo_pd(p0, p1), 0xD8);
+			__m256d pim= _mm256_permute4x64_pd(_mm256_unpackhi_pd(p0, p1), 0xD8);
+			_mm256_storeu_pd(s+v, _mm256_add_pd(_mm256_mul_pd(re, pre), _mm256_mul_pd(im, pim)));
+		}
+	}
+#endif
+	bf_project_uniform_scalar(iq_ch, n_samples, t0, inv_ts, delay, phase, v, n, s);
+}
+
+// Single precision: twice the lanes of the double precision kernel
+static void bf_project_uniform_block(const FloatComplex* iq_ch, octave_idx_type n_samples, float t0, float inv_ts,
+									 const float* delay, const FloatComplex* phase, octave_idx_type n, float* s)
+{
+	octave_idx_type v = 0;
+#if defined(__AVX512F__)
+	{
+		const float* base = reinterpret_cast<const float*>(iq_ch);
+		const float* pph  = reinterpret_cast<const float*>(phase);
+		__m512 vt0	 = _mm512_set1_ps(t0);
+		__m512 vinv  = _mm512_set1_ps(inv_ts);
+		__m512 vzero = _mm512_setzero_ps();
+		__m512 vmax  = _mm512_set1_ps((float)(n_samples-1));
+		__m512 vlast = _mm512_set1_ps((float)(n_samples-2));
+		__m512i even = _mm512_set_epi32(30,28,26,24,22,20,18,16,14,12,10,8,6,4,2,0);
+		__m512i odd  = _mm512_set_epi32(31,29,27,25,23,21,19,17,15,13,11,9,7,5,3,1);
+		for (; v + 16 <= n; v += 16)
+		{
+			__m512 t  = _mm512_mul_ps(_mm512_sub_ps(_mm512_loadu_ps(delay+v), vt0), vinv);
+			t = _mm512_min_ps(_mm512_max_ps(t, vzero), vmax);
+			__m512 tf = _mm512_min_ps(_mm512_roundscale_ps(t, _MM_FROUND_TO_NEG_INF|_MM_FROUND_NO_EXC), vlast);
+			__m512 w  = _mm512_sub_ps(t, tf);
+			__m512i idx= _mm512_slli_epi32(_mm512_cvtps_epi32(tf), 1);
+			__m512 re0= _mm512_i32gather_ps(idx, base,	 4);
+			__m512 im0= _mm512_i32gather_ps(idx, base+1, 4);
+			__m512 re1= _mm512_i32gather_ps(idx, base+2, 4);
+			__m512 im1= _mm512_i32gather_ps(idx, base+3, 4);
+			__m512 re = _mm512_add_ps(re0, _mm512_mul_ps(_mm512_sub_ps(re1, re0), w));
+			__m512 im = _mm512_add_ps(im0, _mm512_mul_ps(_mm512_sub_ps(im1, im0), w));
+			__m512 p0 = _mm512_loadu_ps(pph+2*v);
+			__m512 p1 = _mm512_loadu_ps(pph+2*v+16);
+			__m512 pre= _mm512_permutex2var_ps(p0, even, p1);
+			__m512 pim= _mm512_permutex2var_ps(p0, odd,  p1);
+			_mm512_storeu_ps(s+v, _mm512_add_ps(_mm512_mul_ps(re, pre), _mm512_mul_ps(im, pim)));
+		}
+	}
+#elif defined(__AVX2__)
+	{
+		const float* base = reinterpret_cast<const float*>(iq_ch);
+		const float* pph  = reinterpret_cast<const float*>(phase);
+		__m256 vt0	 = _mm256_set1_ps(t0);
+		__m256 vinv  = _mm256_set1_ps(inv_ts);
+		__m256 vzero = _mm256_setzero_ps();
+		__m256 vmax  = _mm256_set1_ps((float)(n_samples-1));
+		__m256 vlast = _mm256_set1_ps((float)(n_samples-2));
+		for (; v + 8 <= n; v += 8)
+		{
+			__m256 t  = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(delay+v), vt0), vinv);
+			t = _mm256_min_ps(_mm256_max_ps(t, vzero), vmax);
+			__m256 tf = _mm256_min_ps(_mm256_floor_ps(t), vlast);
+			__m256 w  = _mm256_sub_ps(t, tf);
+			__m256i idx= _mm256_slli_epi32(_mm256_cvtps_epi32(tf), 1);
+			__m256 re0= _mm256_i32gather_ps(base,	idx, 4);
+			__m256 im0= _mm256_i32gather_ps(base+1, idx, 4);
+			__m256 re1= _mm256_i32gather_ps(base+2, idx, 4);
+			__m256 im1= _mm256_i32gather_ps(base+3, idx, 4);
+			__m256 re = _mm256_add_ps(re0, _mm256_mul_ps(_mm256_sub_ps(re1, re0), w));
+			__m256 im = _mm256_add_ps(im0, _mm256_mul_ps(_mm256_sub_ps(im1, im0), w));
+			// (r0 i0 .. r3 i3),(r4 i4 .. r7 i7) -> (r0 .. r7),(i0 .. i7)
+			__m256 p0 = _mm256_loadu_ps(pph+2*v);
+			__m256 p1 = _mm256_loadu_ps(pph+2*v+8);
+			__m256 pre= _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_shuffle_ps(p0, p1, _MM_SHUFFLE(2,0,2,0))), 0xD8));
+			__m256 pim= _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_shuffle_ps(p0, p1, _MM_SHUFFLE(3,1,3,1))), 0xD8));
+			_mm256_storeu_ps(s+v, _mm256_add_ps(_mm256_mul_ps(re, pre), _mm256_mul_ps(im, pim)));
+		}
+	}
+#endif
+	bf_project_uniform_scalar(iq_ch, n_samples, t0, inv_ts, delay, phase, v, n, s);
+}
+
+//---------------------------------------------------
+// Image kernels
+// Every voxel is computed independently by the same sequence of operations,
+// so the output does not depend on the number of threads.
+
+// Delay map / phase factor in (voxels x channels) layout, searched time support
+template <typename T>
+void bf_image_search(const typename bf_traits<T>::complex_array& iq_signals, const NDArray& time,
+					 const typename bf_traits<T>::real_array& delay_map, const typename bf_traits<T>::complex_array& phase_fact,
+					 const bf_options& opts, typename bf_traits<T>::real_array& out)
+{
+	octave_idx_type n_samples	= time.numel();
+	octave_idx_type n_vox		= out.numel();
+	octave_idx_type n_ch		= delay_map.numel()/n_vox;
+	const std::complex<T>*	iq	= iq_signals.data();
+	const T*				dm	= delay_map.data();
+	const std::complex<T>*	pf	= phase_fact.data();
+	T*						pout= out.fortran_vec();
+
+	const bf_interp_table<T>& table = bf_get_interp_table<T>(opts.interp);
+
+	bf_parallel_for(n_vox, BF_BLOCK, opts.n_threads, [&](octave_idx_type v_begin, octave_idx_type v_end)
+	{
+		std::vector<T> samples(n_ch);
+		for (octave_idx_type v=v_begin; v < v_end; v++)
+		{
+			for (octave_idx_type c=0; c < n_ch; c++)
+			{
+				octave_idx_type i0;
+				double			w;
+				bf_sample_position(time, dm[v + n_vox*c], i0, w);
+				samples[c] = bf_project_interp<T>(iq + c*n_samples, n_samples, i0, w, pf[v + n_vox*c], table);
+			}
+			pout[v] = bf_combine(opts, samples.data(), n_ch);
+		}
+	});
+}
+
+// Delay map / phase factor in (voxels x channels) layout, uniform time support.
+// Channels are projected over blocks of BF_BLOCK voxels; blocks are aligned to the
+// voxel index so each voxel always takes the same (SIMD or scalar) route.
+template <typename T>
+void bf_image_uniform(const typename bf_traits<T>::complex_array& iq_signals,
+					  const typename bf_traits<T>::real_array& delay_map, const typename bf_traits<T>::complex_array& phase_fact,
+					  double t0, double ts, const bf_options& opts, typename bf_traits<T>::real_array& out)
+{
+	octave_idx_type n_samples = iq_signals.dim1();
+	octave_idx_type n_vox = out.numel();
+	octave_idx_type n_ch  = delay_map.numel()/n_vox;
+	T				t0_t  = (T)t0;
+	T				inv_ts= (T)(1.0/ts);
+	const std::complex<T>*	iq	= iq_signals.data();
+	const T*				dm	= delay_map.data();
+	const std::complex<T>*	pf	= phase_fact.data();
+	T*						pout= out.fortran_vec();
+	const bf_interp_table<T>& table = bf_get_interp_table<T>(opts.interp);
+
+	bf_parallel_for(n_vox, BF_BLOCK, opts.n_threads, [&](octave_idx_type v_begin, octave_idx_type v_end)
+	{
+		std::vector<T> block(n_ch*BF_BLOCK);
+		std::vector<T> samples(n_ch);
+		for (octave_idx_type v0=v_begin; v0 < v_end; v0+=BF_BLOCK)
+		{
+			octave_idx_type nb = std::min<octave_idx_type>(BF_BLOCK, v_end-v0);
+			for (octave_idx_type c=0; c < n_ch; c++)
+			{
+				if (table.interp==BF_INTERP_LINEAR)
+				{
+					bf_project_uniform_block(iq + c*n_samples, n_samples, t0_t, inv_ts,
+											 dm + v0 + n_vox*c, pf + v0 + n_vox*c, nb, block.data() + c*BF_BLOCK);
+					continue;
+				}
+				for (octave_idx_type v=0; v < nb; v++)
+				{
+					octave_idx_type i0;
+					T				w;
+					bf_sample_position_uniform(t0_t, inv_ts, n_samples, dm[v0 + v + n_vox*c], i0, w);
+					block[v + c*BF_BLOCK] = bf_project_interp<T>(iq + c*n_samples, n_samples, i0, w, pf[v0 + v + n_vox*c], table);
+				}
+			}
+			for (octave_idx_type v=0; v < nb; v++)
+			{
+				for (octave_idx_type c=0; c < n_ch; c++)
+					samples[c] = block[v + c*BF_BLOCK];
+				pout[v0+v] = bf_combine(opts, samples.data(), n_ch);
+			}
+		}
+	});
+}
+
+octave_idx_type bf_frames(const dim_vector& iq_dims)
+{
+	return iq_dims.ndims() > 3 ? iq_dims(3) : 1;
+}
+
+// Runs kernel(iq_frame, image) on every frame of the BB data; frames are
+// shallow slices of the stack and the images are stacked along the 4th dimension
+template <typename T, typename F>
+static octave_value bf_image_frames(const typename bf_traits<T>::complex_array& iq_signals,
+									octave_idx_type nx, octave_idx_type ny, octave_idx_type nz, F kernel)
+{
+	typedef bf_traits<T> traits;
+	octave_idx_type n_frames = bf_frames(iq_signals.dims());
+	typename traits::real_array image(dim_vector({nx,ny,nz}));
+	if (n_frames==1)
+	{
+		kernel(iq_signals, image);
+		return octave_value(image);
+	}
+
+	dim_vector		frame_dims({iq_signals.dim1(), iq_signals.dim2(), iq_signals.dim3()});
+	octave_idx_type frame_size = frame_dims.numel();
+	octave_idx_type n_vox	   = nx*ny*nz;
+	typename traits::real_array out(dim_vector({nx,ny,nz,n_frames}));
+	T* pout = out.fortran_vec();
+	for (octave_idx_type f=0; f < n_frames; f++)
+	{
+		typename traits::complex_array iq_frame(iq_signals.linear_slice(f*frame_size, (f+1)*frame_size).reshape(frame_dims));
+		kernel(iq_frame, image);
+		std::copy(image.data(), image.data()+n_vox, pout + f*n_vox);
+	}
+	return octave_value(out);
+}
+
+template <typename T>
+octave_value bf_image_maps(const octave_value& signals, const NDArray& time, const octave_value& delay_map,
+						   const octave_value& phase_fact, const bf_options& opts)
+{
+	typedef bf_traits<T> traits;
+	typename traits::complex_array	iq_signals	= traits::complex_value(signals);
+	typename traits::real_array		dm			= traits::real_value(delay_map);
+	typename traits::complex_array	pf			= traits::complex_value(phase_fact);
+
+	// Uniform time support: arithmetic sample positions, no search
+	double t0, ts;
+	bool   bUniform = bf_uniform_time(time, t0, ts);
+	return bf_image_frames<T>(iq_signals, dm.dim1(), dm.dim2(), dm.dim3(),
+							  [&](const typename traits::complex_array& iq_frame, typename traits::real_array& out)
+	{
+		if (bUniform)
+			bf_image_uniform<T>(iq_frame, dm, pf, t0, ts, opts, out);
+		else
+			bf_image_search<T>(iq_frame, time, dm, pf, opts, out);
+	});
+}
+
+//---------------------------------------------------
+// Separable one-way tables (voxels x (n_tx + n_rx)): the pair delay and phase factor
+// are formed per voxel from the tx and rx entries, sample positions in double precision
+template <typename T>
+void bf_image_oneway(const typename bf_traits<T>::complex_array& iq_signals, const NDArray& time,
+					 const typename bf_traits<T>::real_array& delay_ow, const typename bf_traits<T>::complex_array& phase_ow,
+					 octave_idx_type n_tx, octave_idx_type n_rx, const bf_options& opts, typename bf_traits<T>::real_array& out)
+{
+	octave_idx_type n_samples = time.numel();
+	octave_idx_type n_vox	  = out.numel();
+	octave_idx_type n_ch	  = n_tx*n_rx;
+	const std::complex<T>*	iq	 = iq_signals.data();
+	const T*				dm	 = delay_ow.data();
+	const std::complex<T>*	pf	 = phase_ow.data();
+	T*						pout = out.fortran_vec();
+
+	double t0, ts;
+	bool   bUniform = bf_uniform_time(time, t0, ts);
+	double inv_ts	= bUniform ? 1.0/ts : 0.0;
+	const bf_interp_table<T>& table = bf_get_interp_table<T>(opts.interp);
+
+	bf_parallel_for(n_vox, BF_BLOCK, opts.n_threads, [&](octave_idx_type v_begin, octave_idx_type v_end)
+	{
+		std::vector<T> samples(n_ch);
+		for (octave_idx_type v=v_begin; v < v_end; v++)
+		{
+			for (octave_idx_type r=0; r < n_rx; r++)
+			{
+				double			d_rx = dm[v + n_vox*(n_tx+r)];
+				std::complex<T> p_rx = pf[v + n_vox*(n_tx+r)];
+				for (octave_idx_type t=0; t < n_tx; t++)
+				{
+					octave_idx_type c	 = t + n_tx*r;
+					double			delay= dm[v + n_vox*t] + d_rx;
+					octave_idx_type i0;
+					double			w;
+					if (bUniform)
+						bf_sample_position_uniform(t0, inv_ts, n_samples, delay, i0, w);
+					else
+						bf_sample_position(time, delay, i0, w);
+					samples[c] = bf_project_interp<T>(iq + c*n_samples, n_samples, i0, (T)w, (T)delay*pf[v + n_vox*t]*p_rx, table);
+				}
+			}
+			pout[v] = bf_combine(opts, samples.data(), n_ch);
+		}
+	});
+}
+
+template <typename T>
+octave_value bf_image_oneway_maps(const octave_value& signals, const NDArray& time, const octave_value& delay_map,
+								  const octave_value& phase_fact, octave_idx_type n_tx, octave_idx_type n_rx, const bf_options& opts)
+{
+	typedef bf_traits<T> traits;
+	typename traits::complex_array	iq_signals	= traits::complex_value(signals);
+	typename traits::real_array		dm			= traits::real_value(delay_map);
+	typename traits::complex_array	pf			= traits::complex_value(phase_fact);
+
+	return bf_image_frames<T>(iq_signals, dm.dim1(), dm.dim2(), dm.dim3(),
+							  [&](const typename traits::complex_array& iq_frame, typename traits::real_array& out)
+	{
+		bf_image_oneway<T>(iq_frame, time, dm, pf, n_tx, n_rx, opts, out);
+	});
+}
+
+bool bf_is_oneway_map(const octave_value& delay_map, octave_idx_type n_tx, octave_idx_type n_rx)
+{
+	dim_vector dims = delay_map.dims();
+	return (dims.ndims()==4)&&(dims(3)==n_tx+n_rx);
+}
+
+//---------------------------------------------------
+// Matrix-free kernels
+// Geometry and delays are always evaluated in double precision,
+// only the projection and the combination run in precision T.
+template <typename T>
+struct bf_geometry_projector
+{
+	const std::complex<T>*	iq;
+	const NDArray&			time;
+	octave_idx_type			n_samples;
+	octave_idx_type			n_tx;
+	octave_idx_type			n_rx;
+	const double*			ptx;
+	const double*			prx;
+	double					k;
+	bool					uniform;
+	double					t0;
+	double					inv_ts;
+
+	bf_geometry_projector(const typename bf_traits<T>::complex_array& iq_signals, const NDArray& time_array,
+						  double freq, const NDArray& pos_tx, const NDArray& pos_rx)
+		: iq(iq_signals.data()), time(time_array), n_samples(time_array.numel()),
+		  n_tx(pos_tx.dim1()), n_rx(pos_rx.dim1()), ptx(pos_tx.data()), prx(pos_rx.data()), k(2.0*M_PI*freq)
+	{
+		double ts;
+		uniform = bf_uniform_time(time, t0, ts);
+		inv_ts	= uniform ? 1.0/ts : 0.0;
+	}
+
+	// Combined value at (xp, yp, zp); d_tx, d_rx and samples are per-thread scratch buffers
+	T value(double xp, double yp, double zp, const bf_options& opts, double* d_tx, double* d_rx, T* samples) const
+	{
+		const bf_interp_table<T>& table = bf_get_interp_table<T>(opts.interp);
+		// One-way distances are shared by all the pairs of the voxel
+		for (octave_idx_type t=0; t < n_tx; t++)
+		{
+			double dx = xp-ptx[t], dy = yp-ptx[t+n_tx], dz = zp-ptx[t+2*n_tx];
+			d_tx[t] = sqrt(dx*dx + dy*dy + dz*dz);
+		}
+		for (octave_idx_type r=0; r < n_rx; r++)
+		{
+			double dx = xp-prx[r], dy = yp-prx[r+n_rx], dz = zp-prx[r+2*n_rx];
+			d_rx[r] = sqrt(dx*dx + dy*dy + dz*dz);
+		}
+		for (octave_idx_type r=0; r < n_rx; r++)
+		{
+			for (octave_idx_type t=0; t < n_tx; t++)
+			{
+				octave_idx_type c	 = t + n_tx*r;
+				double			delay= (d_tx[t]+d_rx[r])/C0;
+				double			phase= k*delay;
+				octave_idx_type i0;
+				double			w;
+				if (uniform)
+					bf_sample_position_uniform(t0, inv_ts, n_samples, delay, i0, w);
+				else
+					bf_sample_position(time, delay, i0, w);
+				samples[c] = bf_project_interp<T>(iq + c*n_samples, n_samples, i0, (T)w,
+												  std::complex<T>((T)(delay*cos(phase)), (T)(delay*sin(phase))), table);
+			}
+		}
+		return bf_combine(opts, samples, n_tx*n_rx);
+	}
+};
+
+template <typename T>
+void bf_image_geometry(const typename bf_traits<T>::complex_array& iq_signals, const NDArray& time, const bf_geometry& geom,
+					   const bf_options& opts, typename bf_traits<T>::real_array& out)
+{
+	octave_idx_type nx	 = geom.x.numel();
+	octave_idx_type ny	 = geom.y.numel();
+	octave_idx_type nz	 = geom.z.numel();
+	T*				pout = out.fortran_vec();
+	bf_geometry_projector<T> proj(iq_signals, time, geom.freq, geom.pos_tx, geom.pos_rx);
+
+	bf_tiles tiles(nx, ny, nz);
+	bf_parallel_for(tiles.count(), tiles.chunk(), opts.n_threads, [&](octave_idx_type k_begin, octave_idx_type k_end)
+	{
+		std::vector<double> d_tx(proj.n_tx);
+		std::vector<double> d_rx(proj.n_rx);
+		std::vector<T>		samples(proj.n_tx*proj.n_rx);
+		for (octave_idx_type k=k_begin; k < k_end; k++)
+			tiles.for_each(k, [&](octave_idx_type v)
+			{
+				pout[v] = proj.value(geom.x.xelem(v % nx), geom.y.xelem((v / nx) % ny), geom.z.xelem(v / (nx*ny)),
+									 opts, d_tx.data(), d_rx.data(), samples.data());
+			});
+	});
+}
+
+template <typename T>
+void bf_image_points(const typename bf_traits<T>::complex_array& iq_signals, const NDArray& time, double freq,
+					 const NDArray& pos_tx, const NDArray& pos_rx, const NDArray& points,
+					 const bf_options& opts, typename bf_traits<T>::real_array& out)
+{
+	octave_idx_type n_pts = points.dim1();
+	const double*	pts	  = points.data();
+	T*				pout  = out.fortran_vec();
+	bf_geometry_projector<T> proj(iq_signals, time, freq, pos_tx, pos_rx);
+
+	// Points are usually few: small chunks keep all the threads busy
+	bf_parallel_for(n_pts, 16, opts.n_threads, [&](octave_idx_type m_begin, octave_idx_type m_end)
+	{
+		std::vector<double> d_tx(proj.n_tx);
+		std::vector<double> d_rx(proj.n_rx);
+		std::vector<T>		samples(proj.n_tx*proj.n_rx);
+		for (octave_idx_type m=m_begin; m < m_end; m++)
+			pout[m] = proj.value(pts[m], pts[m+n_pts], pts[m+2*n_pts], opts, d_tx.data(), d_rx.data(), samples.data());
+	});
+}
+
+//---------------------------------------------------
+// Plan
+// Sample positions are computed in double precision for both plan types
+template <typename T>
+bf_plan<T> bf_build_plan(const NDArray& time, const typename bf_traits<T>::real_array& delay_map,
+						 const typename bf_traits<T>::complex_array& phase_fact, int n_threads)
+{
+	bf_plan<T> plan;
+	dim_vector dims = delay_map.dims();
+	plan.nx = delay_map.dim1();
+	plan.ny = delay_map.dim2();
+	plan.nz = delay_map.dim3();
+	plan.n_tx = dims.ndims() > 3 ? dims(3) : 1;
+	plan.n_rx = dims.ndims() > 4 ? dims(4) : 1;
+	plan.n_samples = time.numel();
+
+	octave_idx_type n_ch  = plan.n_tx*plan.n_rx;
+	octave_idx_type n_vox = plan.nx*plan.ny*plan.nz;
+
+	plan.index = int32NDArray(dim_vector({n_ch, n_vox}));
+	plan.frac  = typename bf_traits<T>::real_array(dim_vector({n_ch, n_vox}));
+	plan.phase = typename bf_traits<T>::complex_array(dim_vector({n_ch, n_vox}));
+	plan.voxel = int32NDArray(dim_vector({1, n_vox}));
+
+	// Tile order of the voxels
+	bf_tiles		tiles(plan.nx, plan.ny, plan.nz);
+	octave_int32*	voxel = plan.voxel.fortran_vec();
+	octave_idx_type k	  = 0;
+	for (octave_idx_type tile=0; tile < tiles.count(); tile++)
+		tiles.for_each(tile, [&](octave_idx_type v) { voxel[k++] = octave_int32(v); });
+
+	double t0, ts;
+	bool   bUniform = bf_uniform_time(time, t0, ts);
+	double inv_ts	= bUniform ? 1.0/ts : 0.0;
+
+	const T*				dm	  = delay_map.data();
+	const std::complex<T>*	pf	  = phase_fact.data();
+	octave_int32*			index = plan.index.fortran_vec();
+	T*						frac  = plan.frac.fortran_vec();
+	std::complex<T>*		phase = plan.phase.fortran_vec();
+	bf_parallel_for(n_vox, BF_BLOCK, n_threads, [&](octave_idx_type k_begin, octave_idx_type k_end)
+	{
+		for (octave_idx_type k=k_begin; k < k_end; k++)
+		{
+			octave_idx_type v = voxel[k].value();
+			for (octave_idx_type c=0; c < n_ch; c++)
+			{
+				octave_idx_type i0;
+				double			w;
+				octave_idx_type src = v + n_vox*c;
+				octave_idx_type dst = c + n_ch*k;
+				if (bUniform)
+					bf_sample_position_uniform(t0, inv_ts, plan.n_samples, (double)dm[src], i0, w);
+				else
+					bf_sample_position(time, dm[src], i0, w);
+				index[dst] = octave_int32(i0);
+				frac[dst]  = (T)w;
+				phase[dst] = pf[src];
+			}
+		}
+	});
+	return plan;
+}
+
+template <typename T>
+octave_value bf_plan_to_value(const bf_plan<T>& plan)
+{
+	octave_scalar_map out;
+	NDArray dims(dim_vector({1,5}));
+	dims(0) = plan.nx;
+	dims(1) = plan.ny;
+	dims(2) = plan.nz;
+	dims(3) = plan.n_tx;
+	dims(4) = plan.n_rx;
+	out.assign("dims", dims);
+	out.assign("n_samples", octave_value((double)plan.n_samples));
+	out.assign("index", plan.index);
+	out.assign("frac",  plan.frac);
+	out.assign("phase", plan.phase);
+	out.assign("voxel", plan.voxel);
+	return octave_value(out);
+}
+
+bool bf_is_plan(const octave_value& value)
+{
+	if (!value.isstruct())
+		return false;
+	octave_scalar_map map = value.scalar_map_value();
+	return map.isfield("dims") && map.isfield("n_samples") &&
+		   map.isfield("index") && map.isfield("frac") && map.isfield("phase");
+}
+
+// The precision of a plan is the precision of its tables
+bool bf_plan_is_single(const octave_value& value)
+{
+	if (!bf_is_plan(value))
+		return false;
+	return value.scalar_map_value().getfield("frac").is_single_type();
+}
+
+template <typename T>
+bool bf_plan_from_value(const octave_value& value, bf_plan<T>& plan)
+{
+	if (!bf_is_plan(value))
+	{
+		error("plan must be a structure returned by signal_bf_plan");
+		return false;
+	}
+	octave_scalar_map map = value.scalar_map_value();
+	NDArray dims = map.getfield("dims").array_value();
+	if (dims.numel()!=5)
+	{
+		error("invalid plan dimensions");
+		return false;
+	}
+	plan.nx			= dims(0);
+	plan.ny			= dims(1);
+	plan.nz			= dims(2);
+	plan.n_tx		= dims(3);
+	plan.n_rx		= dims(4);
+	plan.n_samples	= map.getfield("n_samples").idx_type_value();
+	plan.index		= map.getfield("index").int32_array_value();
+	plan.frac		= bf_traits<T>::real_value(map.getfield("frac"));
+	plan.phase		= bf_traits<T>::complex_value(map.getfield("phase"));
+
+	octave_idx_type n_ch  = plan.n_tx*plan.n_rx;
+	octave_idx_type n_vox = plan.nx*plan.ny*plan.nz;
+	if ((plan.index.numel()!=n_ch*n_vox)||(plan.frac.numel()!=n_ch*n_vox)||(plan.phase.numel()!=n_ch*n_vox))
+	{
+		error("plan tables not consistent with plan dimensions");
+		return false;
+	}
+	// The kernel clamps sample positions to index / index+1 inside the time support
+	if (plan.n_samples < 2)
+	{
+		error("plan must refer to at least two time samples");
+		return false;
+	}
+	// Plans without a voxel table are stored in map order
+	if (map.isfield("voxel"))
+		plan.voxel = map.getfield("voxel").int32_array_value();
+	else
+	{
+		plan.voxel = int32NDArray(dim_vector({1, n_vox}));
+		for (octave_idx_type k=0; k < n_vox; k++)
+			plan.voxel.xelem(k) = octave_int32(k);
+	}
+	if (plan.voxel.numel()!=n_vox)
+	{
+		error("plan tables not consistent with plan dimensions");
+		return false;
+	}
+	// Every output voxel must be written exactly once by exactly one thread
+	std::vector<bool> seen(n_vox, false);
+	for (octave_idx_type k=0; k < n_vox; k++)
+	{
+		octave_idx_type v = plan.voxel.xelem(k).value();
+		if ((v < 0)||(v >= n_vox)||seen[v])
+		{
+			error("plan voxel table is not a permutation of the voxels");
+			return false;
+		}
+		seen[v] = true;
+	}
+	return true;
+}
+
+//---------------------------------------------------
+// Plan kernel
+template <typename T>
+void bf_image_plan(const typename bf_traits<T>::complex_array& iq_signals, const bf_plan<T>& plan,
+				   const bf_options& opts, typename bf_traits<T>::real_array& out)
+{
+	octave_idx_type n_ch  = plan.n_tx*plan.n_rx;
+	octave_idx_type n_vox = plan.nx*plan.ny*plan.nz;
+	const std::complex<T>*	iq		= iq_signals.data();
+	const octave_int32*		index	= plan.index.data();
+	const T*				frac	= plan.frac.data();
+	const std::complex<T>*	phase	= plan.phase.data();
+	const octave_int32*		voxel	= plan.voxel.data();
+	T*						pout	= out.fortran_vec();
+	const bf_interp_table<T>& table = bf_get_interp_table<T>(opts.interp);
+
+	bf_parallel_for(n_vox, BF_BLOCK, opts.n_threads, [&](octave_idx_type v_begin, octave_idx_type v_end)
+	{
+		std::vector<T> samples(n_ch);
+		for (octave_idx_type v=v_begin; v < v_end; v++)
+		{
+			octave_idx_type base = n_ch*v;
+			for (octave_idx_type c=0; c < n_ch; c++)
+			{
+				const std::complex<T>* iq_ch = iq + c*plan.n_samples;
+				// Corrupted tables stay inside the time support (a NaN weight reads as 0)
+				octave_idx_type i0 = std::min(std::max((octave_idx_type)index[base+c].value(), (octave_idx_type)0), plan.n_samples-2);
+				T				w  = std::min(T(1), std::max(T(0), frac[base+c]));
+				samples[c] = bf_project_interp(iq_ch, plan.n_samples, i0, w, phase[base+c], table);
+			}
+			pout[voxel[v].value()] = bf_combine(opts, samples.data(), n_ch);
+		}
+	});
+}
+
+template <typename T>
+octave_value bf_image_plan_value(const octave_value& signals, const octave_value& plan_value, const bf_options& opts)
+{
+	bf_plan<T> plan;
+	if (!bf_plan_from_value(plan_value, plan))
+		return octave_value();
+
+	typedef bf_traits<T> traits;
+	typename traits::complex_array iq_signals = traits::complex_value(signals);
+	octave_idx_type time_samples = iq_signals.numel();
+	int n_tx = 1;
+	int n_rx = 1;
+	if (iq_signals.ndims()!=2)
+	{
+		n_tx = iq_signals.dim2();
+		n_rx = iq_signals.dim3();
+		time_samples = iq_signals.dim1();
+	}
+	if ((plan.n_tx!=n_tx)||(plan.n_rx!=n_rx)||(plan.n_samples!=time_samples))
+	{
+		error("plan not consistent with BB data");
+		return octave_value();
+	}
+	return bf_image_frames<T>(iq_signals, plan.nx, plan.ny, plan.nz,
+							  [&](const typename traits::complex_array& iq_frame, typename traits::real_array& out)
+	{
+		bf_image_plan<T>(iq_frame, plan, opts, out);
+	});
+}
+
+//---------------------------------------------------
+// Explicit instantiations
+#define BF_INSTANTIATE(T) \
+	template void bf_image_search<T>(const bf_traits<T>::complex_array&, const NDArray&, const bf_traits<T>::real_array&, \
+									 const bf_traits<T>::complex_array&, const bf_options&, bf_traits<T>::real_array&); \
+	template void bf_image_uniform<T>(const bf_traits<T>::complex_array&, const bf_traits<T>::real_array&, \
+									  const bf_traits<T>::complex_array&, double, double, const bf_options&, bf_traits<T>::real_array&); \
+	template octave_value bf_image_maps<T>(const octave_value&, const NDArray&, const octave_value&, const octave_value&, const bf_options&); \
+	template void bf_image_oneway<T>(const bf_traits<T>::complex_array&, const NDArray&, const bf_traits<T>::real_array&, \
+									 const bf_traits<T>::complex_array&, octave_idx_type, octave_idx_type, const bf_options&, \
+									 bf_traits<T>::real_array&); \
+	template octave_value bf_image_oneway_maps<T>(const octave_value&, const NDArray&, const octave_value&, const octave_value&, \
+												  octave_idx_type, octave_idx_type, const bf_options&); \
+	template void bf_image_geometry<T>(const bf_traits<T>::complex_array&, const NDArray&, const bf_geometry&, \
+									   const bf_options&, bf_traits<T>::real_array&); \
+	template void bf_image_points<T>(const bf_traits<T>::complex_array&, const NDArray&, double, const NDArray&, const NDArray&, \
+									 const NDArray&, const bf_options&, bf_traits<T>::real_array&); \
+	template bf_plan<T> bf_build_plan<T>(const NDArray&, const bf_traits<T>::real_array&, const bf_traits<T>::complex_array&, int); \
+	template octave_value bf_plan_to_value<T>(const bf_plan<T>&); \
+	template bool bf_plan_from_value<T>(const octave_value&, bf_plan<T>&); \
+	template void bf_image_plan<T>(const bf_traits<T>::complex_array&, const bf_plan<T>&, const bf_options&, bf_traits<T>::real_array&); \
+	template octave_value bf_image_plan_value<T>(const octave_value&, const octave_value&, const bf_options&); \
+	template const bf_interp_table<T>& bf_get_interp_table<T>(bf_interp);
+
+BF_INSTANTIATE(double)
+BF_INSTANTIATE(float)
+
+//---------------------------------------------------
+// Cycle sequence imaging
+bool bf_radar_cycles_from_value(const octave_value& hradar, octave_idx_type n_streams, bf_radar_cycles& cycles)
+{
+	if (!hradar.isstruct())
+	{
+		error("hradar must be a structure");
+		return false;
+	}
+	octave_scalar_map map = hradar.scalar_map_value();
+	const char* fields[] = {"CoreFrequency", "txCenterFrequency", "FixedTxToAntennaDelays", "FixedRxToAntennaDelays",
+							"TxAntPosition", "RxAntPosition", "TxRxCycle"};
+	for (const char* f : fields)
+	{
+		if (!map.isfield(f))
+		{
+			error("hradar.%s is missing", f);
+			return false;
+		}
+	}
+	cycles.fadc		= map.getfield("CoreFrequency").double_value();
+	cycles.fc		= map.getfield("txCenterFrequency").double_value();
+	cycles.delay_tx = map.getfield("FixedTxToAntennaDelays").array_value();
+	cycles.delay_rx = map.getfield("FixedRxToAntennaDelays").array_value();
+	cycles.pos_tx	= map.getfield("TxAntPosition").array_value();
+	cycles.pos_rx	= map.getfield("RxAntPosition").array_value();
+	if (cycles.fadc <= 0)
+	{
+		error("hradar.CoreFrequency must be positive");
+		return false;
+	}
+	if ((cycles.pos_tx.dim2()!=3)||(cycles.pos_rx.dim2()!=3))
+	{
+		error("antenna positions must be n by 3 matrices");
+		return false;
+	}
+
+	// TxRxCycle is (2, NumAntennas, NumCycles)
+	NDArray seq = map.getfield("TxRxCycle").array_value();
+	octave_idx_type n_ant	 = seq.dim2();
+	octave_idx_type n_cycles = seq.numel()/(2*n_ant);
+	if ((seq.dim1()!=2)||(n_cycles!=n_streams))
+	{
+		error("Number of streams must match the antenna sequence description");
+		return false;
+	}
+	cycles.tx = Array<int>(dim_vector({n_cycles,1}));
+	cycles.rx = Array<int>(dim_vector({n_cycles,1}));
+	for (octave_idx_type n=0; n < n_cycles; n++)
+	{
+		int n_active_tx = 0, n_active_rx = 0;
+		for (octave_idx_type a=0; a < n_ant; a++)
+		{
+			if (seq(0 + 2*(a + n_ant*n)) == 1)
+			{
+				n_active_tx++;
+				cycles.tx(n) = a;
+			}
+			if (seq(1 + 2*(a + n_ant*n)) == 1)
+			{
+				n_active_rx++;
+				cycles.rx(n) = a;
+			}
+		}
+		if ((n_active_tx!=1)||(n_active_rx!=1))
+		{
+			error("Invalid Tx Rx scan combination");
+			return false;
+		}
+		if ((cycles.tx(n) >= cycles.pos_tx.dim1())||(cycles.rx(n) >= cycles.pos_rx.dim1())||
+			(cycles.tx(n) >= cycles.delay_tx.numel())||(cycles.rx(n) >= cycles.delay_rx.numel()))
+		{
+			error("antenna positions or fixed delays not consistent with hradar.TxRxCycle");
+			return false;
+		}
+	}
+	return true;
+}
+
+bool bf_parse_reconstruction(const octave_value& algorithm, bool& das, bool& sr)
+{
+	std::string alg = algorithm.isempty() ? "DAS" : (algorithm.is_string() ? algorithm.string_value() : "");
+	das = (alg=="DAS")||(alg=="DAS_SR");
+	sr	= (alg=="DAS_SR")||(alg=="DMAS_SR");
+	if ((!das)&&(alg!="DMAS")&&(alg!="DMAS_SR"))
+	{
+		error("Invalid algorithm type");
+		return false;
+	}
+	return true;
+}
+
+void bf_image_cycles(const ComplexNDArray& streams, const bf_radar_cycles& cycles, const bf_polar_grid& grid,
+					 bool das, bool sr, int n_threads, ComplexNDArray& out)
+{
+	octave_idx_type n_cycles  = streams.dim1();
+	octave_idx_type n_samples = streams.numel()/n_cycles;
+	octave_idx_type n_rho	  = grid.rho.numel();
+	octave_idx_type n_dir	  = grid.dir.dim1();
+	octave_idx_type n_tx_ant  = cycles.pos_tx.dim1();
+	octave_idx_type n_rx_ant  = cycles.pos_rx.dim1();
+	double			t_max	  = n_samples/cycles.fadc;
+	double			k		  = 2.0*M_PI*cycles.fc;
+
+	// One stream per column, so that every cycle is contiguous
+	std::vector<Complex> data(n_samples*n_cycles);
+	for (octave_idx_type n=0; n < n_cycles; n++)
+		for (octave_idx_type s=0; s < n_samples; s++)
+			data[s + n_samples*n] = streams.xelem(n + n_cycles*s);
+
+	const double* ptx = cycles.pos_tx.data();
+	const double* prx = cycles.pos_rx.data();
+	const double* dir = grid.dir.data();
+	Complex*	  pout= out.fortran_vec();
+
+	bf_parallel_for(n_rho*n_dir, BF_BLOCK, n_threads, [&](octave_idx_type v_begin, octave_idx_type v_end)
+	{
+		// One-way distances are shared by all the cycles using the antenna
+		std::vector<double> d_tx(n_tx_ant);
+		std::vector<double> d_rx(n_rx_ant);
+		for (octave_idx_type v=v_begin; v < v_end; v++)
+		{
+			octave_idx_type ir = grid.rho_first ? v % n_rho : v / n_dir;
+			octave_idx_type id = grid.rho_first ? v / n_rho : v % n_dir;
+			double r  = grid.rho.xelem(ir);
+			double xp = r*dir[id];
+			double yp = r*dir[id + n_dir];
+			double zp = r*dir[id + 2*n_dir];
+			for (octave_idx_type a=0; a < n_tx_ant; a++)
+			{
+				double dx = xp-ptx[a], dy = yp-ptx[a+n_tx_ant], dz = zp-ptx[a+2*n_tx_ant];
+				d_tx[a] = sqrt(dx*dx + dy*dy + dz*dz);
+			}
+			for (octave_idx_type a=0; a < n_rx_ant; a++)
+			{
+				double dx = xp-prx[a], dy = yp-prx[a+n_rx_ant], dz = zp-prx[a+2*n_rx_ant];
+				d_rx[a] = sqrt(dx*dx + dy*dy + dz*dz);
+			}
+
+			// Running sums: sum p, sum |p|^2 and sum_{a<b} p_a conj(p_b)
+			Complex sum	  = 0;
+			Complex cross = 0;
+			double	power = 0;
+			for (octave_idx_type n=0; n < n_cycles; n++)
+			{
+				int    tx	= cycles.tx.xelem(n);
+				int    rx	= cycles.rx.xelem(n);
+				double tfly = (d_tx[tx] + d_rx[rx])/C0 + cycles.delay_tx.xelem(tx) + cycles.delay_rx.xelem(rx);
+				Complex p	= 0;
+				if ((tfly >= 0)&&(tfly <= t_max))
+				{
+					// Linear interpolation, the sample after the last one is zero
+					double			pos = tfly*cycles.fadc;
+					octave_idx_type i0	= (octave_idx_type)pos;
+					if (i0 < n_samples)
+					{
+						double	w  = pos-i0;
+						Complex s0 = data[i0 + n_samples*n];
+						Complex s1 = (i0+1 < n_samples) ? data[i0 + 1 + n_samples*n] : Complex(0);
+						p = (s0 + (s1-s0)*w) * std::polar(1.0, k*tfly);
+					}
+				}
+				cross += sum*std::conj(p);
+				sum   += p;
+				power += std::norm(p);
+			}
+
+			Complex value = das ? sum/(double)n_cycles : cross;
+			if (sr)
+				value *= power > 0 ? std::norm(sum)/(n_cycles*power) : 0.0;
+			pout[v] = value;
+		}
+	});
+}
@@ -34,10 +34,268 @@
 
 #include <octave/oct.h>
 #include <octave/ov-struct.h>
+#include <vector>
 #include "aria_uwb_toolbox.h"
+#include "aria_beamforming.h"
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
 
 inline double sqr(double x) {return x*x;}
 
+enum grid_type {GRID_CARTESIAN, GRID_POLAR, GRID_SPHERICAL};
+
+// In place p[i] = sqrt(max(p[i], 0)) over a contiguous run
+static void sqrt_run(double* p, octave_idx_type n)
+{
+	octave_idx_type i = 0;
+#if defined(__AVX512F__)
+	__m512d zero8 = _mm512_setzero_pd();
+	for (; i+8 <= n; i+=8)
+		_mm512_storeu_pd(p+i, _mm512_sqrt_pd(_mm512_max_pd(_mm512_loadu_pd(p+i), zero8)));
+#endif
+#if defined(__AVX2__) || defined(__AVX512F__)
+	__m256d zero4 = _mm256_setzero_pd();
+	for (; i+4 <= n; i+=4)
+		_mm256_storeu_pd(p+i, _mm256_sqrt_pd(_mm256_max_pd(_mm256_loadu_pd(p+i), zero4)));
+#endif
+	for (; i < n; i++)
+		p[i] = sqrt(std::max(p[i], 0.0));
+}
+
+// One-way antenna distances dist(v + n_vox*a), voxels in (x, y, z) order.
+// Threads run over (antenna, z) planes, rows along x are contiguous:
+// (x-xa)^2 is computed once per antenna and every row is an add and a sqrt_run.
+static void one_way_cartesian(const NDArray& xv, const NDArray& yv, const NDArray& zv, const NDArray& pos, NDArray& dist, int n_threads)
+{
+	octave_idx_type nx	  = xv.numel();
+	octave_idx_type ny	  = yv.numel();
+	octave_idx_type nz	  = zv.numel();
+	octave_idx_type n_vox = nx*ny*nz;
+	double*			pd	  = dist.fortran_vec();
+	bf_parallel_for(pos.dim1()*nz, 1, n_threads, [&](octave_idx_type begin, octave_idx_type end)
+	{
+		std::vector<double> dx2(nx);
+		for (octave_idx_type item=begin; item < end; item++)
+		{
+			octave_idx_type a = item / nz;
+			octave_idx_type z = item % nz;
+			for (octave_idx_type x=0; x < nx; x++)
+				dx2[x] = sqr(xv.xelem(x)-pos.xelem(a,0));
+			double dz2 = sqr(zv.xelem(z)-pos.xelem(a,2));
+			for (octave_idx_type y=0; y < ny; y++)
+			{
+				double	dyz = sqr(yv.xelem(y)-pos.xelem(a,1)) + dz2;
+				double* row = pd + nx*(y + ny*z) + n_vox*a;
+				for (octave_idx_type x=0; x < nx; x++)
+					row[x] = dx2[x] + dyz;
+				sqrt_run(row, nx);
+			}
+		}
+	});
+}
+
+// One-way antenna distances on a radial grid, voxel = rho * u with u a unit direction.
+// |rho*u - a| = sqrt(rho^2 - 2*rho*(u.a) + |a|^2): u.a and |a|^2 are computed once per
+// direction and antenna, each voxel only costs a multiply-add and the square root.
+// rho_first selects the (rho x dir) voxel order, otherwise (dir x rho); threads run
+// over the antennas and the outer voxel index, the inner one is contiguous.
+static void one_way_radial(const NDArray& rho, const NDArray& dir, bool rho_first, const NDArray& pos, NDArray& dist, int n_threads)
+{
+	octave_idx_type n_rho = rho.numel();
+	octave_idx_type n_dir = dir.dim1();
+	octave_idx_type n_vox = n_rho*n_dir;
+	octave_idx_type n_out = rho_first ? n_dir : n_rho;
+	double*			pd	  = dist.fortran_vec();
+	bf_parallel_for(pos.dim1()*n_out, 1, n_threads, [&](octave_idx_type begin, octave_idx_type end)
+	{
+		for (octave_idx_type item=begin; item < end; item++)
+		{
+			octave_idx_type a = item / n_out;
+			octave_idx_type o = item % n_out;
+			double c = sqr(pos.xelem(a,0)) + sqr(pos.xelem(a,1)) + sqr(pos.xelem(a,2));
+			if (rho_first)
+			{
+				double	b	= dir.xelem(o,0)*pos.xelem(a,0) + dir.xelem(o,1)*pos.xelem(a,1) + dir.xelem(o,2)*pos.xelem(a,2);
+				double* run = pd + n_rho*o + n_vox*a;
+				for (octave_idx_type r=0; r < n_rho; r++)
+				{
+					double rv = rho.xelem(r);
+					run[r] = rv*(rv - 2.0*b) + c;
+				}
+				sqrt_run(run, n_rho);
+			}
+			else
+			{
+				double	rv	= rho.xelem(o);
+				double* run = pd + n_dir*o + n_vox*a;
+				for (octave_idx_type d=0; d < n_dir; d++)
+				{
+					double b = dir.xelem(d,0)*pos.xelem(a,0) + dir.xelem(d,1)*pos.xelem(a,1) + dir.xelem(d,2)*pos.xelem(a,2);
+					run[d] = rv*(rv - 2.0*b) + c;
+				}
+				sqrt_run(run, n_dir);
+			}
+		}
+	});
+}
+
+// One-way unit phasors exp(j*k*d/C0) of every antenna, stored as separate real and imaginary
+// planes: the pair phasor is their product, so sin/cos run n_vox*(n_tx+n_rx) times
+// instead of n_vox*n_tx*n_rx
+static void one_way_phasors(const NDArray& dist, double k, NDArray& re, NDArray& im, int n_threads)
+{
+	const double* pd = dist.data();
+	double*		  pr = re.fortran_vec();
+	double*		  pi = im.fortran_vec();
+	bf_parallel_for(dist.numel(), 4096, n_threads, [&](octave_idx_type begin, octave_idx_type end)
+	{
+		for (octave_idx_type i=begin; i < end; i++)
+		{
+			double phase = k*pd[i]/C0;
+			pr[i] = cos(phase);
+			pi[i] = sin(phase);
+		}
+	});
+}
+
+// Delays and phases are always computed in double precision and stored as T.
+// Threads run over the (tx, rx) pairs, every pair is a contiguous run of voxels:
+// delay = (d_tx + d_rx)/C0, phase_fact = delay*phasor_tx*phasor_rx
+template <typename T, typename real_array, typename complex_array>
+static void fill_delay_map(const NDArray& d_tx, const NDArray& d_rx, double freq, real_array& out_delay, complex_array& out_phase,
+						   int n_threads)
+{
+	octave_idx_type n_tx  = d_tx.dim2();
+	octave_idx_type n_rx  = d_rx.dim2();
+	octave_idx_type n_vox = d_tx.dim1();
+
+	double k = 2.0*M_PI*freq;
+	NDArray re_tx(d_tx.dims()), im_tx(d_tx.dims()), re_rx(d_rx.dims()), im_rx(d_rx.dims());
+	one_way_phasors(d_tx, k, re_tx, im_tx, n_threads);
+	one_way_phasors(d_rx, k, re_rx, im_rx, n_threads);
+
+	T*				 pd = out_delay.fortran_vec();
+	std::complex<T>* pp = out_phase.fortran_vec();
+	bf_parallel_for(n_tx*n_rx, 1, n_threads, [&](octave_idx_type begin, octave_idx_type end)
+	{
+		for (octave_idx_type c=begin; c < end; c++)
+		{
+			octave_idx_type t	 = c % n_tx;
+			octave_idx_type r	 = c / n_tx;
+			const double*	dt	 = d_tx.data()  + n_vox*t;
+			const double*	dr	 = d_rx.data()  + n_vox*r;
+			const double*	ct	 = re_tx.data() + n_vox*t;
+			const double*	st	 = im_tx.data() + n_vox*t;
+			const double*	cr	 = re_rx.data() + n_vox*r;
+			const double*	sr	 = im_rx.data() + n_vox*r;
+			T*				 od = pd + n_vox*c;
+			std::complex<T>* op = pp + n_vox*c;
+			for (octave_idx_type v=0; v < n_vox; v++)
+			{
+				double delay = (dt[v] + dr[v])/C0;
+				od[v] = (T)delay;
+				op[v] = std::complex<T>((T)(delay*(ct[v]*cr[v] - st[v]*sr[v])), (T)(delay*(ct[v]*sr[v] + st[v]*cr[v])));
+			}
+		}
+	});
+}
+
+// Separable tables: one-way delays d/C0 and unit phasors exp(j*2*pi*freq*d/C0) of the tx
+// antennas followed by the rx antennas, (voxels x (n_tx + n_rx)).
+// The pair values are delay = delay_tx + delay_rx, phase_fact = delay*phasor_tx*phasor_rx.
+template <typename T, typename real_array, typename complex_array>
+static void fill_oneway_map(const NDArray& d_tx, const NDArray& d_rx, double freq, real_array& out_delay, complex_array& out_phase,
+							int n_threads)
+{
+	octave_idx_type n_tx  = d_tx.dim2();
+	octave_idx_type n_vox = d_tx.dim1();
+
+	double k = 2.0*M_PI*freq;
+	T*				 pd = out_delay.fortran_vec();
+	std::complex<T>* pp = out_phase.fortran_vec();
+	for (const NDArray* d : {&d_tx, &d_rx})
+	{
+		octave_idx_type base = d==&d_tx ? 0 : n_vox*n_tx;
+		const double*	pdist = d->data();
+		bf_parallel_for(d->numel(), 4096, n_threads, [&](octave_idx_type begin, octave_idx_type end)
+		{
+			for (octave_idx_type i=begin; i < end; i++)
+			{
+				double delay = pdist[i]/C0;
+				pd[base + i] = (T)delay;
+				pp[base + i] = std::complex<T>((T)cos(k*delay), (T)sin(k*delay));
+			}
+		});
+	}
+}
+
+// Virtual array: with the monostatic-equivalent approximation a (tx, rx) pair is an
+// element at the phase centre (tx + rx)/2 and pairs sharing it are redundant.
+// group(t + n_tx*r) is the element of the pair, elements in order of first pair;
+// centres within tol of an element are merged into it.
+static octave_idx_type virtual_elements(const NDArray& pos_tx, const NDArray& pos_rx, double tol, NDArray& centres,
+										std::vector<octave_idx_type>& group)
+{
+	octave_idx_type		n_tx = pos_tx.dim1();
+	octave_idx_type		n_rx = pos_rx.dim1();
+	std::vector<double> c;
+	group.resize(n_tx*n_rx);
+	for (octave_idx_type r=0; r < n_rx; r++)
+		for (octave_idx_type t=0; t < n_tx; t++)
+		{
+			double			p[3];
+			octave_idx_type v = 0, n_v = c.size()/3;
+			for (int d=0; d < 3; d++)
+				p[d] = 0.5*(pos_tx.xelem(t,d) + pos_rx.xelem(r,d));
+			for (; v < n_v; v++)
+				if ((fabs(c[3*v]-p[0]) <= tol)&&(fabs(c[3*v+1]-p[1]) <= tol)&&(fabs(c[3*v+2]-p[2]) <= tol))
+					break;
+			if (v==n_v)
+				c.insert(c.end(), p, p+3);
+			group[t + n_tx*r] = v;
+		}
+	octave_idx_type n_v = c.size()/3;
+	centres = NDArray(dim_vector({n_v, 3}));
+	for (octave_idx_type v=0; v < n_v; v++)
+		for (int d=0; d < 3; d++)
+			centres(v,d) = c[3*v+d];
+	return n_v;
+}
+
+// Maps of the virtual elements: delay = 2*d/C0, phase_fact = delay*exp(j*2*pi*freq*delay)
+// with d the distance from the phase centre, the monostatic pair of build_delay_map
+template <typename T, typename real_array, typename complex_array>
+static void fill_virtual_map(const NDArray& d_v, double freq, real_array& out_delay, complex_array& out_phase, int n_threads)
+{
+	double			 k	= 2.0*M_PI*freq;
+	const double*	 pv = d_v.data();
+	T*				 pd = out_delay.fortran_vec();
+	std::complex<T>* pp = out_phase.fortran_vec();
+	bf_parallel_for(d_v.numel(), 4096, n_threads, [&](octave_idx_type begin, octave_idx_type end)
+	{
+		for (octave_idx_type i=begin; i < end; i++)
+		{
+			double delay = 2.0*pv[i]/C0;
+			pd[i] = (T)delay;
+			pp[i] = std::complex<T>((T)(delay*cos(k*delay)), (T)(delay*sin(k*delay)));
+		}
+	});
+}
+
+static bool check_vector(const octave_value& arg, const char* name, NDArray& out)
+{
+	bool vector = (arg.ndims()==2) && (arg.dims().num_ones()>=1);
+	if ((!vector)||(!arg.isreal()))
+	{
+		error("%s must be a real vector", name);
+		return false;
+	}
+	out = arg.array_value();
+	return true;
+}
+
 DEFUN_DLD(build_delay_map, args, nargout, "-*- texinfo -*-\n\
 @deftypefn {} {@var{map_out},@var{cos_map},@var{sin_map} =} build_das_map (@var{x}, @var{y}, @var{z}, @var{frf}, @var{pos_tx}, @var{pos_rx})\n\
 Return the space-to-delay map and sin/cos constant.\n\
@@ -45,118 +303,307 @@ Return the space-to-delay map and sin/cos constant.\n\
 @var{frf} is the RF frequency \n\
 @var{pos_tx} is a n x 3 matrix where n is the number of transmitter antennas \n\
 @var{pos_rx} is a n x 3 matrix where n is the number of receiver    antennas \n\
+@deftypefnx {} {@var{map_out},@var{phase_fact} =} build_das_map (\"polar\", @var{rho}, @var{phi}, @var{frf}, @var{pos_tx}, @var{pos_rx})\n\
+Polar grid of imageReconstruction: the voxels are (0, rho sin(phi), rho cos(phi)) \n\
+and the maps are (phi x rho x 1 x n_tx x n_rx).\n\
+@deftypefnx {} {@var{map_out},@var{phase_fact} =} build_das_map (\"spherical\", @var{rho}, @var{theta}, @var{phi}, @var{frf}, @var{pos_tx}, @var{pos_rx})\n\
+Spherical grid of imageReconstruction_3D: the voxels are \n\
+(rho cos(theta) sin(phi), rho sin(theta) sin(phi), rho cos(phi)) \n\
+and the maps are (rho x theta x phi x n_tx x n_rx).\n\
+@deftypefnx {} {@var{map_out},@var{phase_fact} =} build_das_map (@dots{}, @var{class})\n\
+@var{class} is \"double\" (default) or \"single\": single maps select the single precision \n\
+path of signal_das, signal_fdmas and signal_bf_plan. \n\
+@deftypefnx {} {@var{map_out},@var{phase_fact} =} build_das_map (@dots{}, \"oneway\")\n\
+Return the separable one-way tables instead of the (n_tx x n_rx) maps: @var{map_out} holds \n\
+the one-way delays and @var{phase_fact} the unit phasors exp(j*2*pi*frf*delay) of the tx \n\
+antennas followed by the rx antennas, in (grid x (n_tx + n_rx)) format. \n\
+signal_das and signal_fdmas accept them in place of the maps and form the pair delay \n\
+delay_tx + delay_rx and phase factor (delay_tx + delay_rx)*phasor_tx*phasor_rx on the fly, \n\
+so the memory is (n_tx + n_rx)/(n_tx * n_rx) of the full maps. \n\
+@deftypefnx {} {[@var{map_out},@var{phase_fact},@var{group}] =} build_das_map (@dots{}, \"virtual\")\n\
+Collapse the redundant (tx, rx) pairs of a MIMO layout: with the monostatic-equivalent \n\
+approximation a pair is a virtual element at its phase centre (pos_tx + pos_rx)/2, with \n\
+delay 2*|p - centre|/C0, and the pairs sharing a centre (within 1 um) have the same maps. \n\
+The maps are built only for the n_v unique elements, in (grid x 1 x n_v) format, and \n\
+@var{group} is the n_tx x n_rx matrix of the element of every pair (one based). \n\
+signal_virtual_sum (@var{signals}, @var{group}) pre-sums the BB data of the redundant pairs \n\
+coherently, so signal_das runs over n_v channels instead of n_tx * n_rx.\n\
+@deftypefnx {} {@var{map_out},@var{phase_fact} =} build_das_map (@dots{}, @var{n_threads})\n\
+@var{n_threads} is the number of threads (default: all cores). The one-way distances are \n\
+computed once per antenna and the sin/cos once per antenna and voxel, the (n_tx x n_rx) maps \n\
+are then filled pair by pair with contiguous writes.\n\
+@seealso{signal_virtual_sum, signal_das}\n\
 @end deftypefn")
 {
+	int nargs = args.length();
 
-	if (args.length()!=6)
+	// Grid type: cartesian (x, y, z), polar (rho, phi) or spherical (rho, theta, phi)
+	grid_type grid = GRID_CARTESIAN;
+	int first = 0;
+	if ((nargs >= 1) && args(0).is_string())
 	{
-		print_usage();
-		return octave_value();
+		std::string type = args(0).string_value();
+		if (type=="polar")
+			grid = GRID_POLAR;
+		else if (type=="spherical")
+			grid = GRID_SPHERICAL;
+		else
+		{
+			error("grid must be \"polar\" or \"spherical\"");
+			return octave_value();
+		}
+		first = 1;
 	}
-	// Check x
-	bool vector = (args(0).ndims()==2) && (args(0).dims().num_ones()>=1);
-	if ((!vector)||(!args(0).isreal()))
+	int n_axes = grid==GRID_POLAR ? 2 : 3;
+	int ifreq  = first + n_axes;
+
+	if ((nargs < ifreq+3)||(nargs > ifreq+6))
 	{
-		error("x must be a real vector");
+		print_usage();
 		return octave_value();
 	}
-	int nx = args(0).numel();
-	NDArray xv=args(0).array_value();
-
-	// Check y
-	vector = (args(1).ndims()==2) && (args(1).dims().num_ones()>=1);
-	if ((!vector)||(!args(1).isreal()))
+	// Output class, layout and thread count
+	bool bSingle   = false;
+	bool bOneWay   = false;
+	bool bVirtual  = false;
+	int  n_threads = bf_default_threads();
+	for (int i=ifreq+3; i < nargs; i++)
 	{
-		error("y must be a real vector");
-		return octave_value();
+		if (!args(i).is_string())
+		{
+			if (!bf_threads_from_value(args(i), n_threads))
+				return octave_value();
+			continue;
+		}
+		std::string opt = args(i).is_string() ? args(i).string_value() : "";
+		if ((opt!="single")&&(opt!="double")&&(opt!="oneway")&&(opt!="virtual"))
+		{
+			error("options must be \"single\", \"double\", \"oneway\" or \"virtual\"");
+			return octave_value();
+		}
+		if (opt=="oneway")
+			bOneWay = true;
+		else if (opt=="virtual")
+			bVirtual = true;
+		else
+			bSingle = opt=="single";
 	}
-
-	int ny = args(1).numel();
-	NDArray yv=args(1).array_value();
-
-	// Check z
-	vector = (args(2).ndims()==2) && (args(2).dims().num_ones()>=1);
-	if ((!vector)||(!args(2).isreal()))
+	if (bOneWay && bVirtual)
 	{
-		error("z must be a real vector");
+		error("\"oneway\" and \"virtual\" cannot be combined");
 		return octave_value();
 	}
-	int nz = args(2).numel();
 
-	NDArray zv=args(2).array_value();
+	// Check coordinates
+	const char* cartesian_names[] = {"x", "y", "z"};
+	const char* polar_names[]	  = {"rho", "phi"};
+	const char* spherical_names[] = {"rho", "theta", "phi"};
+	const char** names = grid==GRID_CARTESIAN ? cartesian_names : (grid==GRID_POLAR ? polar_names : spherical_names);
+	NDArray axes[3];
+	for (int i=0; i < n_axes; i++)
+		if (!check_vector(args(first+i), names[i], axes[i]))
+			return octave_value();
+
 	// Check freq
-	bool number = (args(3).dims().num_ones()==args(3).ndims());
-	if ((!number)||(!args(3).isreal())||(args(3).array_value()(0)<=0))
+	bool number = (args(ifreq).dims().num_ones()==args(ifreq).ndims());
+	if ((!number)||(!args(ifreq).isreal())||(args(ifreq).array_value()(0)<=0))
 	{
 		error("freq must be a single positive value");
 		return octave_value();
 	}
-	double freq = args(3).array_value()(0);
+	double freq = args(ifreq).array_value()(0);
 
 	// Check tx-pos
-	if ((args(4).dims()(1)!=3)||(!args(4).isreal()))
+	if ((args(ifreq+1).dims()(1)!=3)||(!args(ifreq+1).isreal()))
 	{
 		error("tx position must be a n by 3 real matrix");
 		return octave_value();
 	}
-	int n_tx = args(4).dims()(0);
-	NDArray pos_tx = args(4).array_value();
+	int n_tx = args(ifreq+1).dims()(0);
+	NDArray pos_tx = args(ifreq+1).array_value();
 
-	if ((args(5).dims()(1)!=3)||(!args(5).isreal()))
+	if ((args(ifreq+2).dims()(1)!=3)||(!args(ifreq+2).isreal()))
 	{
 		error("rx position must be a n by 3 real matrix");
 		return octave_value();
 	}
-	NDArray pos_rx = args(5).array_value();
-	int n_rx = args(5).dims()(0);
+	NDArray pos_rx = args(ifreq+2).array_value();
+	int n_rx = args(ifreq+2).dims()(0);
 
-	NDArray			out_delay(dim_vector({nx,ny,nz,n_tx,n_rx}));
-	ComplexNDArray  out_phase(dim_vector({nx,ny,nz,n_tx,n_rx}));
+	// Virtual elements replace the tx antennas, one-way distances are computed from the
+	// phase centres only
+	std::vector<octave_idx_type> group;
+	octave_idx_type				 n_v = 0;
+	NDArray						 pos_v;
+	if (bVirtual)
+		n_v = virtual_elements(pos_tx, pos_rx, 1e-6, pos_v, group);
+	const NDArray& pos_first = bVirtual ? pos_v : pos_tx;
+	octave_idx_type n_first	 = bVirtual ? n_v : n_tx;
 
-	double k = 2.0*M_PI*freq;
-	for (int t = 0; t < n_tx; t++ )
-	{
-		Array<octave_idx_type> index(dim_vector({1,4}));
-		double xt = pos_tx.xelem(t,0);
-		double yt = pos_tx.xelem(t,1);
-		double zt = pos_tx.xelem(t,2);
-		index(3)=t;
-		for (int r = 0; r < n_rx; r++ )
-		{
-			index(4)=r;
-			double xr = pos_rx.xelem(r,0);
-			double yr = pos_rx.xelem(r,1);
-			double zr = pos_rx.xelem(r,2);
-			for (int x=0; x < nx; x++)
+	// Map dimensions and one-way distances
+	octave_idx_type n1, n2, n3;
+	NDArray d_tx, d_rx;
+	if (grid==GRID_CARTESIAN)
+	{
+		n1 = axes[0].numel();
+		n2 = axes[1].numel();
+		n3 = axes[2].numel();
+		d_tx = NDArray(dim_vector({n1*n2*n3, n_first}));
+		one_way_cartesian(axes[0], axes[1], axes[2], pos_first, d_tx, n_threads);
+		if (!bVirtual)
+		{
+			d_rx = NDArray(dim_vector({n1*n2*n3, n_rx}));
+			one_way_cartesian(axes[0], axes[1], axes[2], pos_rx, d_rx, n_threads);
+		}
+	}
+	else
+	{
+		const NDArray& rho = axes[0];
+		NDArray dir;
+		if (grid==GRID_POLAR)
+		{
+			const NDArray& phi = axes[1];
+			n1 = phi.numel();
+			n2 = rho.numel();
+			n3 = 1;
+			dir = NDArray(dim_vector({n1,3}));
+			for (octave_idx_type p=0; p < n1; p++)
+			{
+				dir(p,0) = 0;
+				dir(p,1) = sin(phi(p));
+				dir(p,2) = cos(phi(p));
+			}
+		}
+		else
+		{
+			const NDArray& theta = axes[1];
+			const NDArray& phi	 = axes[2];
+			n1 = rho.numel();
+			n2 = theta.numel();
+			n3 = phi.numel();
+			dir = NDArray(dim_vector({n2*n3,3}));
+			for (octave_idx_type p=0; p < n3; p++)
 			{
-				index(0)=x;
-				double xp = xv.xelem(x);
-				for (int y=0; y < ny; y++)
+				for (octave_idx_type t=0; t < n2; t++)
 				{
-					index(1)= y;
-					double yp = yv.xelem(y);
-					for (int z=0; z < nz; z++)
-					{
-						double zp = zv.xelem(z);
-
-						double d = sqrt( sqr(xp-xt) + sqr(yp-yt) + sqr(zp-zt)) +
-								   sqrt( sqr(xp-xr) + sqr(yp-yr) + sqr(zp-zr));
-						index(2) = z;
-						double delay = d/C0;
-						double phase = k*delay;
-						out_delay.xelem(index) = delay;
-						out_phase.xelem(index) = Complex(delay*cos(phase), delay*sin(phase));
-						//out_sin(index) = delay*sin(phase);
-
-					}
+					dir(t + n2*p,0) = cos(theta(t))*sin(phi(p));
+					dir(t + n2*p,1) = sin(theta(t))*sin(phi(p));
+					dir(t + n2*p,2) = cos(phi(p));
 				}
 			}
 		}
+		bool rho_first = grid==GRID_SPHERICAL;
+		d_tx = NDArray(dim_vector({n1*n2*n3, n_first}));
+		one_way_radial(rho, dir, rho_first, pos_first, d_tx, n_threads);
+		if (!bVirtual)
+		{
+			d_rx = NDArray(dim_vector({n1*n2*n3, n_rx}));
+			one_way_radial(rho, dir, rho_first, pos_rx, d_rx, n_threads);
+		}
 	}
+
 	octave_value_list out(nargout);
+	if (bVirtual)
+	{
+		dim_vector dims({n1,n2,n3,1,n_v});
+		if (nargout >= 3)
+		{
+			NDArray out_group(dim_vector({n_tx,n_rx}));
+			for (octave_idx_type c=0; c < n_tx*n_rx; c++)
+				out_group(c) = group[c] + 1;
+			out(2) = out_group;
+		}
+		if (bSingle)
+		{
+			FloatNDArray		out_delay(dims);
+			FloatComplexNDArray out_phase(dims);
+			fill_virtual_map<float>(d_tx, freq, out_delay, out_phase, n_threads);
+			out(0) = out_delay;
+			if (nargout >= 2)
+				out(1) = out_phase;
+			return octave_value(out);
+		}
+		NDArray			out_delay(dims);
+		ComplexNDArray	out_phase(dims);
+		fill_virtual_map<double>(d_tx, freq, out_delay, out_phase, n_threads);
+		out(0) = out_delay;
+		if (nargout >= 2)
+			out(1) = out_phase;
+		return octave_value(out);
+	}
+
+	if (bOneWay)
+	{
+		dim_vector dims({n1,n2,n3,n_tx+n_rx});
+		if (bSingle)
+		{
+			FloatNDArray		out_delay(dims);
+			FloatComplexNDArray out_phase(dims);
+			fill_oneway_map<float>(d_tx, d_rx, freq, out_delay, out_phase, n_threads);
+			out(0) = out_delay;
+			if (nargout >= 2)
+				out(1) = out_phase;
+			return octave_value(out);
+		}
+		NDArray			out_delay(dims);
+		ComplexNDArray	out_phase(dims);
+		fill_oneway_map<double>(d_tx, d_rx, freq, out_delay, out_phase, n_threads);
+		out(0) = out_delay;
+		if (nargout >= 2)
+			out(1) = out_phase;
+		return octave_value(out);
+	}
+
+	if (bSingle)
+	{
+		FloatNDArray		out_delay(dim_vector({n1,n2,n3,n_tx,n_rx}));
+		FloatComplexNDArray out_phase(dim_vector({n1,n2,n3,n_tx,n_rx}));
+		fill_delay_map<float>(d_tx, d_rx, freq, out_delay, out_phase, n_threads);
+		if (nargout >= 1)
+			out(0) = out_delay;
+		if (nargout >= 2)
+			out(1) = out_phase;
+		return octave_value(out);
+	}
+
+	NDArray			out_delay(dim_vector({n1,n2,n3,n_tx,n_rx}));
+	ComplexNDArray  out_phase(dim_vector({n1,n2,n3,n_tx,n_rx}));
+	fill_delay_map<double>(d_tx, d_rx, freq, out_delay, out_phase, n_threads);
 	if (nargout >= 1)
 		out(0) = out_delay;
 	if (nargout >= 2)
 		out(1) = out_phase;
 	return octave_value(out);
 }
+
+/*
+%!shared x, y, z, frf, pos_tx, pos_rx, time, iq
+%! x = linspace (-0.2, 0.2, 9);
+%! y = linspace (-0.1, 0.1, 7);
+%! z = linspace (0.5, 1, 5);
+%! frf = 7.29e9;
+%! pos_tx = [0 0 0; 0.02 0 0];
+%! pos_rx = [0 0.02 0; 0.02 0.02 0; 0.04 0.02 0];
+%! time = (0:255)'/1.792e9;
+%! iq = complex (randn (256, 2, 3), randn (256, 2, 3));
+
+%!test
+%! ## Separable one-way tables give the image of the full (n_tx x n_rx) maps
+%! [dm, pf] = build_delay_map (x, y, z, frf, pos_tx, pos_rx);
+%! [dm1, pf1] = build_delay_map (x, y, z, frf, pos_tx, pos_rx, "oneway");
+%! assert (size (dm1), [9, 7, 5, 5]);
+%! assert (dm1(:,:,:,1) + dm1(:,:,:,3), dm(:,:,:,1,1), 1e-18);
+%! for opt = {{}, {"cf"}, {"lagrange"}}
+%!   ref = signal_das (iq, time, dm, pf, opt{1}{:});
+%!   assert (signal_das (iq, time, dm1, pf1, opt{1}{:}), ref, 1e-10*max (abs (ref(:))));
+%!   ref = signal_fdmas (iq, time, dm, pf, "full", opt{1}{:});
+%!   assert (signal_fdmas (iq, time, dm1, pf1, "full", opt{1}{:}), ref, 1e-10*max (abs (ref(:))));
+%! endfor
+
+%!test
+%! [dm1, pf1] = build_delay_map (x, y, z, frf, pos_tx, pos_rx, "oneway", "single");
+%! assert (class (dm1), "single");
+%! [dm, pf] = build_delay_map (x, y, z, frf, pos_tx, pos_rx, "single");
+%! ref = signal_das (iq, time, dm, pf);
+%! assert (signal_das (iq, time, dm1, pf1), ref, 1e-4*max (abs (ref(:))));
+*/
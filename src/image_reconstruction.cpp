@@ -0,0 +1,138 @@
+/* Copyright (C) 2024 ARIA Sensing
+##
+## This program is free software: you can redistribute it and/or modify
+## it under the terms of the GNU General Public License as published by
+## the Free Software Foundation, either version 3 of the License, or
+## (at your option) any later version.
+##
+## This program is distributed in the hope that it will be useful,
+## but WITHOUT ANY WARRANTY; without even the implied warranty of
+## MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+## GNU General Public License for more details.
+##
+## You should have received a copy of the GNU General Public License
+## along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+## -*- texinfo -*-
+## @deftypefn {} {@var{outputImage} =} image_reconstruction (@var{hradar}, @var{inputData}, @var{phyBase}, @var{rhoBase}, @var{algorithm})
+## Native implementation of imageReconstruction.
+## @seealso{imageReconstruction, image_reconstruction_3d}
+## @end deftypefn
+*/
+
+#include <octave/oct.h>
+#include <octave/ov-struct.h>
+#include "aria_uwb_toolbox.h"
+#include "aria_beamforming.h"
+
+DEFUN_DLD(image_reconstruction, args, , "-*- texinfo -*-\n\
+@deftypefn {} {@var{outputImage} =} image_reconstruction (@var{hradar}, @var{inputData}, @var{phyBase}, @var{rhoBase}, @var{algorithm})\n\
+@deftypefnx {} {@var{outputImage} =} image_reconstruction (@dots{}, @var{n_threads})\n\
+Create an output image from radar streams on the (phy x rho) polar plane.\n\
+Same interface and result as imageReconstruction, computed in a single pass over the \n\
+grid without the per-cycle remapping storage.\n\
+@var{hradar} is the acquisition structure (CoreFrequency, txCenterFrequency, \n\
+FixedTxToAntennaDelays, FixedRxToAntennaDelays, TxAntPosition, RxAntPosition, TxRxCycle) \n\
+@var{inputData} is the stream input (every row is a single stream) \n\
+@var{phyBase} is the reconstruction azimuth base (default: -90:1:90 degrees) \n\
+@var{rhoBase} is the reconstruction distance base (default: one point per ADC sample) \n\
+@var{algorithm} is \"DAS\" (default), \"DMAS\", \"DAS_SR\" or \"DMAS_SR\" \n\
+@var{n_threads} is the number of threads (default: all cores) \n\
+Voxels without any in-range sample are zero in the _SR images.\n\
+@seealso{imageReconstruction, image_reconstruction_3d}\n\
+@end deftypefn")
+{
+	if ((args.length() < 5)||(args.length() > 6))
+	{
+		print_usage();
+		return octave_value();
+	}
+
+	bool das, sr;
+	if (!bf_parse_reconstruction(args(4), das, sr))
+		return octave_value();
+
+	int n_threads = bf_default_threads();
+	if ((args.length()==6)&&(!bf_threads_from_value(args(5), n_threads)))
+		return octave_value();
+
+	if (args(1).ndims()!=2)
+	{
+		error("inputData must be a (streams x samples) matrix");
+		return octave_value();
+	}
+	ComplexNDArray streams = args(1).complex_array_value();
+
+	bf_radar_cycles cycles;
+	if (!bf_radar_cycles_from_value(args(0), streams.dim1(), cycles))
+		return octave_value();
+	octave_idx_type n_samples = streams.dim2();
+
+	NDArray phy;
+	if (args(2).isempty())
+	{
+		phy = NDArray(dim_vector({1,181}));
+		for (int i=0; i < 181; i++)
+			phy(i) = (i-90)*M_PI/180.0;
+	}
+	else
+		phy = args(2).array_value();
+
+	bf_polar_grid grid;
+	if (args(3).isempty())
+	{
+		grid.rho = NDArray(dim_vector({1,n_samples}));
+		for (octave_idx_type i=0; i < n_samples; i++)
+			grid.rho(i) = i*(C0/(2.0*cycles.fadc));
+	}
+	else
+		grid.rho = args(3).array_value();
+
+	// (phy x rho) plane at x = 0
+	octave_idx_type n_phy = phy.numel();
+	grid.dir = NDArray(dim_vector({n_phy,3}));
+	for (octave_idx_type i=0; i < n_phy; i++)
+	{
+		grid.dir(i,0) = 0;
+		grid.dir(i,1) = sin(phy(i));
+		grid.dir(i,2) = cos(phy(i));
+	}
+	grid.rho_first = false;
+
+	ComplexNDArray out(dim_vector({n_phy, grid.rho.numel()}));
+	bf_image_cycles(streams, cycles, grid, das, sr, n_threads, out);
+
+	return octave_value(out);
+}
+
+/*
+%!shared hradar, data, phy, rho
+%! hradar.CoreFrequency = 1.792e9;
+%! hradar.txCenterFrequency = 7.29e9;
+%! hradar.TxAntPosition = [0 -0.03 0; 0 -0.01 0];
+%! hradar.RxAntPosition = [0 0.01 0; 0 0.03 0];
+%! hradar.FixedTxToAntennaDelays = [0.1e-9 0.2e-9];
+%! hradar.FixedRxToAntennaDelays = [0.15e-9 0.05e-9];
+%! ## One cycle per tx/rx pair
+%! seq = zeros (2, 2, 4);
+%! for n = 1:4
+%!   seq(1, fix ((n-1)/2)+1, n) = 1;
+%!   seq(2, mod (n-1, 2)+1, n) = 1;
+%! endfor
+%! hradar.TxRxCycle = seq;
+%! data = complex (randn (4, 256), randn (4, 256));
+%! phy = (-60:5:60)*pi/180;
+%! rho = 0.1:0.05:2;
+
+%!test
+%! for alg = {"DAS", "DMAS", "DAS_SR", "DMAS_SR"}
+%!   ref = imageReconstruction (hradar, data, phy, rho, alg{1});
+%!   assert (image_reconstruction (hradar, data, phy, rho, alg{1}), ref, 1e-9*max (abs (ref(:))));
+%! endfor
+
+%!test
+%! ref = image_reconstruction (hradar, data, phy, rho, "DMAS", 1);
+%! assert (image_reconstruction (hradar, data, phy, rho, "DMAS", 4), ref);
+
+%!error <Number of streams> image_reconstruction (hradar, data(1:3,:), phy, rho, "DAS")
+*/
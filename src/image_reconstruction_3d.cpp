@@ -0,0 +1,150 @@
+/* Copyright (C) 2024 ARIA Sensing
+##
+## This program is free software: you can redistribute it and/or modify
+## it under the terms of the GNU General Public License as published by
+## the Free Software Foundation, either version 3 of the License, or
+## (at your option) any later version.
+##
+## This program is distributed in the hope that it will be useful,
+## but WITHOUT ANY WARRANTY; without even the implied warranty of
+## MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+## GNU General Public License for more details.
+##
+## You should have received a copy of the GNU General Public License
+## along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+## -*- texinfo -*-
+## @deftypefn {} {@var{outputImage} =} image_reconstruction_3d (@var{hradar}, @var{inputData}, @var{thetaBase}, @var{phyBase}, @var{rhoBase}, @var{algorithm})
+## Native implementation of imageReconstruction_3D.
+## @seealso{imageReconstruction_3D, image_reconstruction}
+## @end deftypefn
+*/
+
+#include <octave/oct.h>
+#include <octave/ov-struct.h>
+#include "aria_uwb_toolbox.h"
+#include "aria_beamforming.h"
+
+// Default angular base: first:step:last degrees
+static NDArray degree_base(int first, int step, int last)
+{
+	int n = (last-first)/step + 1;
+	NDArray base(dim_vector({1,n}));
+	for (int i=0; i < n; i++)
+		base(i) = (first + i*step)*M_PI/180.0;
+	return base;
+}
+
+DEFUN_DLD(image_reconstruction_3d, args, , "-*- texinfo -*-\n\
+@deftypefn {} {@var{outputImage} =} image_reconstruction_3d (@var{hradar}, @var{inputData}, @var{thetaBase}, @var{phyBase}, @var{rhoBase}, @var{algorithm})\n\
+@deftypefnx {} {@var{outputImage} =} image_reconstruction_3d (@dots{}, @var{n_threads})\n\
+Create an output volume from radar streams on the (rho x theta x phy) spherical grid.\n\
+Same interface and result as imageReconstruction_3D, computed in a single pass over the \n\
+grid without the per-cycle remapping storage.\n\
+@var{hradar} is the acquisition structure (CoreFrequency, txCenterFrequency, \n\
+FixedTxToAntennaDelays, FixedRxToAntennaDelays, TxAntPosition, RxAntPosition, TxRxCycle) \n\
+@var{inputData} is the stream input (every row is a single stream) \n\
+@var{thetaBase} is the reconstruction azimuth base (default: 0:5:360 degrees) \n\
+@var{phyBase} is the reconstruction elevation base (default: -90:5:90 degrees) \n\
+@var{rhoBase} is the reconstruction distance base (default: one point per ADC sample) \n\
+@var{algorithm} is \"DAS\" (default), \"DMAS\", \"DAS_SR\" or \"DMAS_SR\" \n\
+@var{n_threads} is the number of threads (default: all cores) \n\
+Voxels without any in-range sample are zero in the _SR images.\n\
+@seealso{imageReconstruction_3D, image_reconstruction}\n\
+@end deftypefn")
+{
+	if ((args.length() < 6)||(args.length() > 7))
+	{
+		print_usage();
+		return octave_value();
+	}
+
+	bool das, sr;
+	if (!bf_parse_reconstruction(args(5), das, sr))
+		return octave_value();
+
+	int n_threads = bf_default_threads();
+	if ((args.length()==7)&&(!bf_threads_from_value(args(6), n_threads)))
+		return octave_value();
+
+	if (args(1).ndims()!=2)
+	{
+		error("inputData must be a (streams x samples) matrix");
+		return octave_value();
+	}
+	ComplexNDArray streams = args(1).complex_array_value();
+
+	bf_radar_cycles cycles;
+	if (!bf_radar_cycles_from_value(args(0), streams.dim1(), cycles))
+		return octave_value();
+	octave_idx_type n_samples = streams.dim2();
+
+	NDArray theta = args(2).isempty() ? degree_base(0, 5, 360) : args(2).array_value();
+	NDArray phy   = args(3).isempty() ? degree_base(-90, 5, 90) : args(3).array_value();
+
+	bf_polar_grid grid;
+	if (args(4).isempty())
+	{
+		grid.rho = NDArray(dim_vector({1,n_samples}));
+		for (octave_idx_type i=0; i < n_samples; i++)
+			grid.rho(i) = i*(C0/(2.0*cycles.fadc));
+	}
+	else
+		grid.rho = args(4).array_value();
+
+	// Directions in (theta x phy) order
+	octave_idx_type n_theta = theta.numel();
+	octave_idx_type n_phy	= phy.numel();
+	grid.dir = NDArray(dim_vector({n_theta*n_phy,3}));
+	for (octave_idx_type p=0; p < n_phy; p++)
+	{
+		for (octave_idx_type t=0; t < n_theta; t++)
+		{
+			octave_idx_type id = t + n_theta*p;
+			grid.dir(id,0) = cos(theta(t))*sin(phy(p));
+			grid.dir(id,1) = sin(theta(t))*sin(phy(p));
+			grid.dir(id,2) = cos(phy(p));
+		}
+	}
+	grid.rho_first = true;
+
+	ComplexNDArray out(dim_vector({grid.rho.numel(), n_theta, n_phy}));
+	bf_image_cycles(streams, cycles, grid, das, sr, n_threads, out);
+
+	return octave_value(out);
+}
+
+/*
+%!shared hradar, data, theta, phy, rho
+%! hradar.CoreFrequency = 1.792e9;
+%! hradar.txCenterFrequency = 7.29e9;
+%! hradar.TxAntPosition = [-0.02 -0.03 0; 0.02 -0.01 0];
+%! hradar.RxAntPosition = [-0.02 0.01 0; 0.02 0.03 0];
+%! hradar.FixedTxToAntennaDelays = [0.1e-9 0.2e-9];
+%! hradar.FixedRxToAntennaDelays = [0.15e-9 0.05e-9];
+%! ## One cycle per tx/rx pair
+%! seq = zeros (2, 2, 4);
+%! for n = 1:4
+%!   seq(1, fix ((n-1)/2)+1, n) = 1;
+%!   seq(2, mod (n-1, 2)+1, n) = 1;
+%! endfor
+%! hradar.TxRxCycle = seq;
+%! data = complex (randn (4, 256), randn (4, 256));
+%! theta = (0:30:330)*pi/180;
+%! phy = (-60:15:60)*pi/180;
+%! rho = 0.1:0.1:2;
+
+%!test
+%! for alg = {"DAS", "DMAS", "DAS_SR", "DMAS_SR"}
+%!   ref = imageReconstruction_3D (hradar, data, theta, phy, rho, alg{1});
+%!   out = image_reconstruction_3d (hradar, data, theta, phy, rho, alg{1});
+%!   assert (size (out), [20 12 9]);
+%!   assert (out, ref, 1e-9*max (abs (ref(:))));
+%! endfor
+
+%!test
+%! ref = image_reconstruction_3d (hradar, data, theta, phy, rho, "DMAS", 1);
+%! assert (image_reconstruction_3d (hradar, data, theta, phy, rho, "DMAS", 4), ref);
+
+%!error <Number of streams> image_reconstruction_3d (hradar, data(1:3,:), theta, phy, rho, "DAS")
+*/
@@ -0,0 +1,201 @@
+/* Copyright (C) 2024 Alessio Cacciatori
+##
+## This program is free software: you can redistribute it and/or modify
+## it under the terms of the GNU General Public License as published by
+## the Free Software Foundation, either version 3 of the License, or
+## (at your option) any later version.
+##
+## This program is distributed in the hope that it will be useful,
+## but WITHOUT ANY WARRANTY; without even the implied warranty of
+## MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+## GNU General Public License for more details.
+##
+## You should have received a copy of the GNU General Public License
+## along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+## -*- texinfo -*-
+## @deftypefn {} {@var{map_out} =} signal_bf_image (@var{signals}, @var{time}, @var{x}, @var{y}, @var{z}, @var{frf}, @var{pos_tx}, @var{pos_rx})\n\
+## Return the radar map computing delays and phase factors on the fly.\n\
+## @seealso{signal_das, signal_fdmas, signal_bf_points, build_delay_map}
+## @end deftypefn
+
+## Author: Alessio Cacciatori <alessioc@alessio-laptop>
+## Created: 2024-11-15
+*/
+
+#include <octave/oct.h>
+#include <octave/ov-struct.h>
+#include "aria_uwb_toolbox.h"
+#include "aria_beamforming.h"
+
+DEFUN_DLD(signal_bf_image, args, , "-*- texinfo -*-\n\
+@deftypefn {} {@var{map_out} =} signal_bf_image (@var{signals}, @var{time}, @var{x}, @var{y}, @var{z}, @var{frf}, @var{pos_tx}, @var{pos_rx})\n\
+@deftypefnx {} {@var{map_out} =} signal_bf_image (@dots{}, @var{options})\n\
+Return the radar map without building the delay and phase maps.\n\
+Delays and phase factors are computed on the fly inside the beamforming loop with the \n\
+same convention as build_delay_map, so memory is O(voxels) instead of O(voxels * n_tx * n_rx).\n\
+@var{signals} is the I/Q downsampled data. It must be in (time x n_tx x n_rx) format\n\
+@var{time} is the time support for signals \n\
+@var{x},@var{y},@var{z} are the coordinates  \n\
+@var{frf} is the RF frequency \n\
+@var{pos_tx} is a n x 3 matrix where n is the number of transmitter antennas \n\
+@var{pos_rx} is a n x 3 matrix where n is the number of receiver    antennas \n\
+@var{options} are the optional arguments: a number sets the thread count, \n\
+\"das\" (default) or \"fdmas\" selects the algorithm, \"ring\" or \"full\" the F-DMAS pairs, \n\
+\"cf\" or \"scf\" the coherence weighting, \"linear\", \"lagrange\", \"sinc\" or \"farrow\" \n\
+the fractional-delay interpolator (see signal_das).\n\
+When @var{signals} is single the map is computed and returned in single precision; \n\
+delays and phase factors are always evaluated in double precision.\n\
+@seealso{signal_das, signal_fdmas, signal_bf_points, build_delay_map}\n\
+@end deftypefn")
+{
+	if (args.length() < 8)
+	{
+		print_usage();
+		return octave_value();
+	}
+
+	bf_options opts;
+	if (!bf_parse_options(args, 8, BF_DAS, true, opts))
+		return octave_value();
+
+	// Check time
+	bool vector = (args(1).ndims()==2) && (args(1).dims().num_ones()>=1);
+	if ((!args(1).isreal())||(!vector))
+	{
+		error("time must be a real vector");
+		return octave_value();
+	}
+	NDArray time = args(1).array_value();
+	octave_idx_type time_samples = time.numel();
+	if (time_samples < 2)
+	{
+		error("time support must contain at least two samples");
+		return octave_value();
+	}
+
+	bf_geometry geom;
+	// Check x
+	vector = (args(2).ndims()==2) && (args(2).dims().num_ones()>=1);
+	if ((!vector)||(!args(2).isreal()))
+	{
+		error("x must be a real vector");
+		return octave_value();
+	}
+	geom.x = args(2).array_value();
+
+	// Check y
+	vector = (args(3).ndims()==2) && (args(3).dims().num_ones()>=1);
+	if ((!vector)||(!args(3).isreal()))
+	{
+		error("y must be a real vector");
+		return octave_value();
+	}
+	geom.y = args(3).array_value();
+
+	// Check z
+	vector = (args(4).ndims()==2) && (args(4).dims().num_ones()>=1);
+	if ((!vector)||(!args(4).isreal()))
+	{
+		error("z must be a real vector");
+		return octave_value();
+	}
+	geom.z = args(4).array_value();
+
+	// Check freq
+	bool number = (args(5).dims().num_ones()==args(5).ndims());
+	if ((!number)||(!args(5).isreal())||(args(5).array_value()(0)<=0))
+	{
+		error("freq must be a single positive value");
+		return octave_value();
+	}
+	geom.freq = args(5).array_value()(0);
+
+	// Check tx-pos
+	if ((args(6).dims()(1)!=3)||(!args(6).isreal()))
+	{
+		error("tx position must be a n by 3 real matrix");
+		return octave_value();
+	}
+	geom.pos_tx = args(6).array_value();
+
+	if ((args(7).dims()(1)!=3)||(!args(7).isreal()))
+	{
+		error("rx position must be a n by 3 real matrix");
+		return octave_value();
+	}
+	geom.pos_rx = args(7).array_value();
+
+	// Check BB data: (time x n_tx x n_rx)
+	dim_vector iq_dims = args(0).dims();
+	octave_idx_type n_tx = geom.pos_tx.dim1();
+	octave_idx_type n_rx = geom.pos_rx.dim1();
+	bool bVector = (n_tx*n_rx==1)&&(iq_dims.ndims()==2)&&(iq_dims.numel()==time_samples)&&(iq_dims.num_ones() >= 1);
+	if ((!bVector)&&((iq_dims.ndims() > 3)||(iq_dims(0)!=time_samples)||(iq_dims(1)!=n_tx)||
+					 ((iq_dims.ndims() > 2 ? iq_dims(2) : 1)!=n_rx)))
+	{
+		error("BB data dimension not consistent with time support and antenna positions");
+		return octave_value();
+	}
+
+	dim_vector out_dims({geom.x.numel(), geom.y.numel(), geom.z.numel()});
+	if (args(0).is_single_type())
+	{
+		FloatComplexNDArray iq_signals = args(0).float_complex_array_value();
+		FloatNDArray out(out_dims);
+		bf_image_geometry<float>(iq_signals, time, geom, opts, out);
+		return octave_value(out);
+	}
+
+	ComplexNDArray iq_signals = args(0).complex_array_value();
+	NDArray out(out_dims);
+	bf_image_geometry<double>(iq_signals, time, geom, opts, out);
+
+	return octave_value(out);
+}
+
+/*
+%!shared x, y, z, frf, pos_tx, pos_rx, time, iq, dm, pf
+%! x = linspace (-0.2, 0.2, 9);
+%! y = linspace (-0.1, 0.1, 7);
+%! z = linspace (0.5, 1, 5);
+%! frf = 7.29e9;
+%! pos_tx = [0 0 0; 0.02 0 0];
+%! pos_rx = [0 0.02 0; 0.02 0.02 0; 0.04 0.02 0];
+%! time = (0:255)'/1.792e9;
+%! iq = complex (randn (256, 2, 3), randn (256, 2, 3));
+%! [dm, pf] = build_delay_map (x, y, z, frf, pos_tx, pos_rx);
+
+%!test
+%! ## Same image as signal_das / signal_fdmas on the maps of build_delay_map
+%! for opt = {{}, {"cf"}, {"scf", "lagrange"}, {"sinc"}, {"farrow"}}
+%!   ref = signal_das (iq, time, dm, pf, opt{1}{:});
+%!   map = signal_bf_image (iq, time, x, y, z, frf, pos_tx, pos_rx, opt{1}{:});
+%!   assert (size (map), [9 7 5]);
+%!   assert (map, ref, 1e-10*max (abs (ref(:))));
+%! endfor
+%! for opt = {{}, {"full"}, {"full", "cf"}}
+%!   ref = signal_fdmas (iq, time, dm, pf, opt{1}{:});
+%!   map = signal_bf_image (iq, time, x, y, z, frf, pos_tx, pos_rx, "fdmas", opt{1}{:});
+%!   assert (map, ref, 1e-10*max (abs (ref(:))));
+%! endfor
+
+%!test
+%! ## Non uniform time support
+%! t = time + 1e-11*sin (1:256)';
+%! ref = signal_das (iq, t, dm, pf);
+%! assert (signal_bf_image (iq, t, x, y, z, frf, pos_tx, pos_rx), ref, 1e-10*max (abs (ref(:))));
+
+%!test
+%! ref = signal_das (iq, time, dm, pf);
+%! map = signal_bf_image (single (iq), time, x, y, z, frf, pos_tx, pos_rx);
+%! assert (class (map), "single");
+%! assert (double (map), ref, 1e-4*max (abs (ref(:))));
+%! assert (signal_bf_image (iq, time, x, y, z, frf, pos_tx, pos_rx, 1),
+%!         signal_bf_image (iq, time, x, y, z, frf, pos_tx, pos_rx, 3));
+
+%!error <BB data dimension not consistent>
+%! signal_bf_image (iq(:,:,1:2), time, x, y, z, frf, pos_tx, pos_rx);
+%!error <tx position must be a n by 3 real matrix>
+%! signal_bf_image (iq, time, x, y, z, frf, pos_tx(:,1:2), pos_rx);
+*/
@@ -0,0 +1,437 @@
+/* Copyright (C) 2024 Alessio Cacciatori
+##
+## This program is free software: you can redistribute it and/or modify
+## it under the terms of the GNU General Public License as published by
+## the Free Software Foundation, either version 3 of the License, or
+## (at your option) any later version.
+##
+## This program is distributed in the hope that it will be useful,
+## but WITHOUT ANY WARRANTY; without even the implied warranty of
+## MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+## GNU General Public License for more details.
+##
+## You should have received a copy of the GNU General Public License
+## along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+## -*- texinfo -*-
+## @deftypefn {} {@var{h} =} signal_bf_incremental (\"create\", @var{time}, @var{delay_map}, @var{phase_fact})\n\
+## @deftypefnx {} {@var{map_out} =} signal_bf_incremental (@var{h}, @var{tx}, @var{rx}, @var{signal})\n\
+## Incremental DAS / F-DMAS image updated one tx/rx pair at a time.\n\
+## @seealso{signal_das, signal_fdmas, set_multistreammode}
+## @end deftypefn
+
+## Author: Alessio Cacciatori <alessioc@alessio-laptop>
+## Created: 2024-11-15
+*/
+
+#include <octave/oct.h>
+#include <octave/ov-struct.h>
+#include <map>
+#include <algorithm>
+#include <vector>
+#include "aria_uwb_toolbox.h"
+#include "aria_beamforming.h"
+
+// Updates between two rebuilds of the running sums from the stored samples,
+// bounding the rounding drift of the add/subtract updates
+#define BFI_REFRESH 1024
+
+// Running sums of the projected channel samples s of every voxel: every combination
+// and weighting of bf_combine is a function of them, and replacing the samples of
+// one channel only touches its own terms
+struct bfi_sums
+{
+	std::vector<double> sum;		// sum s					(DAS, CF)
+	std::vector<double> sum_sq;		// sum s^2					(CF)
+	std::vector<double> sum_sgn;	// sum sign(s)				(SCF)
+	std::vector<double> sum_rt;		// sum sign(s)sqrt(|s|)		(F-DMAS full)
+	std::vector<double> sum_abs;	// sum |s|					(F-DMAS full)
+	std::vector<double> ring;		// sum of the ring products (F-DMAS ring)
+};
+
+struct bf_incremental
+{
+	bool				single;
+	octave_idx_type		nx, ny, nz, n_vox, n_ch;
+	int					n_tx, n_rx;
+	NDArray				time;
+	bool				uniform;
+	double				t0, ts;
+	bf_options			opts;
+	NDArray				dm_d;
+	ComplexNDArray		pf_d;
+	FloatNDArray		dm_f;
+	FloatComplexNDArray pf_f;
+	std::vector<double> samples_d;		// (voxels x channels) projected samples
+	std::vector<float>	samples_f;
+	bfi_sums			sums;
+	octave_idx_type		updates;
+};
+
+// Engines of the session, released by "clear" or when the oct-file is cleared
+static std::map<int, bf_incremental> engines;
+static int							 next_handle = 1;
+
+static inline double bfi_sign(double s) { return s < 0 ? -1.0 : 1.0; }
+static inline double bfi_rt(double s) { return s < 0 ? -sqrt(-s) : sqrt(s); }
+static inline double bfi_pair(double a, double b)
+{
+	double prod = a*b;
+	return sqrt(fabs(prod))*(prod > 0 ? 1.0 : -1.0);
+}
+
+// Sums rebuilt from the stored samples
+template <typename T>
+static void bfi_rebuild(bf_incremental& e, const std::vector<T>& samples)
+{
+	bfi_sums&		s	 = e.sums;
+	octave_idx_type n_ch = e.n_ch;
+	bf_parallel_for(e.n_vox, 4096, e.opts.n_threads, [&](octave_idx_type begin, octave_idx_type end)
+	{
+		for (octave_idx_type v=begin; v < end; v++)
+		{
+			double sum = 0, sum_sq = 0, sum_sgn = 0, sum_rt = 0, sum_abs = 0, ring = 0;
+			for (octave_idx_type c=0; c < n_ch; c++)
+			{
+				double x = samples[v + e.n_vox*c];
+				sum		+= x;
+				sum_sq	+= x*x;
+				sum_sgn += bfi_sign(x);
+				sum_rt	+= bfi_rt(x);
+				sum_abs += fabs(x);
+				ring	+= bfi_pair(x, samples[v + e.n_vox*((c+1) % n_ch)]);
+			}
+			s.sum[v]	 = sum;
+			s.sum_sq[v]	 = sum_sq;
+			s.sum_sgn[v] = sum_sgn;
+			s.sum_rt[v]	 = sum_rt;
+			s.sum_abs[v] = sum_abs;
+			s.ring[v]	 = ring;
+		}
+	});
+}
+
+// Replaces the samples of channel c with the projection of iq: O(voxels)
+template <typename T>
+static void bfi_update(bf_incremental& e, std::vector<T>& samples, const typename bf_traits<T>::real_array& dm,
+					   const typename bf_traits<T>::complex_array& pf, const typename bf_traits<T>::complex_array& iq,
+					   octave_idx_type c)
+{
+	typedef bf_traits<T> traits;
+	octave_idx_type n_vox = e.n_vox;
+	octave_idx_type n_ch  = e.n_ch;
+
+	// Projection of the channel alone: a single channel combination is its sample
+	typename traits::real_array	   dm_c(dm.linear_slice(n_vox*c, n_vox*(c+1)));
+	typename traits::complex_array pf_c(pf.linear_slice(n_vox*c, n_vox*(c+1)));
+	typename traits::real_array	   proj(dim_vector({n_vox, 1}));
+	bf_options					   opts = e.opts;
+	opts.mode	= BF_DAS;
+	opts.weight = BF_WEIGHT_NONE;
+	if (e.uniform)
+		bf_image_uniform<T>(iq, dm_c, pf_c, e.t0, e.ts, opts, proj);
+	else
+		bf_image_search<T>(iq, e.time, dm_c, pf_c, opts, proj);
+
+	if (++e.updates % BFI_REFRESH==0)
+	{
+		std::copy(proj.data(), proj.data()+n_vox, samples.begin() + n_vox*c);
+		bfi_rebuild(e, samples);
+		return;
+	}
+
+	// Only the sums read by the combination and the weighting are kept up to date,
+	// the others are rebuilt with them
+	bfi_sums&		s	 = e.sums;
+	const T*		pn	 = proj.data();
+	T*				pc	 = samples.data() + n_vox*c;
+	const T*		prev = samples.data() + n_vox*((c+n_ch-1) % n_ch);
+	const T*		next = samples.data() + n_vox*((c+1) % n_ch);
+	bool			bSq	  = e.opts.weight==BF_WEIGHT_CF;
+	bool			bSgn  = e.opts.weight==BF_WEIGHT_SCF;
+	bool			bFull = (e.opts.mode==BF_FDMAS_FULL)&&(n_ch > 1);
+	bool			bRing = (e.opts.mode==BF_FDMAS)&&(n_ch > 1);
+	bf_parallel_for(n_vox, 4096, e.opts.n_threads, [&](octave_idx_type begin, octave_idx_type end)
+	{
+		for (octave_idx_type v=begin; v < end; v++)
+		{
+			double x_old = pc[v];
+			double x_new = pn[v];
+			s.sum[v] += x_new - x_old;
+			if (bSq)
+				s.sum_sq[v]	 += x_new*x_new - x_old*x_old;
+			if (bSgn)
+				s.sum_sgn[v] += bfi_sign(x_new) - bfi_sign(x_old);
+			if (bFull)
+			{
+				s.sum_rt[v]	 += bfi_rt(x_new) - bfi_rt(x_old);
+				s.sum_abs[v] += fabs(x_new) - fabs(x_old);
+			}
+			if (bRing)
+				s.ring[v] += bfi_pair(prev[v], x_new) + bfi_pair(x_new, next[v])
+						   - bfi_pair(prev[v], x_old) - bfi_pair(x_old, next[v]);
+			pc[v] = pn[v];
+		}
+	});
+}
+
+// Image of the current samples, with the expressions of bf_combine
+template <typename T>
+static octave_value bfi_image(const bf_incremental& e)
+{
+	typename bf_traits<T>::real_array out(dim_vector({e.nx, e.ny, e.nz}));
+	T*								  pout = out.fortran_vec();
+	const bfi_sums&					  s	   = e.sums;
+	double							  n	   = e.n_ch;
+	bf_parallel_for(e.n_vox, 4096, e.opts.n_threads, [&](octave_idx_type begin, octave_idx_type end)
+	{
+		for (octave_idx_type v=begin; v < end; v++)
+		{
+			double value = s.sum[v];
+			if ((e.opts.mode==BF_FDMAS_FULL)&&(e.n_ch > 1))
+				value = 0.5*(s.sum_rt[v]*s.sum_rt[v] - s.sum_abs[v]);
+			else if ((e.opts.mode==BF_FDMAS)&&(e.n_ch > 1))
+				value = s.ring[v];
+			if (e.opts.weight==BF_WEIGHT_CF)
+				value *= s.sum_sq[v] > 0 ? s.sum[v]*s.sum[v]/(n*s.sum_sq[v]) : 0.0;
+			else if (e.opts.weight==BF_WEIGHT_SCF)
+			{
+				double b = s.sum_sgn[v]/n;
+				value *= 1.0 - sqrt(std::max(0.0, 1.0 - b*b));
+			}
+			pout[v] = (T)value;
+		}
+	});
+	return octave_value(out);
+}
+
+static void bfi_clear(bf_incremental& e)
+{
+	if (e.single)
+		std::fill(e.samples_f.begin(), e.samples_f.end(), 0.0f);
+	else
+		std::fill(e.samples_d.begin(), e.samples_d.end(), 0.0);
+	for (std::vector<double>* v : {&e.sums.sum, &e.sums.sum_sq, &e.sums.sum_rt, &e.sums.sum_abs, &e.sums.ring})
+		v->assign(e.n_vox, 0.0);
+	// sign(0) counts as +1, as in bf_coherence
+	e.sums.sum_sgn.assign(e.n_vox, (double)e.n_ch);
+	e.updates = 0;
+}
+
+static bool bfi_handle(const octave_value& value, int& handle)
+{
+	if ((!value.is_real_scalar())||(engines.find(value.int_value())==engines.end()))
+	{
+		error("invalid incremental beamformer handle");
+		return false;
+	}
+	handle = value.int_value();
+	return true;
+}
+
+DEFUN_DLD(signal_bf_incremental, args, , "-*- texinfo -*-\n\
+@deftypefn {} {@var{h} =} signal_bf_incremental (\"create\", @var{time}, @var{delay_map}, @var{phase_fact})\n\
+@deftypefnx {} {@var{h} =} signal_bf_incremental (\"create\", @var{time}, @var{delay_map}, @var{phase_fact}, @dots{})\n\
+@deftypefnx {} {@var{map_out} =} signal_bf_incremental (@var{h}, @var{tx}, @var{rx}, @var{signal})\n\
+@deftypefnx {} {@var{map_out} =} signal_bf_incremental (@var{h})\n\
+@deftypefnx {} {} signal_bf_incremental (\"reset\", @var{h})\n\
+@deftypefnx {} {} signal_bf_incremental (\"clear\", @var{h})\n\
+Incremental image for BB data delivered one tx/rx pair at a time, as in multistream \n\
+mode (set_multistreammode).\n\
+The first forms create an engine over the time support @var{time} and the \n\
+(x , y , z , n_tx , n_rx) @var{delay_map} and @var{phase_fact} of signal_das; the \n\
+trailing options of signal_das and signal_fdmas are accepted: \"das\" (default) or \"fdmas\", \n\
+\"ring\" / \"full\" F-DMAS pairs, \"cf\" / \"scf\" weighting, the interpolator and the number \n\
+of threads. The engine is single when @var{delay_map} or @var{phase_fact} is single.\n\
+The engine keeps the projected samples of every channel and per voxel running sums of \n\
+them (sum, squares, signs, signed square roots and ring products). \n\
+signal_bf_incremental (@var{h}, @var{tx}, @var{rx}, @var{signal}) projects the new \n\
+@var{signal} (time samples of the pair, one based @var{tx} and @var{rx}), replaces the stale \n\
+samples of the pair in the sums and returns the updated image, in O(voxels) instead of \n\
+O(voxels x n_tx x n_rx). Pairs not received yet contribute zero samples, so the image \n\
+equals signal_das / signal_fdmas on BB data with those channels set to zero. \n\
+The sums are rebuilt from the stored samples every 1024 updates to bound the rounding drift.\n\
+signal_bf_incremental (@var{h}) returns the current image.\n\
+\"reset\" sets all the channels to zero; \"clear\" releases the engine.\n\
+Clearing the oct-file (clear signal_bf_incremental) releases all the engines.\n\
+@seealso{signal_das, signal_fdmas, set_multistreammode}\n\
+@end deftypefn")
+{
+	if (args.length() < 1)
+	{
+		print_usage();
+		return octave_value();
+	}
+
+	// Update or current image
+	if (!args(0).is_string())
+	{
+		int handle;
+		if ((args.length()!=1)&&(args.length()!=4))
+		{
+			print_usage();
+			return octave_value();
+		}
+		if (!bfi_handle(args(0), handle))
+			return octave_value();
+		bf_incremental& e = engines[handle];
+		if (args.length()==1)
+			return e.single ? bfi_image<float>(e) : bfi_image<double>(e);
+
+		if ((!args(1).is_real_scalar())||(!args(2).is_real_scalar())||
+			(args(1).double_value() < 1)||(args(1).double_value() > e.n_tx)||
+			(args(2).double_value() < 1)||(args(2).double_value() > e.n_rx)||
+			(args(1).double_value()!=std::floor(args(1).double_value()))||
+			(args(2).double_value()!=std::floor(args(2).double_value())))
+		{
+			error("tx and rx must be antenna indices between 1 and %d and 1 and %d", e.n_tx, e.n_rx);
+			return octave_value();
+		}
+		octave_idx_type c = (args(1).idx_type_value()-1) + e.n_tx*(args(2).idx_type_value()-1);
+		if ((!args(3).isnumeric())||(args(3).numel()!=e.time.numel()))
+		{
+			error("signal must contain the same number of samples as the time support");
+			return octave_value();
+		}
+		dim_vector iq_dims({e.time.numel(), 1});
+		if (e.single)
+		{
+			FloatComplexNDArray iq = args(3).float_complex_array_value().reshape(iq_dims);
+			bfi_update<float>(e, e.samples_f, e.dm_f, e.pf_f, iq, c);
+			return bfi_image<float>(e);
+		}
+		ComplexNDArray iq = args(3).complex_array_value().reshape(iq_dims);
+		bfi_update<double>(e, e.samples_d, e.dm_d, e.pf_d, iq, c);
+		return bfi_image<double>(e);
+	}
+
+	std::string key = args(0).string_value();
+	std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+
+	if ((key=="reset")||(key=="clear"))
+	{
+		int handle;
+		if (args.length()!=2)
+		{
+			print_usage();
+			return octave_value();
+		}
+		if (!bfi_handle(args(1), handle))
+			return octave_value();
+		if (key=="clear")
+			engines.erase(handle);
+		else
+			bfi_clear(engines[handle]);
+		return octave_value();
+	}
+
+	if (key!="create")
+	{
+		error("unknown command \"%s\"", key.c_str());
+		return octave_value();
+	}
+	if (args.length() < 4)
+	{
+		print_usage();
+		return octave_value();
+	}
+
+	bf_incremental e;
+	if (!bf_parse_options(args, 4, BF_DAS, true, e.opts))
+		return octave_value();
+
+	bool vector = (args(1).ndims()==2) && (args(1).dims().num_ones()>=1);
+	if ((!args(1).isreal())||(!vector)||(args(1).numel() < 2))
+	{
+		error("time must be a real vector with at least two samples");
+		return octave_value();
+	}
+	e.time	  = args(1).array_value();
+	e.uniform = bf_uniform_time(e.time, e.t0, e.ts);
+
+	if ((!args(2).isreal())||((args(2).ndims()!=3)&&(args(2).ndims()!=5)))
+	{
+		error("delay map must be a real (x , y , z) or (x , y , z , n_tx , n_rx) matrix");
+		return octave_value();
+	}
+	if (args(3).dims()!=args(2).dims())
+	{
+		error("Phase fact size not consistent with delay_map");
+		return octave_value();
+	}
+	dim_vector dims = args(2).dims();
+	e.nx	= dims(0);
+	e.ny	= dims(1);
+	e.nz	= dims(2);
+	e.n_tx	= dims.ndims()==5 ? dims(3) : 1;
+	e.n_rx	= dims.ndims()==5 ? dims(4) : 1;
+	e.n_vox = e.nx*e.ny*e.nz;
+	e.n_ch	= (octave_idx_type)e.n_tx*e.n_rx;
+	e.single = args(2).is_single_type()||args(3).is_single_type();
+	if (e.single)
+	{
+		e.dm_f = args(2).float_array_value();
+		e.pf_f = args(3).float_complex_array_value();
+		e.samples_f.resize(e.n_vox*e.n_ch);
+	}
+	else
+	{
+		e.dm_d = args(2).array_value();
+		e.pf_d = args(3).complex_array_value();
+		e.samples_d.resize(e.n_vox*e.n_ch);
+	}
+	bfi_clear(e);
+
+	int handle = next_handle++;
+	engines[handle] = e;
+	return octave_value(handle);
+}
+
+/*
+%!shared time, dm, pf
+%! nt = 64; n_tx = 2; n_rx = 3;
+%! time = (0:nt-1)'/1.792e9;
+%! dm = (5 + 50*rand (8, 6, 4, n_tx, n_rx))/1.792e9;
+%! pf = exp (2i*pi*rand (size (dm)));
+
+%!test
+%! ## Same image as signal_das / signal_fdmas on the data received so far, across
+%! ## the periodic rebuild of the running sums (every 1024 updates)
+%! for opts = {{}, {"scf"}, {"cf", "lagrange"}, {"fdmas"}, {"fdmas", "full"}}
+%!   h = signal_bf_incremental ("create", time, dm, pf, opts{1}{:});
+%!   iq = complex (zeros (numel (time), 2, 3));
+%!   for k = 1:1100
+%!     tx = randi (2);
+%!     rx = randi (3);
+%!     iq(:,tx,rx) = complex (randn (numel (time), 1), randn (numel (time), 1));
+%!     map = signal_bf_incremental (h, tx, rx, iq(:,tx,rx));
+%!     if (any (k == [1 2 7 1023 1024 1025 1100]))
+%!       if ((! isempty (opts{1})) && strcmp (opts{1}{1}, "fdmas"))
+%!         ref = signal_fdmas (iq, time, dm, pf, opts{1}{2:end});
+%!       else
+%!         ref = signal_das (iq, time, dm, pf, opts{1}{:});
+%!       endif
+%!       assert (map, ref, 1e-9*max (abs (ref(:))));
+%!     endif
+%!   endfor
+%!   assert (signal_bf_incremental (h), map);
+%!   signal_bf_incremental ("reset", h);
+%!   assert (signal_bf_incremental (h), zeros (8, 6, 4));
+%!   signal_bf_incremental ("clear", h);
+%! endfor
+
+%!test
+%! h = signal_bf_incremental ("create", time, single (dm), single (pf));
+%! map = signal_bf_incremental (h, 2, 3, ones (numel (time), 1));
+%! assert (class (map), "single");
+%! signal_bf_incremental ("clear", h);
+
+%!error signal_bf_incremental (-1)
+%!error <tx and rx must be antenna indices>
+%! h = signal_bf_incremental ("create", time, dm, pf);
+%! unwind_protect
+%!   signal_bf_incremental (h, 1.5, 1, ones (numel (time), 1));
+%! unwind_protect_cleanup
+%!   signal_bf_incremental ("clear", h);
+%! end_unwind_protect
+*/
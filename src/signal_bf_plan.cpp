@@ -0,0 +1,150 @@
+/* Copyright (C) 2024 Alessio Cacciatori
+##
+## This program is free software: you can redistribute it and/or modify
+## it under the terms of the GNU General Public License as published by
+## the Free Software Foundation, either version 3 of the License, or
+## (at your option) any later version.
+##
+## This program is distributed in the hope that it will be useful,
+## but WITHOUT ANY WARRANTY; without even the implied warranty of
+## MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+## GNU General Public License for more details.
+##
+## You should have received a copy of the GNU General Public License
+## along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+## -*- texinfo -*-
+## @deftypefn {} {@var{plan} =} signal_bf_plan (@var{time}, @var{delay_map}, @var{phase_fact})\n\
+## @deftypefnx {} {@var{plan} =} signal_bf_plan (@var{time}, @var{delay_map}, @var{phase_fact}, @var{n_threads})\n\
+## Precompute the beamforming plan used by signal_das and signal_fdmas.\n\
+## @var{time} is the time support for signals \n\
+## @var{delay_map} is delay map that must be in (x * y * z) or (x * y * z * n_tx * n_rx) \n\
+## @var{phase_fact} is the phase factor \n\
+## @seealso{signal_das, signal_fdmas}
+## @end deftypefn
+
+## Author: Alessio Cacciatori <alessioc@alessio-laptop>
+## Created: 2024-11-15
+*/
+
+#include <octave/oct.h>
+#include <octave/ov-struct.h>
+#include "aria_beamforming.h"
+
+DEFUN_DLD(signal_bf_plan, args, , "-*- texinfo -*-\n\
+@deftypefn {} {@var{plan} =} signal_bf_plan (@var{time}, @var{delay_map}, @var{phase_fact})\n\
+Precompute the beamforming plan used by signal_das and signal_fdmas.\n\
+The plan stores, for every voxel and every tx/rx pair, the lower sample index, \n\
+the linear interpolation weight and the phase factor, so that subsequent calls \n\
+@code{signal_das (@var{signals}, @var{plan})} only perform a gather and a multiply-accumulate.\n\
+The tables hold the tx/rx pairs of a voxel contiguously and the voxels in blocks of \n\
+8 x 8 x 8, so the samples read by a block stay in cache; @var{plan}.voxel is the zero based \n\
+index of every table column in the map.\n\
+@var{time} is the time support for signals \n\
+@var{delay_map} is delay map that must be in (x * y * z) or (x , y , z , [n_tx * n_rx]) \n\
+@var{phase_fact} is the phase factor \n\
+When @var{delay_map} or @var{phase_fact} is single, the plan tables are single and \n\
+the plan runs the single precision kernels.\n\
+@var{n_threads} is the number of threads the plan is built with (default: all cores).\n\
+@seealso{signal_das, signal_fdmas}\n\
+@end deftypefn")
+{
+	if ((args.length() < 3)||(args.length() > 4))
+	{
+		print_usage();
+		return octave_value();
+	}
+
+	// Check Time
+	bool vector = (args(0).ndims()==2) && (args(0).dims().num_ones()>=1);
+	if ((!args(0).isreal())||(!vector))
+	{
+		error("time must be a real vector");
+		return octave_value();
+	}
+	NDArray time = args(0).array_value();
+	if (time.numel() < 2)
+	{
+		error("time support must contain at least two samples");
+		return octave_value();
+	}
+
+	// Check delay map
+	if (!args(1).isreal())
+	{
+		error("delay map must be real");
+		return octave_value();
+	}
+
+	if ((args(1).ndims() < 2)||(args(1).ndims() > 5))
+	{
+		error("delay map must be a 2d to 5d matrix");
+		return octave_value();
+	}
+
+	if (args(2).dims()!=args(1).dims())
+	{
+		error("Phase fact size not consistent with delay_map");
+		return octave_value();
+	}
+
+	int n_threads = bf_default_threads();
+	if ((args.length()==4)&&(!bf_threads_from_value(args(3), n_threads)))
+		return octave_value();
+
+	// Single precision tables when the maps are single
+	if (args(1).is_single_type()||args(2).is_single_type())
+	{
+		FloatNDArray		delay_map  = args(1).float_array_value();
+		FloatComplexNDArray phase_fact = args(2).float_complex_array_value();
+		return bf_plan_to_value(bf_build_plan<float>(time, delay_map, phase_fact, n_threads));
+	}
+
+	NDArray			delay_map  = args(1).array_value();
+	ComplexNDArray	phase_fact = args(2).complex_array_value();
+
+	return bf_plan_to_value(bf_build_plan<double>(time, delay_map, phase_fact, n_threads));
+}
+
+/*
+%!shared time, iq, dm, pf
+%! nt = 128; n_tx = 2; n_rx = 3;
+%! time = (0:nt-1)'/1.792e9;
+%! iq = complex (randn (nt, n_tx, n_rx), randn (nt, n_tx, n_rx));
+%! dm = (10 + 100*rand (20, 15, 4, n_tx, n_rx))/1.792e9;
+%! pf = exp (2i*pi*rand (size (dm)));
+
+%!test
+%! plan = signal_bf_plan (time, dm, pf);
+%! assert (size (plan.index), [6, 1200]);
+%! assert (signal_das (iq, plan), signal_das (iq, time, dm, pf), 1e-10);
+%! assert (signal_fdmas (iq, plan), signal_fdmas (iq, time, dm, pf), 1e-10);
+%! assert (signal_fdmas (iq, plan, "full"), signal_fdmas (iq, time, dm, pf, "full"), 1e-10);
+
+%!test
+%! plan = signal_bf_plan (time, dm, pf, 1);
+%! assert (signal_bf_plan (time, dm, pf, 3), plan);
+
+%!test
+%! plan = signal_bf_plan (time, single (dm), single (pf));
+%! assert (class (plan.frac), "single");
+%! map = signal_das (single (iq), plan);
+%! assert (class (map), "single");
+%! assert (map, signal_das (single (iq), time, single (dm), single (pf)), 1e-3);
+
+%!test
+%! plan = signal_bf_plan (time, dm, pf);
+%! ref = plan;
+%! ref.index(1:2) = [numel(time)-2, 0];
+%! ref.frac(1:2) = [1, 0];
+%! plan.index(1:2) = [numel(time)+5, -3];
+%! plan.frac(1:2) = [2, -1];
+%! assert (signal_das (iq, plan), signal_das (iq, ref));
+
+%!error <plan voxel table is not a permutation of the voxels>
+%! plan = signal_bf_plan (time, dm, pf);
+%! plan.voxel(2) = plan.voxel(1);
+%! signal_das (iq, plan);
+
+%!error <n_threads must be a positive integer> signal_bf_plan (time, dm, pf, 1.5)
+*/
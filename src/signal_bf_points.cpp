@@ -0,0 +1,183 @@
+/* Copyright (C) 2024 Alessio Cacciatori
+##
+## This program is free software: you can redistribute it and/or modify
+## it under the terms of the GNU General Public License as published by
+## the Free Software Foundation, either version 3 of the License, or
+## (at your option) any later version.
+##
+## This program is distributed in the hope that it will be useful,
+## but WITHOUT ANY WARRANTY; without even the implied warranty of
+## MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+## GNU General Public License for more details.
+##
+## You should have received a copy of the GNU General Public License
+## along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+## -*- texinfo -*-
+## @deftypefn {} {@var{values} =} signal_bf_points (@var{signals}, @var{time}, @var{points}, @var{frf}, @var{pos_tx}, @var{pos_rx})\n\
+## Return the beamformed values at a list of points.\n\
+## @seealso{signal_bf_image, signal_das, build_delay_map}
+## @end deftypefn
+
+## Author: Alessio Cacciatori <alessioc@alessio-laptop>
+## Created: 2024-11-15
+*/
+
+#include <octave/oct.h>
+#include <octave/ov-struct.h>
+#include "aria_uwb_toolbox.h"
+#include "aria_beamforming.h"
+
+DEFUN_DLD(signal_bf_points, args, , "-*- texinfo -*-\n\
+@deftypefn {} {@var{values} =} signal_bf_points (@var{signals}, @var{time}, @var{points}, @var{frf}, @var{pos_tx}, @var{pos_rx})\n\
+@deftypefnx {} {@var{values} =} signal_bf_points (@dots{}, @var{options})\n\
+Return the beamformed values at a list of arbitrary points.\n\
+Delays and phase factors are computed on the fly with the same convention as build_delay_map, \n\
+so every point costs O(n_tx * n_rx) and matches the signal_bf_image voxel at the same position.\n\
+@var{signals} is the I/Q downsampled data. It must be in (time x n_tx x n_rx) format\n\
+@var{time} is the time support for signals \n\
+@var{points} is a M x 3 matrix of [x y z] positions \n\
+@var{frf} is the RF frequency \n\
+@var{pos_tx} is a n x 3 matrix where n is the number of transmitter antennas \n\
+@var{pos_rx} is a n x 3 matrix where n is the number of receiver    antennas \n\
+@var{options} are the optional arguments of signal_bf_image.\n\
+@var{values} is a M x 1 vector, single when @var{signals} is single.\n\
+@seealso{signal_bf_image, signal_das, build_delay_map}\n\
+@end deftypefn")
+{
+	if (args.length() < 6)
+	{
+		print_usage();
+		return octave_value();
+	}
+
+	bf_options opts;
+	if (!bf_parse_options(args, 6, BF_DAS, true, opts))
+		return octave_value();
+
+	// Check time
+	bool vector = (args(1).ndims()==2) && (args(1).dims().num_ones()>=1);
+	if ((!args(1).isreal())||(!vector))
+	{
+		error("time must be a real vector");
+		return octave_value();
+	}
+	NDArray time = args(1).array_value();
+	octave_idx_type time_samples = time.numel();
+	if (time_samples < 2)
+	{
+		error("time support must contain at least two samples");
+		return octave_value();
+	}
+
+	// Check points
+	if ((args(2).ndims()!=2)||(args(2).dims()(1)!=3)||(!args(2).isreal()))
+	{
+		error("points must be a M by 3 real matrix");
+		return octave_value();
+	}
+	NDArray points = args(2).array_value();
+
+	// Check freq
+	bool number = (args(3).dims().num_ones()==args(3).ndims());
+	if ((!number)||(!args(3).isreal())||(args(3).array_value()(0)<=0))
+	{
+		error("freq must be a single positive value");
+		return octave_value();
+	}
+	double freq = args(3).array_value()(0);
+
+	// Check tx-pos
+	if ((args(4).dims()(1)!=3)||(!args(4).isreal()))
+	{
+		error("tx position must be a n by 3 real matrix");
+		return octave_value();
+	}
+	NDArray pos_tx = args(4).array_value();
+
+	if ((args(5).dims()(1)!=3)||(!args(5).isreal()))
+	{
+		error("rx position must be a n by 3 real matrix");
+		return octave_value();
+	}
+	NDArray pos_rx = args(5).array_value();
+
+	// Check BB data: (time x n_tx x n_rx)
+	dim_vector iq_dims = args(0).dims();
+	octave_idx_type n_tx = pos_tx.dim1();
+	octave_idx_type n_rx = pos_rx.dim1();
+	bool bVector = (n_tx*n_rx==1)&&(iq_dims.ndims()==2)&&(iq_dims.numel()==time_samples)&&(iq_dims.num_ones() >= 1);
+	if ((!bVector)&&((iq_dims.ndims() > 3)||(iq_dims(0)!=time_samples)||(iq_dims(1)!=n_tx)||
+					 ((iq_dims.ndims() > 2 ? iq_dims(2) : 1)!=n_rx)))
+	{
+		error("BB data dimension not consistent with time support and antenna positions");
+		return octave_value();
+	}
+
+	dim_vector out_dims({points.dim1(), 1});
+	if (args(0).is_single_type())
+	{
+		FloatComplexNDArray iq_signals = args(0).float_complex_array_value();
+		FloatNDArray out(out_dims);
+		bf_image_points<float>(iq_signals, time, freq, pos_tx, pos_rx, points, opts, out);
+		return octave_value(out);
+	}
+
+	ComplexNDArray iq_signals = args(0).complex_array_value();
+	NDArray out(out_dims);
+	bf_image_points<double>(iq_signals, time, freq, pos_tx, pos_rx, points, opts, out);
+
+	return octave_value(out);
+}
+
+/*
+%!shared x, y, z, frf, pos_tx, pos_rx, time, iq, dm, pf, grid
+%! x = linspace (-0.2, 0.2, 9);
+%! y = linspace (-0.1, 0.1, 7);
+%! z = linspace (0.5, 1, 5);
+%! frf = 7.29e9;
+%! pos_tx = [0 0 0; 0.02 0 0];
+%! pos_rx = [0 0.02 0; 0.02 0.02 0; 0.04 0.02 0];
+%! time = (0:255)'/1.792e9;
+%! iq = complex (randn (256, 2, 3), randn (256, 2, 3));
+%! [dm, pf] = build_delay_map (x, y, z, frf, pos_tx, pos_rx);
+%! [gx, gy, gz] = ndgrid (x, y, z);
+%! grid = [gx(:) gy(:) gz(:)];
+
+%!test
+%! ## All the voxels in map order: the signal_das image
+%! for opt = {{}, {"cf"}, {"lagrange"}}
+%!   ref = signal_das (iq, time, dm, pf, opt{1}{:});
+%!   values = signal_bf_points (iq, time, grid, frf, pos_tx, pos_rx, opt{1}{:});
+%!   assert (size (values), [numel(ref) 1]);
+%!   assert (values, ref(:), 1e-10*max (abs (ref(:))));
+%! endfor
+%! ref = signal_fdmas (iq, time, dm, pf, "full");
+%! values = signal_bf_points (iq, time, grid, frf, pos_tx, pos_rx, "fdmas", "full");
+%! assert (values, ref(:), 1e-10*max (abs (ref(:))));
+
+%!test
+%! ## Arbitrary point lists: a shuffled subset of the voxels, with repetitions
+%! map = signal_bf_image (iq, time, x, y, z, frf, pos_tx, pos_rx);
+%! idx = [randperm(numel (map), 40) 7 7];
+%! assert (signal_bf_points (iq, time, grid(idx,:), frf, pos_tx, pos_rx), map(idx)', 1e-12*max (abs (map(:))));
+
+%!test
+%! ## Off grid points: one voxel images at the same positions
+%! points = [0.013 -0.047 0.61; -0.151 0.08 0.93; 0 0 0.5];
+%! values = signal_bf_points (iq, time, points, frf, pos_tx, pos_rx);
+%! for m = 1:rows (points)
+%!   assert (values(m), signal_bf_image (iq, time, points(m,1), points(m,2), points(m,3), frf, pos_tx, pos_rx), 1e-10*max (abs (values)));
+%! endfor
+
+%!test
+%! values = signal_bf_points (single (iq), time, grid, frf, pos_tx, pos_rx);
+%! assert (class (values), "single");
+%! ref = signal_das (iq, time, dm, pf);
+%! assert (double (values), ref(:), 1e-4*max (abs (ref(:))));
+
+%!error <points must be a M by 3 real matrix>
+%! signal_bf_points (iq, time, grid(:,1:2), frf, pos_tx, pos_rx);
+%!error <BB data dimension not consistent>
+%! signal_bf_points (iq(:,:,1:2), time, grid, frf, pos_tx, pos_rx);
+*/
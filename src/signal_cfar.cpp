@@ -0,0 +1,502 @@
+/* Copyright (C) 2024 Alessio Cacciatori
+##
+## This program is free software: you can redistribute it and/or modify
+## it under the terms of the GNU General Public License as published by
+## the Free Software Foundation, either version 3 of the License, or
+## (at your option) any later version.
+##
+## This program is distributed in the hope that it will be useful,
+## but WITHOUT ANY WARRANTY; without even the implied warranty of
+## MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+## GNU General Public License for more details.
+##
+## You should have received a copy of the GNU General Public License
+## along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+## -*- texinfo -*-
+## @deftypefn {} {[@var{det}, @var{threshold}] =} signal_cfar (@var{map}, @var{method}, @var{guard}, @var{train}, @var{pfa})\n\
+## CA-CFAR and OS-CFAR detection over range profiles and 2D/3D maps.\n\
+## @seealso{signal_das, signal_bf_image, get_detection_2D}
+## @end deftypefn
+
+## Author: Alessio Cacciatori <alessioc@alessio-laptop>
+## Created: 2024-11-15
+*/
+
+#include <octave/oct.h>
+#include <octave/ov-struct.h>
+#include <algorithm>
+#include <numeric>
+#include <limits>
+#include <vector>
+#include "aria_uwb_toolbox.h"
+#include "aria_beamforming.h"
+
+// The map is handled as a (n[0] x n[1] x n[2]) array; the training window of a cell
+// is the box of half widths guard+train clipped to the map, minus the guard box
+// (cell under test included) clipped in the same way.
+struct cfar_grid
+{
+	octave_idx_type n[3];
+	octave_idx_type guard[3];
+	octave_idx_type outer[3];	// guard + train
+
+	octave_idx_type numel() const { return n[0]*n[1]*n[2]; }
+
+	void box(const octave_idx_type* c, const octave_idx_type* half, octave_idx_type* lo, octave_idx_type* hi) const
+	{
+		for (int d=0; d < 3; d++)
+		{
+			lo[d] = std::max(c[d]-half[d], (octave_idx_type)0);
+			hi[d] = std::min(c[d]+half[d], n[d]-1);
+		}
+	}
+
+	// Training cells of the cell c
+	octave_idx_type n_train(const octave_idx_type* c) const
+	{
+		octave_idx_type lo[3], hi[3], vo = 1, vi = 1;
+		box(c, outer, lo, hi);
+		for (int d=0; d < 3; d++) vo *= hi[d]-lo[d]+1;
+		box(c, guard, lo, hi);
+		for (int d=0; d < 3; d++) vi *= hi[d]-lo[d]+1;
+		return vo - vi;
+	}
+};
+
+//---------------------------------------------------
+// CA-CFAR: window sums from a summed-area table, O(1) per cell
+struct cfar_sat
+{
+	octave_idx_type		s0, s1;		// strides of the (n0+1) x (n1+1) x (n2+1) table
+	std::vector<double> sat;
+
+	cfar_sat(const cfar_grid& g, const double* p) : s0(g.n[0]+1), s1((g.n[0]+1)*(g.n[1]+1)),
+												   sat((g.n[0]+1)*(g.n[1]+1)*(g.n[2]+1), 0.0)
+	{
+		for (octave_idx_type z=0; z < g.n[2]; z++)
+			for (octave_idx_type y=0; y < g.n[1]; y++)
+			{
+				double row = 0;
+				for (octave_idx_type x=0; x < g.n[0]; x++)
+				{
+					row += p[x + g.n[0]*(y + g.n[1]*z)];
+					octave_idx_type i = (x+1) + s0*(y+1) + s1*(z+1);
+					sat[i] = row + sat[i-s0] + sat[i-s1] - sat[i-s0-s1];
+				}
+			}
+	}
+
+	// Sum over the inclusive box [lo, hi]
+	double sum(const octave_idx_type* lo, const octave_idx_type* hi) const
+	{
+		octave_idx_type x0 = lo[0], x1 = hi[0]+1;
+		octave_idx_type y0 = s0*lo[1], y1 = s0*(hi[1]+1);
+		octave_idx_type z0 = s1*lo[2], z1 = s1*(hi[2]+1);
+		return  sat[x1+y1+z1] - sat[x0+y1+z1] - sat[x1+y0+z1] - sat[x1+y1+z0]
+			  + sat[x0+y0+z1] + sat[x0+y1+z0] + sat[x1+y0+z0] - sat[x0+y0+z0];
+	}
+};
+
+static void cfar_ca(const cfar_grid& g, const double* p, double pfa, int n_threads, double* thr)
+{
+	cfar_sat sat(g, p);
+	bf_parallel_for(g.numel(), 1024, n_threads, [&](octave_idx_type v_begin, octave_idx_type v_end)
+	{
+		for (octave_idx_type v=v_begin; v < v_end; v++)
+		{
+			octave_idx_type c[3] = {v % g.n[0], (v / g.n[0]) % g.n[1], v / (g.n[0]*g.n[1])};
+			octave_idx_type lo[3], hi[3];
+			octave_idx_type n = g.n_train(c);
+			if (n <= 0)
+			{
+				thr[v] = std::numeric_limits<double>::infinity();
+				continue;
+			}
+			g.box(c, g.outer, lo, hi);
+			double s = sat.sum(lo, hi);
+			g.box(c, g.guard, lo, hi);
+			s -= sat.sum(lo, hi);
+			// Exponential (square law) clutter: alpha = N (pfa^(-1/N) - 1)
+			double alpha = n*(pow(pfa, -1.0/n) - 1.0);
+			thr[v] = alpha*std::max(s, 0.0)/n;
+		}
+	});
+}
+
+//---------------------------------------------------
+// OS-CFAR: the training cells of a line of cells are kept in a Fenwick tree over the
+// ranks of the map values, updated by the planes that enter and leave the window
+// while sliding along the first dimension; the k-th value is found in O(log n).
+struct cfar_ranks
+{
+	std::vector<int> tree;
+	int				 top;		// highest power of two <= size
+
+	explicit cfar_ranks(octave_idx_type size) : tree(size+1, 0), top(1)
+	{
+		while (2*(octave_idx_type)top <= size) top *= 2;
+	}
+
+	void add(octave_idx_type rank, int delta)
+	{
+		for (octave_idx_type i=rank+1; i < (octave_idx_type)tree.size(); i += i & -i)
+			tree[i] += delta;
+	}
+
+	// Rank of the k-th (1-based) smallest element
+	octave_idx_type kth(octave_idx_type k) const
+	{
+		octave_idx_type pos = 0;
+		for (octave_idx_type step=top; step > 0; step >>= 1)
+		{
+			if ((pos+step < (octave_idx_type)tree.size())&&(tree[pos+step] < k))
+			{
+				pos += step;
+				k	-= tree[pos];
+			}
+		}
+		return pos;
+	}
+};
+
+// Threshold factor: pfa = prod_{i<k} (N-i)/(N-i+alpha) for exponential clutter
+static double cfar_os_alpha(octave_idx_type n, octave_idx_type k, double pfa)
+{
+	double target = log(pfa);
+	auto   lpfa	  = [&](double alpha)
+	{
+		double s = 0;
+		for (octave_idx_type i=0; i < k; i++)
+			s += log((double)(n-i)/(n-i+alpha));
+		return s;
+	};
+	double lo = 0, hi = 1;
+	while (lpfa(hi) > target)
+		hi *= 2;
+	for (int it=0; it < 60; it++)
+	{
+		double mid = 0.5*(lo+hi);
+		if (lpfa(mid) > target)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return 0.5*(lo+hi);
+}
+
+// Rank of the window statistic for n training cells, k is given for the full window
+static octave_idx_type cfar_os_rank(octave_idx_type n, octave_idx_type k, octave_idx_type n_full)
+{
+	octave_idx_type kn = (octave_idx_type)std::llround((double)k*n/n_full);
+	return std::min(std::max(kn, (octave_idx_type)1), n);
+}
+
+static void cfar_os(const cfar_grid& g, const double* p, double pfa, octave_idx_type k, int n_threads, double* thr)
+{
+	octave_idx_type n_vox = g.numel();
+
+	// Global ranks of the values, ties broken by position
+	std::vector<octave_idx_type> order(n_vox);
+	std::iota(order.begin(), order.end(), 0);
+	std::sort(order.begin(), order.end(), [&](octave_idx_type a, octave_idx_type b) { return p[a] < p[b] || (p[a]==p[b] && a < b); });
+	std::vector<octave_idx_type> rank(n_vox);
+	for (octave_idx_type r=0; r < n_vox; r++)
+		rank[order[r]] = r;
+
+	// Threshold factors of the training sizes found in the map
+	octave_idx_type n_full = 1, n_guard = 1;
+	for (int d=0; d < 3; d++)
+	{
+		n_full	*= std::min(2*g.outer[d]+1, g.n[d]);
+		n_guard *= std::min(2*g.guard[d]+1, g.n[d]);
+	}
+	n_full = std::max(n_full - n_guard, (octave_idx_type)1);
+	std::vector<double> alpha(n_full+1, -1.0);
+	for (octave_idx_type v=0; v < n_vox; v++)
+	{
+		octave_idx_type c[3] = {v % g.n[0], (v / g.n[0]) % g.n[1], v / (g.n[0]*g.n[1])};
+		octave_idx_type n	 = g.n_train(c);
+		if ((n > 0)&&(alpha[n] < 0))
+			alpha[n] = cfar_os_alpha(n, cfar_os_rank(n, k, n_full), pfa);
+	}
+
+	// One chunk of lines per thread: every chunk allocates its n_vox tree once and
+	// empties it between lines, lines have about the same cost
+	octave_idx_type n_lines = g.n[1]*g.n[2];
+	octave_idx_type chunk	= (n_lines + std::max(n_threads, 1) - 1)/std::max(n_threads, 1);
+	bf_parallel_for(n_lines, chunk, n_threads, [&](octave_idx_type l_begin, octave_idx_type l_end)
+	{
+		cfar_ranks tree(n_vox);
+		// delta on the plane x of the (y, z) box [lo, hi]
+		auto plane = [&](octave_idx_type x, const octave_idx_type* lo, const octave_idx_type* hi, int delta)
+		{
+			if ((x < 0)||(x >= g.n[0]))
+				return;
+			for (octave_idx_type z=lo[2]; z <= hi[2]; z++)
+				for (octave_idx_type y=lo[1]; y <= hi[1]; y++)
+					tree.add(rank[x + g.n[0]*(y + g.n[1]*z)], delta);
+		};
+		for (octave_idx_type l=l_begin; l < l_end; l++)
+		{
+			octave_idx_type c[3] = {0, l % g.n[1], l / g.n[1]};
+			octave_idx_type olo[3], ohi[3], ilo[3], ihi[3];
+			g.box(c, g.outer, olo, ohi);
+			g.box(c, g.guard, ilo, ihi);
+			for (octave_idx_type x=olo[0]; x <= ohi[0]; x++)
+				plane(x, olo, ohi, 1);
+			for (octave_idx_type x=ilo[0]; x <= ihi[0]; x++)
+				plane(x, ilo, ihi, -1);
+			for (c[0]=0; c[0] < g.n[0]; c[0]++)
+			{
+				if (c[0] > 0)
+				{
+					octave_idx_type x = c[0];
+					plane(x-1-g.outer[0], olo, ohi, -1);
+					plane(x+g.outer[0],	  olo, ohi,	1);
+					plane(x-1-g.guard[0], ilo, ihi,	1);
+					plane(x+g.guard[0],	  ilo, ihi, -1);
+				}
+				octave_idx_type v = c[0] + g.n[0]*l;
+				octave_idx_type n = g.n_train(c);
+				if (n <= 0)
+				{
+					thr[v] = std::numeric_limits<double>::infinity();
+					continue;
+				}
+				thr[v] = alpha[n]*p[order[tree.kth(cfar_os_rank(n, k, n_full))]];
+			}
+			// Empty the tree for the next line
+			octave_idx_type x = g.n[0]-1;
+			for (octave_idx_type xo=std::max(x-g.outer[0], (octave_idx_type)0); xo <= x; xo++)
+				plane(xo, olo, ohi, -1);
+			for (octave_idx_type xi=std::max(x-g.guard[0], (octave_idx_type)0); xi <= x; xi++)
+				plane(xi, ilo, ihi, 1);
+		}
+	});
+}
+
+// Half widths: a scalar for all the dimensions or one value per dimension
+static bool cfar_widths(const octave_value& value, int n_dims, const char* name, octave_idx_type* w)
+{
+	if ((!value.isreal())||((value.numel()!=1)&&(value.numel()!=n_dims)))
+	{
+		error("%s must be a non negative scalar or one value per map dimension", name);
+		return false;
+	}
+	NDArray a = value.array_value();
+	for (int d=0; d < 3; d++)
+	{
+		double v = d < n_dims ? a(value.numel()==1 ? 0 : d) : 0;
+		if ((v < 0)||(v!=std::floor(v)))
+		{
+			error("%s must be a non negative integer", name);
+			return false;
+		}
+		w[d] = (octave_idx_type)v;
+	}
+	return true;
+}
+
+DEFUN_DLD(signal_cfar, args, nargout, "-*- texinfo -*-\n\
+@deftypefn {} {[@var{det}, @var{threshold}] =} signal_cfar (@var{map}, \"ca\", @var{guard}, @var{train}, @var{pfa})\n\
+@deftypefnx {} {[@var{det}, @var{threshold}] =} signal_cfar (@var{map}, \"ca\", @var{guard}, @var{train}, @var{pfa}, @var{n_threads})\n\
+@deftypefnx {} {[@var{det}, @var{threshold}] =} signal_cfar (@var{map}, \"os\", @var{guard}, @var{train}, @var{pfa})\n\
+@deftypefnx {} {[@var{det}, @var{threshold}] =} signal_cfar (@var{map}, \"os\", @var{guard}, @var{train}, @var{pfa}, @var{rank})\n\
+@deftypefnx {} {[@var{det}, @var{threshold}] =} signal_cfar (@var{map}, \"os\", @var{guard}, @var{train}, @var{pfa}, @var{rank}, @var{n_threads})\n\
+Constant false alarm rate detection over a range profile or a 2D/3D map.\n\
+@var{map} is a real power map (e.g. abs (signal_das (@dots{})).^2) with up to 3 dimensions; \n\
+complex maps are converted to power.\n\
+The training window of a cell is the box of half widths @var{guard}+@var{train} around it \n\
+minus the guard box of half widths @var{guard}, cell under test included; both are clipped \n\
+to the map. @var{guard} and @var{train} are scalars or one value per map dimension.\n\
+\"ca\" (cell averaging) compares every cell with the mean of its training cells, computed in \n\
+O(1) from a summed-area table. \"os\" (ordered statistic) uses the @var{rank}-th smallest \n\
+training value (default: 3/4 of the full window), kept by sliding the window along the \n\
+first dimension over a rank tree in O(@var{train}^(d-1) log n) per cell. \n\
+The threshold factor gives the false alarm probability @var{pfa} for exponentially \n\
+distributed (square law) clutter and is recomputed for the clipped windows at the borders.\n\
+@var{n_threads} is the number of threads (default: all cores).\n\
+@var{det} is the sparse list of detections, one row [i, (j, (k,)) value, threshold] per cell \n\
+above its threshold with one based indices (a single index for vectors), in map order. \n\
+@var{threshold} is the full threshold map. Both are single when @var{map} is single.\n\
+@seealso{signal_das, signal_bf_image, get_detection_2D}\n\
+@end deftypefn")
+{
+	octave_value_list retval;
+	if ((args.length() < 5)||(args.length() > 7))
+	{
+		print_usage();
+		return octave_value();
+	}
+
+	if ((!args(0).isnumeric())||(args(0).isempty())||(args(0).ndims() > 3))
+	{
+		error("map must be a numeric array with up to 3 dimensions");
+		return octave_value();
+	}
+	dim_vector dims = args(0).dims();
+	NDArray	   map;
+	if (args(0).iscomplex())
+	{
+		ComplexNDArray cmap = args(0).complex_array_value();
+		map = NDArray(dims);
+		for (octave_idx_type v=0; v < cmap.numel(); v++)
+			map.xelem(v) = std::norm(cmap.xelem(v));
+	}
+	else
+		map = args(0).array_value();
+
+	if (!args(1).is_string())
+	{
+		error("method must be \"ca\" or \"os\"");
+		return octave_value();
+	}
+	std::string method = args(1).string_value();
+	std::transform(method.begin(), method.end(), method.begin(), ::tolower);
+	if ((method!="ca")&&(method!="os"))
+	{
+		error("unknown method \"%s\"", method.c_str());
+		return octave_value();
+	}
+
+	// A vector is a 1D profile along its length
+	bool	   bVector = (dims.ndims()==2)&&((dims(0)==1)||(dims(1)==1));
+	int		   n_dims  = bVector ? 1 : dims.ndims();
+	cfar_grid  g;
+	g.n[0] = bVector ? map.numel() : dims(0);
+	g.n[1] = bVector ? 1 : dims(1);
+	g.n[2] = dims.ndims() > 2 ? dims(2) : 1;
+
+	octave_idx_type train[3];
+	if ((!cfar_widths(args(2), n_dims, "guard", g.guard))||(!cfar_widths(args(3), n_dims, "train", train)))
+		return octave_value();
+	for (int d=0; d < 3; d++)
+		g.outer[d] = g.guard[d] + train[d];
+
+	if ((!args(4).is_real_scalar())||(args(4).double_value() <= 0)||(args(4).double_value() >= 1))
+	{
+		error("pfa must be in (0, 1)");
+		return octave_value();
+	}
+	double pfa = args(4).double_value();
+
+	int				n_threads = bf_default_threads();
+	octave_idx_type rank	  = 0;
+	int				i_threads = 5;
+	if (method=="os")
+	{
+		octave_idx_type n_full = 1, n_guard = 1;
+		for (int d=0; d < 3; d++)
+		{
+			n_full	*= std::min(2*g.outer[d]+1, g.n[d]);
+			n_guard *= std::min(2*g.guard[d]+1, g.n[d]);
+		}
+		n_full -= n_guard;
+		if (n_full < 1)
+		{
+			error("the training window is empty");
+			return octave_value();
+		}
+		rank = std::max((octave_idx_type)std::llround(0.75*n_full), (octave_idx_type)1);
+		if ((args.length() > 5)&&(!args(5).isempty()))
+		{
+			if ((!args(5).is_real_scalar())||(args(5).double_value() < 1)||(args(5).double_value() > n_full))
+			{
+				error("rank must be an integer between 1 and the number of training cells (%ld)", (long)n_full);
+				return octave_value();
+			}
+			rank = args(5).idx_type_value();
+		}
+		i_threads = 6;
+	}
+	if (args.length() > i_threads+1)
+	{
+		print_usage();
+		return octave_value();
+	}
+	if ((args.length() > i_threads)&&(!bf_threads_from_value(args(i_threads), n_threads)))
+		return octave_value();
+
+	NDArray thr(dims);
+	if (method=="ca")
+		cfar_ca(g, map.data(), pfa, n_threads, thr.fortran_vec());
+	else
+		cfar_os(g, map.data(), pfa, rank, n_threads, thr.fortran_vec());
+
+	// Single maps get a single threshold; cells are compared with the threshold
+	// returned, so that det and threshold agree
+	bool bSingle = args(0).is_single_type();
+	if (bSingle)
+		thr = NDArray(FloatNDArray(thr));
+
+	// Sparse detection list
+	const double*				 p = map.data();
+	const double*				 t = thr.data();
+	std::vector<octave_idx_type> hits;
+	for (octave_idx_type v=0; v < map.numel(); v++)
+		if (p[v] > t[v])
+			hits.push_back(v);
+
+	octave_idx_type n_hits = hits.size();
+	NDArray det(dim_vector({n_hits, n_dims+2}));
+	for (octave_idx_type h=0; h < n_hits; h++)
+	{
+		octave_idx_type v = hits[h];
+		octave_idx_type c[3] = {v % g.n[0], (v / g.n[0]) % g.n[1], v / (g.n[0]*g.n[1])};
+		for (int d=0; d < n_dims; d++)
+			det(h, d) = c[d] + 1;
+		det(h, n_dims)	 = p[v];
+		det(h, n_dims+1) = t[v];
+	}
+
+	if (bSingle)
+	{
+		retval(0) = octave_value(FloatNDArray(det));
+		if (nargout > 1)
+			retval(1) = octave_value(FloatNDArray(thr));
+		return retval;
+	}
+	retval(0) = octave_value(det);
+	if (nargout > 1)
+		retval(1) = octave_value(thr);
+	return retval;
+}
+
+/*
+%!shared map, alpha_ca, alpha_os
+%! map = ones (64, 48);
+%! map(20, 10) = 100;
+%! map(40, 30) = 100;
+%! ## Interior training window: 9 x 9 box minus the 3 x 3 guard box
+%! n = 72;
+%! alpha_ca = n*(1e-3^(-1/n) - 1);
+%! k = round (0.75*n);
+%! alpha_os = fzero (@(a) sum (log ((n-(0:k-1))./(n-(0:k-1)+a))) - log (1e-3), [0 1e3]);
+
+%!test
+%! [det, thr] = signal_cfar (map, "ca", 1, 3, 1e-3);
+%! assert (det(:,1:3), [20 10 100; 40 30 100]);
+%! assert (det(:,4), thr(sub2ind (size (map), det(:,1), det(:,2))));
+%! assert (thr(32, 24), alpha_ca, 1e-12);
+%! ## (20, 10) is in the training window of (23, 10)
+%! assert (thr(23, 10), alpha_ca*(71 + 100)/72, 1e-10);
+
+%!test
+%! [det, thr] = signal_cfar (map, "os", 1, 3, 1e-3);
+%! assert (det(:,1:3), [20 10 100; 40 30 100]);
+%! assert (thr(32, 24), alpha_os, 1e-9);
+%! assert (signal_cfar (map, "os", 1, 3, 1e-3, [], 3), det);
+
+%!test
+%! ## Single maps give a single detection list and threshold
+%! [det, thr] = signal_cfar (single (map), "ca", 1, 3, 1e-3);
+%! assert (class (det), "single");
+%! assert (class (thr), "single");
+%! assert (det(:,1:3), single ([20 10 100; 40 30 100]));
+%! ## Range profile: a single index per detection
+%! det = signal_cfar (map(:,10), "ca", 1, 8, 1e-3);
+%! assert (det(:,1:2), [20 100]);
+
+%!error <pfa must be in> signal_cfar (map, "ca", 1, 3, 1)
+*/
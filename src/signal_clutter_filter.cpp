@@ -0,0 +1,423 @@
+/* Copyright (C) 2024 Alessio Cacciatori
+##
+## This program is free software: you can redistribute it and/or modify
+## it under the terms of the GNU General Public License as published by
+## the Free Software Foundation, either version 3 of the License, or
+## (at your option) any later version.
+##
+## This program is distributed in the hope that it will be useful,
+## but WITHOUT ANY WARRANTY; without even the implied warranty of
+## MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+## GNU General Public License for more details.
+##
+## You should have received a copy of the GNU General Public License
+## along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+## -*- texinfo -*-
+## @deftypefn {} {@var{h} =} signal_clutter_filter (@var{method}, @dots{})\n\
+## @deftypefnx {} {@var{frame_out} =} signal_clutter_filter (@var{h}, @var{frame})\n\
+## Streaming slow-time clutter removal.\n\
+## @seealso{signal_das, signal_bf_image}
+## @end deftypefn
+
+## Author: Alessio Cacciatori <alessioc@alessio-laptop>
+## Created: 2024-11-15
+*/
+
+#include <octave/oct.h>
+#include <octave/ov-struct.h>
+#include <map>
+#include <algorithm>
+#include <vector>
+#include "aria_uwb_toolbox.h"
+
+enum clutter_method {CLUTTER_EWMA, CLUTTER_MTI2, CLUTTER_MTI3, CLUTTER_HIGHPASS};
+
+// Filter state of every element (channel x range bin) of the frame.
+// Buffers are allocated by the first frame and updated in place afterwards.
+struct clutter_filter
+{
+	clutter_method				  method;
+	double						  alpha;	// EWMA
+	std::vector<double>			  b, a;		// high-pass, a(0) = 1
+	bool						  primed;
+	bool						  single;
+	dim_vector					  dims;
+	std::vector<FloatComplex>	  state_f;
+	std::vector<Complex>		  state_d;
+};
+
+// Filters of the session, released by "clear" or when the oct-file is cleared
+static std::map<int, clutter_filter> filters;
+static int							 next_handle = 1;
+
+// Number of state values per element
+static octave_idx_type clutter_order(const clutter_filter& f)
+{
+	switch (f.method)
+	{
+		case CLUTTER_MTI3:		return 2;
+		case CLUTTER_HIGHPASS:	return f.a.size()-1;
+		default:				return 1;
+	}
+}
+
+// The first frame initializes the state as if the scene had been static before it,
+// so the static clutter is removed from the first output without transients
+template <typename T>
+static void clutter_prime(const clutter_filter& f, const std::complex<T>* x, octave_idx_type n, std::vector<std::complex<T>>& s)
+{
+	if (f.method!=CLUTTER_HIGHPASS)
+	{
+		octave_idx_type k = clutter_order(f);
+		for (octave_idx_type i=0; i < n; i++)
+			for (octave_idx_type j=0; j < k; j++)
+				s[j*n+i] = x[i];
+		return;
+	}
+	// Direct form II transposed steady state for a constant input x0:
+	// y0 = x0*sum(b)/sum(a), z_k = sum_{m>k} (b_m*x0 - a_m*y0)
+	octave_idx_type k	 = clutter_order(f);
+	double			sb	 = 0, sa = 0;
+	for (double v : f.b) sb += v;
+	for (double v : f.a) sa += v;
+	double			gain = sb/sa;
+	for (octave_idx_type j=0; j < k; j++)
+	{
+		double c = 0;
+		for (octave_idx_type m=j+1; m <= k; m++)
+			c += f.b[m] - f.a[m]*gain;
+		for (octave_idx_type i=0; i < n; i++)
+			s[j*n+i] = x[i]*(T)c;
+	}
+}
+
+// State layout: (n x order), so that every pass runs over contiguous elements
+template <typename T>
+static void clutter_run(const clutter_filter& f, const std::complex<T>* x, std::complex<T>* y, octave_idx_type n,
+						std::vector<std::complex<T>>& s)
+{
+	std::complex<T>* s0 = s.data();
+	switch (f.method)
+	{
+		case CLUTTER_EWMA:
+		{
+			// Background b <- (1-alpha)*b + alpha*x, output x - b before the update
+			T alpha = f.alpha;
+			for (octave_idx_type i=0; i < n; i++)
+			{
+				y[i]   = x[i] - s0[i];
+				s0[i] += alpha*y[i];
+			}
+			break;
+		}
+		case CLUTTER_MTI2:
+			for (octave_idx_type i=0; i < n; i++)
+			{
+				y[i]  = x[i] - s0[i];
+				s0[i] = x[i];
+			}
+			break;
+		case CLUTTER_MTI3:
+		{
+			std::complex<T>* s1 = s0 + n;
+			for (octave_idx_type i=0; i < n; i++)
+			{
+				y[i]  = x[i] - T(2)*s0[i] + s1[i];
+				s1[i] = s0[i];
+				s0[i] = x[i];
+			}
+			break;
+		}
+		case CLUTTER_HIGHPASS:
+		{
+			octave_idx_type k = clutter_order(f);
+			T b0 = f.b[0];
+			for (octave_idx_type i=0; i < n; i++)
+				y[i] = b0*x[i] + s0[i];
+			for (octave_idx_type j=0; j < k; j++)
+			{
+				std::complex<T>* sj   = s0 + j*n;
+				const std::complex<T>* sn = j+1 < k ? s0 + (j+1)*n : nullptr;
+				T bj = f.b[j+1];
+				T aj = f.a[j+1];
+				for (octave_idx_type i=0; i < n; i++)
+					sj[i] = bj*x[i] - aj*y[i] + (sn ? sn[i] : std::complex<T>(0));
+			}
+			break;
+		}
+	}
+}
+
+template <typename T>
+static void clutter_apply(clutter_filter& f, const std::complex<T>* x, std::complex<T>* y, octave_idx_type n,
+						  std::vector<std::complex<T>>& s)
+{
+	if (!f.primed)
+	{
+		s.resize(n*clutter_order(f));
+		clutter_prime(f, x, n, s);
+		f.primed = true;
+	}
+	clutter_run(f, x, y, n, s);
+}
+
+static bool clutter_handle(const octave_value& value, int& handle)
+{
+	if ((!value.is_real_scalar())||(filters.find(value.int_value())==filters.end()))
+	{
+		error("invalid clutter filter handle");
+		return false;
+	}
+	handle = value.int_value();
+	return true;
+}
+
+DEFUN_DLD(signal_clutter_filter, args, , "-*- texinfo -*-\n\
+@deftypefn {} {@var{h} =} signal_clutter_filter (\"ewma\", @var{alpha})\n\
+@deftypefnx {} {@var{h} =} signal_clutter_filter (\"mti2\")\n\
+@deftypefnx {} {@var{h} =} signal_clutter_filter (\"mti3\")\n\
+@deftypefnx {} {@var{h} =} signal_clutter_filter (\"highpass\", @var{b}, @var{a})\n\
+@deftypefnx {} {@var{frame_out} =} signal_clutter_filter (@var{h}, @var{frame})\n\
+@deftypefnx {} {} signal_clutter_filter (\"reset\", @var{h})\n\
+@deftypefnx {} {} signal_clutter_filter (\"clear\", @var{h})\n\
+Streaming slow-time clutter removal over all the channels and range bins of a frame.\n\
+The first form creates a filter and returns its handle; the filter state is kept by the \n\
+oct-file and updated in place by every frame, so no state is copied between calls.\n\
+\"ewma\" subtracts an exponentially weighted background, updated as \n\
+b = (1-@var{alpha})*b + @var{alpha}*frame after the subtraction. \n\
+\"mti2\" and \"mti3\" are the two and three pulse cancellers frame - prev and \n\
+frame - 2*prev + prev2. \n\
+\"highpass\" runs the IIR filter with numerator @var{b} and denominator @var{a} along slow time, \n\
+as filter (@var{b}, @var{a}, @dots{}) on every element.\n\
+@var{frame} is a complex frame of any size, e.g. the raw data of read_raw_data_multiple \n\
+(channels x samples) or the I/Q data (time x n_tx x n_rx) of the imaging functions; all the \n\
+frames of a filter must have the same size and class. @var{frame_out} has the size of @var{frame} \n\
+and is single when @var{frame} is single.\n\
+The first frame initializes the state as a static scene, so its output is the clutter-free \n\
+steady state instead of a transient.\n\
+\"reset\" drops the state, the next frame initializes it again; \"clear\" releases the filter.\n\
+Clearing the oct-file (clear signal_clutter_filter) releases all the filters.\n\
+@seealso{signal_das, signal_bf_image}\n\
+@end deftypefn")
+{
+	if (args.length() < 1)
+	{
+		print_usage();
+		return octave_value();
+	}
+
+	// Filtering
+	if (!args(0).is_string())
+	{
+		int handle;
+		if (args.length()!=2)
+		{
+			print_usage();
+			return octave_value();
+		}
+		if (!clutter_handle(args(0), handle))
+			return octave_value();
+		clutter_filter& f = filters[handle];
+		if (!args(1).isnumeric())
+		{
+			error("frame must be a numeric array");
+			return octave_value();
+		}
+		dim_vector dims = args(1).dims();
+		bool single = args(1).is_single_type();
+		if ((f.primed)&&((dims!=f.dims)||(single!=f.single)))
+		{
+			error("frame size or class differs from the previous frames");
+			return octave_value();
+		}
+		f.dims	 = dims;
+		f.single = single;
+		if (single)
+		{
+			FloatComplexNDArray frame = args(1).float_complex_array_value();
+			FloatComplexNDArray out(dims);
+			clutter_apply<float>(f, frame.data(), out.fortran_vec(), frame.numel(), f.state_f);
+			return octave_value(out);
+		}
+		ComplexNDArray frame = args(1).complex_array_value();
+		ComplexNDArray out(dims);
+		clutter_apply<double>(f, frame.data(), out.fortran_vec(), frame.numel(), f.state_d);
+		return octave_value(out);
+	}
+
+	std::string key = args(0).string_value();
+	std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+
+	if ((key=="reset")||(key=="clear"))
+	{
+		int handle;
+		if (args.length()!=2)
+		{
+			print_usage();
+			return octave_value();
+		}
+		if (!clutter_handle(args(1), handle))
+			return octave_value();
+		if (key=="clear")
+		{
+			filters.erase(handle);
+			return octave_value();
+		}
+		clutter_filter& f = filters[handle];
+		f.primed = false;
+		std::vector<FloatComplex>().swap(f.state_f);
+		std::vector<Complex>().swap(f.state_d);
+		return octave_value();
+	}
+
+	clutter_filter f;
+	f.alpha	 = 0;
+	f.primed = false;
+	f.single = false;
+	if (key=="ewma")
+	{
+		if ((args.length()!=2)||(!args(1).is_real_scalar())||(args(1).double_value() <= 0)||(args(1).double_value() > 1))
+		{
+			error("ewma requires alpha in (0, 1]");
+			return octave_value();
+		}
+		f.method = CLUTTER_EWMA;
+		f.alpha	 = args(1).double_value();
+	}
+	else if ((key=="mti2")||(key=="mti3"))
+	{
+		if (args.length()!=1)
+		{
+			print_usage();
+			return octave_value();
+		}
+		f.method = key=="mti2" ? CLUTTER_MTI2 : CLUTTER_MTI3;
+	}
+	else if (key=="highpass")
+	{
+		if ((args.length()!=3)||(!args(1).isreal())||(!args(2).isreal())||(args(1).isempty())||(args(2).isempty()))
+		{
+			error("highpass requires real coefficient vectors b and a");
+			return octave_value();
+		}
+		NDArray b = args(1).array_value();
+		NDArray a = args(2).array_value();
+		if (a(0)==0)
+		{
+			error("a(1) must be non zero");
+			return octave_value();
+		}
+		// Normalized coefficients of the same length
+		octave_idx_type n = std::max(b.numel(), a.numel());
+		if (n < 2)
+		{
+			error("highpass requires a filter of order 1 or more");
+			return octave_value();
+		}
+		f.b.assign(n, 0.0);
+		f.a.assign(n, 0.0);
+		for (octave_idx_type i=0; i < b.numel(); i++)
+			f.b[i] = b(i)/a(0);
+		for (octave_idx_type i=0; i < a.numel(); i++)
+			f.a[i] = a(i)/a(0);
+		double sa = 0;
+		for (double v : f.a) sa += v;
+		if (sa==0)
+		{
+			error("the filter denominator has a pole at DC");
+			return octave_value();
+		}
+		f.method = CLUTTER_HIGHPASS;
+	}
+	else
+	{
+		error("unknown method \"%s\"", key.c_str());
+		return octave_value();
+	}
+
+	int handle = next_handle++;
+	filters[handle] = f;
+	return octave_value(handle);
+}
+
+/*
+%!function out = clutter_run_frames (h, frames)
+%! out = zeros (size (frames), class (frames));
+%! for k = 1:size (frames, 3)
+%!   y = signal_clutter_filter (h, frames(:,:,k));
+%!   assert (size (y), size (frames(:,:,k)));
+%!   assert (class (y), class (frames));
+%!   out(:,:,k) = y;
+%! endfor
+%! signal_clutter_filter ("clear", h);
+%!endfunction
+
+%!shared frames
+%! frames = complex (randn (4, 3, 12), randn (4, 3, 12));
+
+%!test
+%! ## Pulse cancellers: the primed first frame is a static scene
+%! out = clutter_run_frames (signal_clutter_filter ("mti2"), frames);
+%! assert (out(:,:,1), zeros (4, 3));
+%! assert (out(:,:,2:end), diff (frames, 1, 3), 1e-12);
+%! out = clutter_run_frames (signal_clutter_filter ("mti3"), frames);
+%! assert (out(:,:,1), zeros (4, 3));
+%! assert (out(:,:,2), frames(:,:,2) - frames(:,:,1), 1e-12);
+%! assert (out(:,:,3:end), diff (frames, 2, 3), 1e-12);
+
+%!test
+%! ## IIR high-pass: filter () along slow time, with the steady state of the
+%! ## first frame as initial condition (direct form II transposed)
+%! b = [0.9 -1.8 0.9];
+%! a = [1 -1.6 0.68];
+%! gain = sum (b)/sum (a);
+%! zi = arrayfun (@(j) sum (b(j+1:end) - a(j+1:end)*gain), 1:2)';
+%! x = reshape (frames, 12, 12).';
+%! ref = filter (b, a, x, zi .* x(1,:));
+%! out = clutter_run_frames (signal_clutter_filter ("highpass", b, a), frames);
+%! assert (reshape (out, 12, 12).', ref, 1e-12);
+%! ## Coefficients are normalized by a(1)
+%! assert (clutter_run_frames (signal_clutter_filter ("highpass", 2*b, 2*a), frames), out, 1e-12);
+%! ## A static scene is removed from the first frame on
+%! static = repmat (frames(:,:,1), [1 1 5]);
+%! assert (clutter_run_frames (signal_clutter_filter ("highpass", [1 -1], [1 -0.8]), static), zeros (4, 3, 5), 1e-12);
+
+%!test
+%! ## EWMA: background b(k) = (1-alpha)*b(k-1) + alpha*x(k), b(0) = x(1),
+%! ## output x(k) - b(k-1) = x(k) - (1-alpha)^(k-1)*x(1) - alpha*sum_j (1-alpha)^(k-1-j)*x(j)
+%! alpha = 0.2;
+%! out = clutter_run_frames (signal_clutter_filter ("ewma", alpha), frames);
+%! for k = 1:12
+%!   w = reshape (alpha*(1-alpha).^(k-2:-1:0), 1, 1, k-1);
+%!   ref = frames(:,:,k) - (1-alpha)^(k-1)*frames(:,:,1) - sum (w .* frames(:,:,1:k-1), 3);
+%!   assert (out(:,:,k), ref, 1e-12);
+%! endfor
+
+%!test
+%! ## Single frames
+%! for method = {{"mti2"}, {"mti3"}, {"ewma", 0.1}, {"highpass", [1 -1], [1 -0.9]}}
+%!   ref = clutter_run_frames (signal_clutter_filter (method{1}{:}), frames);
+%!   out = clutter_run_frames (signal_clutter_filter (method{1}{:}), single (frames));
+%!   assert (out, single (ref), 1e-4);
+%! endfor
+
+%!test
+%! h = signal_clutter_filter ("mti2");
+%! signal_clutter_filter (h, frames(:,:,1));
+%! signal_clutter_filter ("reset", h);
+%! assert (signal_clutter_filter (h, frames(:,:,2)), zeros (4, 3));
+%! signal_clutter_filter ("clear", h);
+
+%!error <invalid clutter filter handle> signal_clutter_filter (-1, 1)
+%!error <ewma requires alpha> signal_clutter_filter ("ewma", 0)
+%!error <the filter denominator has a pole at DC> signal_clutter_filter ("highpass", [1 -1], [1 -1])
+%!error <frame size or class differs>
+%! h = signal_clutter_filter ("mti2");
+%! unwind_protect
+%!   signal_clutter_filter (h, ones (4, 3));
+%!   signal_clutter_filter (h, single (ones (4, 3)));
+%! unwind_protect_cleanup
+%!   signal_clutter_filter ("clear", h);
+%! end_unwind_protect
+*/
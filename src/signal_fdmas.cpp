@@ -31,83 +31,95 @@
 
 #include <octave/oct.h>
 #include <octave/ov-struct.h>
-#include <octave/parse.h>
-
-#undef DEBUG
-struct search_return
-{
-	double _tmin;
-	double _tmax;
-	octave_idx_type _itmin;
-	search_return (double tmin,double tmax, octave_idx_type itmin) : _tmin(tmin), _tmax(tmax), _itmin(itmin) {}
-};
-
-inline search_return binary_search_time(const NDArray& time_array, double time)
-{
-	octave_idx_type i_min = 0;
-	octave_idx_type i_max = time_array.numel()-1;
-	double t_max = time_array.xelem(i_max);
-	double t_min = time_array.xelem(0);
-
-	if (time > t_max) return			search_return(t_max,t_max,i_max);
-	if (time < time_array.xelem(0))		search_return(t_min,t_min,-1);
-
-	while (i_max - i_min > 1)
-	{
-		octave_idx_type i_half = (i_max + i_min)>>1;
-
-		double t_half = time_array.xelem(i_half);
-
-		if (time < t_half)
-		{
-			i_max = i_half;
-			t_max = t_half;
-		}
-		else
-		{
-			i_min = i_half;
-			t_min = t_half;
-		}
-	}
-
-	return search_return(t_min, t_max, i_min);
-}
 
+#include "aria_beamforming.h"
 
+#undef DEBUG
 
 DEFUN_DLD(signal_fdmas, args, , "-*- texinfo -*-\n\
 @deftypefn {} {@var{map_out} =} signal_fdmas (@var{signals}, @var{time},  @var{delay_map}, @var{phase_fact})\n\
+@deftypefnx {} {@var{map_out} =} signal_fdmas (@var{signals}, @var{time},  @var{delay_map}, @var{phase_fact}, @var{n_threads})\n\
 Return the F-DMAS radar map.\n\
 @var{signals} is the I/Q downsampled data. It must be in (time x n_tx x n_rx) format\n\
 @var{time} is the time support for signals \n\
 @var{delay_map} is delay map that must be in (x * y * z) or (x , y , z , [n_tx * n_rx]) \n\
 @var{phase_fact} is the phase factor \n\
+@var{delay_map} and @var{phase_fact} can also be the separable one-way tables of \n\
+build_delay_map (@dots{}, \"oneway\"), in (x , y , z , [n_tx + n_rx]) format.\n\
+\n\
+@deftypefnx {} {@var{map_out} =} signal_fdmas (@var{signals}, @var{plan})\n\
+@deftypefnx {} {@var{map_out} =} signal_fdmas (@var{signals}, @var{plan}, @var{n_threads})\n\
+Use the precomputed @var{plan} returned by signal_bf_plan in place of the time support, \n\
+delay map and phase factor.\n\
+@var{signals} can also be a (time x n_tx x n_rx x frames) stack of frames sharing the same \n\
+time support and delay map (or plan): @var{map_out} is then the (x , y , z , frames) image stack. \n\
+Arguments are checked and converted once for the whole stack.\n\
+@var{n_threads} is the number of threads the voxel grid is split across (default: all cores). \n\
+The output does not depend on @var{n_threads}.\n\
+When @var{signals}, @var{delay_map} or @var{phase_fact} (or the tables of @var{plan}) are single, \n\
+the map is computed in single precision and @var{map_out} is single.\n\
+\n\
+@deftypefnx {} {@var{map_out} =} signal_fdmas (@dots{}, @var{pairs})\n\
+@var{pairs} selects the multiplied channel pairs: \"ring\" (default) uses the adjacent \n\
+channels (i, i+1 mod N), \"full\" sums the signed square root products of all the pairs \n\
+in O(N) operations per voxel through the ((sum s)^2 - sum s^2)/2 identity.\n\
+\n\
+@deftypefnx {} {@var{map_out} =} signal_fdmas (@dots{}, @var{weight})\n\
+@var{weight} multiplies every voxel by a coherence factor computed in the same pass \n\
+from running sums of the projected channel samples s: \"cf\" is the coherence factor \n\
+(sum s)^2 / (N sum s^2), \"scf\" the sign coherence factor 1 - sqrt(1 - (sum sign(s) / N)^2).\n\
+\n\
+@deftypefnx {} {@var{map_out} =} signal_fdmas (@dots{}, @var{interp})\n\
+@var{interp} selects the fractional-delay interpolator of the channel samples: \"linear\" (default), \n\
+\"lagrange\" (cubic, 4 taps) and \"sinc\" (Kaiser windowed, 8 taps) read polyphase tables with \n\
+256 fractional phases, \"farrow\" evaluates the cubic Lagrange kernel at the exact fraction. \n\
+The higher order kernels keep the accuracy of data sampled close to the Nyquist rate.\n\
+@seealso{signal_bf_plan}\n\
 @end deftypefn")
 {
-	if (args.length()!=4)
+	int  nargs = args.length();
+	bool bPlan = (nargs >= 2) && args(1).isstruct();
+	if ((!bPlan) && (nargs < 4))
 	{
 		print_usage();
 		return octave_value();
 	}
 
-	ComplexNDArray iq_signals = args(0).complex_array_value();
-	bool bSingleTxR = iq_signals.ndims()==2;
+	bf_options opts;
+	if (!bf_parse_options(args, bPlan ? 2 : 4, BF_FDMAS, false, opts))
+		return octave_value();
+
+	// BB data is converted to the kernel precision later on
+	dim_vector iq_dims = args(0).dims();
+	bool bSingleTxR = iq_dims.ndims()==2;
 	octave_idx_type time_samples;
 	int n_tx = 1;
 	int n_rx = 1;
 	if (!bSingleTxR)
 	{
-		n_tx = iq_signals.dim2();
-		n_rx = iq_signals.dim3();
-		time_samples = iq_signals.dim1();
+		n_tx = iq_dims(1);
+		n_rx = iq_dims(2);
+		time_samples = iq_dims(0);
 	}
 	else
-		time_samples = iq_signals.numel();
+		time_samples = iq_dims.numel();
+	if (iq_dims.ndims() > 4)
+	{
+		error("BB data must be in (time x n_tx x n_rx) or (time x n_tx x n_rx x frames) format");
+		return octave_value();
+	}
 #ifdef DEBUG
 	octave_stdout << "N Tx:" << n_tx << "\n";
 	octave_stdout << "N Rx:" << n_rx << "\n";
 	octave_stdout << "N Samples:" << time_samples << "\n";
 #endif
+	if (bPlan)
+	{
+		if (bf_plan_is_single(args(1)))
+			return bf_image_plan_value<float>(args(0), args(1), opts);
+		return bf_image_plan_value<double>(args(0), args(1), opts);
+	}
+
 	// Check Time
 	bool vector = (args(1).ndims()==2) && (args(1).dims().num_ones()>=1);
 	if ((!args(1).isreal())||(!vector))
@@ -122,6 +134,24 @@ Return the F-DMAS radar map.\n\
 		return octave_value();
 	}
 
+	// Separable one-way tables of build_delay_map (..., "oneway")
+	if (bf_is_oneway_map(args(2), n_tx, n_rx))
+	{
+		if ((!args(2).isreal())||(args(3).dims()!=args(2).dims()))
+		{
+			error("one-way delays must be real and the phasors of the same size");
+			return octave_value();
+		}
+		if (time_samples < 2)
+		{
+			error("time support must contain at least two samples");
+			return octave_value();
+		}
+		if (args(0).is_single_type()||args(2).is_single_type()||args(3).is_single_type())
+			return bf_image_oneway_maps<float>(args(0), time, args(2), args(3), n_tx, n_rx, opts);
+		return bf_image_oneway_maps<double>(args(0), time, args(2), args(3), n_tx, n_rx, opts);
+	}
+
 	// Map can be
 	// (x * y * z) or
 	// (x * y * z) * n_tx * n_rx
@@ -139,7 +169,8 @@ Return the F-DMAS radar map.\n\
 		return octave_value();
 	}
 
-	if (((args(2).ndims()==3)&&(!bSingleTxR))||
+	// A single tx/rx pair keeps a 3d map when its BB data is batched
+	if (((args(2).ndims()==3)&&(!bSingleTxR)&&(n_tx*n_rx!=1))||
 		((args(2).ndims()==5)&&(bSingleTxR)) ||
 		(((args(2).ndims()==5)&&((args(2).dims()(3)!=n_tx)||(args(2).dims()(4)!=n_rx)))))
 	{
@@ -163,115 +194,60 @@ Return the F-DMAS radar map.\n\
 
 	}
 
-	NDArray delay_map = args(2).array_value();
-
-	octave_idx_type nx = delay_map.dim1();
-	octave_idx_type ny = delay_map.dim2();
-	octave_idx_type nz = delay_map.dim3();
-
-	ComplexNDArray phase_fact = args(3).complex_array_value();
-
-	NDArray out(dim_vector({nx,ny,nz}));
-
-	if (bSingleTxR)
+	if (time_samples < 2)
 	{
-		ComplexNDArray delay_fact;
-		std::list<octave_value> in({args(1), args(0), args(2)});
-		delay_fact = octave::feval("interp1",in)(0).complex_array_value();
-		for (int x=0; x < nx; x++)
-		{
-			Array<octave_idx_type> index(dim_vector({1,3}));
-			index(0)=x;
-			for (int y=0; y < ny; y++)
-			{
-				index(1)=y;
-				for (int z=0; z < nz; z++)
-				{
-					index(2)=z;
-					Complex cin = delay_fact.xelem(index);
-					Complex phase=phase_fact.xelem(index);
-					out(x,y,z) = cin.real() * phase.real() + cin.imag() * phase.imag();
-				}
-			}
-		}
-
-		return octave_value(out);
+		error("time support must contain at least two samples");
+		return octave_value();
 	}
 
-	int time_index_max = time_samples-1;
-	for (int x=0; x < nx; x++)
-	{
-		Array<octave_idx_type> index(dim_vector({1,bSingleTxR? 3: 5}));
-		index(0)=x;
-		for (int y=0; y < ny; y++)
-		{
-			index(1)=y;
-			for (int z=0; z < nz; z++)
-			{
-				index(2)=z;
-				double out_sample = 0.0;
-				// Store the delayed samples into a convenient array
-
-				NDArray temp_storage(dim_vector{1,n_tx*n_rx});
-				temp_storage.fill(0);
-				octave_idx_type id =0;
-
-				for (int t=0; t < n_tx; t++)
-				{
-					index(3)=t;
-					for (int r=0; r < n_rx; r++)
-					{
-						index(4)=r;
-						double delay = delay_map.xelem(index);
-						search_return sr = binary_search_time(time, delay);
-						octave_idx_type index_delay = sr._itmin;
-						Complex phase=phase_fact.xelem(index);
-						Complex cin;
-						if (index_delay==-1)
-						{
-							cin = iq_signals.xelem(0,t,r);
-						}
-						else
-						{
-							if (index_delay >= time_index_max )
-							{
-								cin = iq_signals(time_index_max,t,r);
-							}
-							else
-							{
-								Complex c0 = iq_signals.xelem(index_delay,t,r);
-								Complex c1 = iq_signals.xelem(index_delay+1,t,r);
-								double  t0 = sr._tmin;
-								double  t1 = sr._tmax;
-								cin = c0 + (c1-c0)*(delay-t0)/(t1-t0);
-
-							}
-						}
-
-						temp_storage(id++) = cin.real() * phase.real() + cin.imag() * phase.imag();
-					} // for rx
-				}	// for tx
-
-				// We have filled the delayed - interpolated samples
-
-				octave_idx_type n_samples = temp_storage.numel();
-				double			acc = 0.0;
-				for (octave_idx_type i=0; i < n_samples ; i++)
-				{
-					octave_idx_type j = i+1;
-					if (j == n_samples) j=0;
-					double sample0 = temp_storage.xelem(i);
-					double sample1 = temp_storage.xelem(j);
-					double prod = sample0*sample1;
-					double ksign= prod > 0 ? 1.0 : -1.0;
-					prod = sqrt(fabs(prod))*ksign;
-					acc+=prod;
-				}
+	// A single tx/rx pair runs the same kernels as a (time x 1 x 1) stack
+	octave_value signals = args(0);
+	if (bSingleTxR)
+		signals = signals.reshape(dim_vector({time_samples, 1}));
 
-				out.xelem(x,y,z) = acc;
-			}
-		}
-	}
+	// Single precision path when any of the inputs is single
+	if (args(0).is_single_type()||args(2).is_single_type()||args(3).is_single_type())
+		return bf_image_maps<float>(signals, time, args(2), args(3), opts);
 
-	return octave_value(out);
+	return bf_image_maps<double>(signals, time, args(2), args(3), opts);
 }
+
+/*
+%!shared time, iq, dm, pf, sh
+%! nt = 128; n_tx = 2; n_rx = 3;
+%! time = (0:nt-1)'/1.792e9;
+%! iq = complex (randn (nt, n_tx, n_rx), randn (nt, n_tx, n_rx));
+%! dm = (10 + 100*rand (20, 15, 4, n_tx, n_rx))/1.792e9;
+%! pf = exp (2i*pi*rand (size (dm)));
+%! ## Signed square roots of the projected channel samples, one column per tx/rx pair
+%! sh = zeros (1200, n_tx*n_rx);
+%! for c = 1:n_tx*n_rx
+%!   d = dm(:,:,:,c);
+%!   p = pf(:,:,:,c);
+%!   s = real (interp1 (time, iq(:,c), d(:)) .* conj (p(:)));
+%!   sh(:,c) = sign (s) .* sqrt (abs (s));
+%! endfor
+
+%!test
+%! ## Ring of adjacent pairs
+%! ref = sum (sh .* sh(:, [2:end 1]), 2);
+%! assert (signal_fdmas (iq, time, dm, pf), reshape (ref, 20, 15, 4), 1e-10);
+
+%!test
+%! ## O(N) "full" mode against the brute-force sum over all the pairs i < j
+%! ref = zeros (rows (sh), 1);
+%! for i = 1:columns (sh)
+%!   for j = i+1:columns (sh)
+%!     ref += sh(:,i) .* sh(:,j);
+%!   endfor
+%! endfor
+%! assert (signal_fdmas (iq, time, dm, pf, "full"), reshape (ref, 20, 15, 4), 1e-10);
+%! assert (signal_fdmas (iq, time, dm, pf, "full", 3), signal_fdmas (iq, time, dm, pf, "full", 1));
+
+%!test
+%! ## A single channel has no pairs and returns the DAS projection
+%! map = signal_fdmas (iq(:,1), time, dm(:,:,:,1), pf(:,:,:,1), "full");
+%! assert (map, reshape (sh(:,1).*abs (sh(:,1)), 20, 15, 4), 1e-10);
+
+%!error <"ring" only applies to F-DMAS> signal_das (iq, time, dm, pf, "ring")
+*/
@@ -0,0 +1,575 @@
+/* Copyright (C) 2024 Alessio Cacciatori
+##
+## This program is free software: you can redistribute it and/or modify
+## it under the terms of the GNU General Public License as published by
+## the Free Software Foundation, either version 3 of the License, or
+## (at your option) any later version.
+##
+## This program is distributed in the hope that it will be useful,
+## but WITHOUT ANY WARRANTY; without even the implied warranty of
+## MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+## GNU General Public License for more details.
+##
+## You should have received a copy of the GNU General Public License
+## along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+## -*- texinfo -*-
+## @deftypefn {} {@var{map_out} =} signal_ffbp (@var{signals}, @var{time}, @var{x}, @var{y}, @var{z}, @var{frf}, @var{pos_tx}, @var{pos_rx})\n\
+## Return the DAS radar map with fast factorized back-projection.\n\
+## @seealso{signal_bf_image, signal_das, build_delay_map}
+## @end deftypefn
+
+## Author: Alessio Cacciatori <alessioc@alessio-laptop>
+## Created: 2024-11-15
+*/
+
+#include <octave/oct.h>
+#include <octave/ov-struct.h>
+#include <vector>
+#include <numeric>
+#include "aria_uwb_toolbox.h"
+#include "aria_beamforming.h"
+
+// Sub-image of a group of channels on a polar grid centered on the group phase center c:
+// range r from c and direction cosines (u, v) with respect to the z axis.
+// The values are demodulated by exp(j*2*pi*frf*delay_ref), with delay_ref the bistatic
+// delay from the mean tx (a) and rx (b) positions of the group, so that they are
+// smooth in range and angle and can be linearly interpolated on a coarse grid.
+struct ffbp_node
+{
+	std::vector<int>	 channels;
+	int					 child[2];
+	double				 a[3], b[3], c[3];
+	double				 aperture;
+	double				 r0, dr, u0, du, v0, dv;
+	octave_idx_type		 nr, nu, nv;
+	std::vector<Complex> data;
+};
+
+struct ffbp_problem
+{
+	const Complex*	iq;
+	NDArray			time;
+	bool			uniform;
+	double			t0, inv_ts;
+	double			freq;
+	NDArray			pos_tx, pos_rx;
+	double			box_min[3], box_max[3];
+	double			dr, lambda_min, accuracy;
+	int				n_threads;
+};
+
+inline double sqr(double x) {return x*x;}
+
+static inline double ffbp_delay_ref(const ffbp_node& node, const double* p)
+{
+	return (sqrt(sqr(p[0]-node.a[0]) + sqr(p[1]-node.a[1]) + sqr(p[2]-node.a[2])) +
+			sqrt(sqr(p[0]-node.b[0]) + sqr(p[1]-node.b[1]) + sqr(p[2]-node.b[2])))/C0;
+}
+
+static inline double clamp(double x, double lo, double hi)
+{
+	return x < lo ? lo : (x > hi ? hi : x);
+}
+
+// Range and direction cosine bounds of the output box seen from c.
+// u is increasing in x and only depends on |y-cy| and z-cz (z > cz), so the
+// extremes lie on {xmin, xmax} x {ymin, ymax, clamp(cy)} x {zmin, zmax}.
+static void ffbp_bounds(const ffbp_problem& pb, const double* c, double* lo, double* hi)
+{
+	const double* bmin = pb.box_min;
+	const double* bmax = pb.box_max;
+	double xs[3] = {bmin[0], bmax[0], clamp(c[0], bmin[0], bmax[0])};
+	double ys[3] = {bmin[1], bmax[1], clamp(c[1], bmin[1], bmax[1])};
+	double zs[2] = {bmin[2], bmax[2]};
+	for (int k=0; k < 3; k++)
+	{
+		lo[k] = 1e300;
+		hi[k] = -1e300;
+	}
+	for (int i=0; i < 3; i++)
+		for (int j=0; j < 3; j++)
+			for (int l=0; l < 2; l++)
+			{
+				double dx = xs[i]-c[0], dy = ys[j]-c[1], dz = zs[l]-c[2];
+				double r  = sqrt(dx*dx + dy*dy + dz*dz);
+				double v[3] = {r, dx/r, dy/r};
+				for (int k=0; k < 3; k++)
+				{
+					lo[k] = std::min(lo[k], v[k]);
+					hi[k] = std::max(hi[k], v[k]);
+				}
+			}
+}
+
+// Axis sampling: at least two samples unless the span is null,
+// plus one guard sample on both sides for the cubic interpolation
+static void ffbp_axis(double lo, double hi, double step, double& a0, double& da, octave_idx_type& n)
+{
+	double span = hi-lo;
+	if (span <= 0)
+	{
+		n  = 1;
+		da = 1.0;
+		a0 = lo;
+		return;
+	}
+	n  = std::max<octave_idx_type>(2, (octave_idx_type)ceil(span/step) + 1);
+	da = span/(n-1);
+	a0 = lo-da;
+	n += 2;
+}
+
+static void ffbp_grid(const ffbp_problem& pb, ffbp_node& node)
+{
+	double lo[3], hi[3];
+	ffbp_bounds(pb, node.c, lo, hi);
+	// Angular step: Nyquist step of the carrier phase over the group aperture and
+	// envelope step of the delay, which also varies with the tx-rx baseline
+	double baseline = sqrt(sqr(node.a[0]-node.b[0]) + sqr(node.a[1]-node.b[1]) + sqr(node.a[2]-node.b[2]));
+	double dang		= 1.0;
+	if (node.aperture > 0)
+		dang = pb.lambda_min/(2.0*node.aperture*pb.accuracy);
+	if (node.aperture + baseline > 0)
+		dang = std::min(dang, pb.dr*2.0/(node.aperture + baseline));
+	ffbp_axis(lo[0], hi[0], pb.dr, node.r0, node.dr, node.nr);
+	ffbp_axis(lo[1], hi[1], dang, node.u0, node.du, node.nu);
+	ffbp_axis(lo[2], hi[2], dang, node.v0, node.dv, node.nv);
+	node.data.assign(node.nr*node.nu*node.nv, Complex(0));
+}
+
+// Keys cubic kernel (a = -0.5): weights of the samples i-1..i+2 at i+t
+static inline void ffbp_cubic(double t, double* w)
+{
+	double t2 = t*t, t3 = t2*t;
+	w[0] = -0.5*t3 + t2 - 0.5*t;
+	w[1] =	1.5*t3 - 2.5*t2 + 1.0;
+	w[2] = -1.5*t3 + 2.0*t2 + 0.5*t;
+	w[3] =	0.5*t3 - 0.5*t2;
+}
+
+// Axis taps: clamped indexes and cubic weights, false outside of the grid
+static inline bool ffbp_taps(double f, octave_idx_type n, octave_idx_type* idx, double* w)
+{
+	const double eps = 1e-9;
+	if ((f < -eps)||(f > n-1+eps))
+		return false;
+	if (n==1)
+	{
+		idx[0] = idx[1] = idx[2] = idx[3] = 0;
+		w[0] = w[2] = w[3] = 0;
+		w[1] = 1;
+		return true;
+	}
+	octave_idx_type i = std::min<octave_idx_type>((octave_idx_type)std::max(f, 0.0), n-2);
+	ffbp_cubic(clamp(f-i, 0, 1), w);
+	for (int k=0; k < 4; k++)
+		idx[k] = std::min<octave_idx_type>(std::max<octave_idx_type>(i-1+k, 0), n-1);
+	return true;
+}
+
+// Tricubic interpolation of a node sub-image, zero outside of the grid
+static Complex ffbp_sample(const ffbp_node& node, double r, double u, double v)
+{
+	octave_idx_type ir[4], iu[4], iv[4];
+	double			wr[4], wu[4], wv[4];
+	if ((!ffbp_taps((r-node.r0)/node.dr, node.nr, ir, wr))||
+		(!ffbp_taps((u-node.u0)/node.du, node.nu, iu, wu))||
+		(!ffbp_taps((v-node.v0)/node.dv, node.nv, iv, wv)))
+		return Complex(0);
+	const Complex* data = node.data.data();
+	Complex acc = 0;
+	for (int c=0; c < 4; c++)
+	{
+		if (wv[c]==0)
+			continue;
+		Complex acc_v = 0;
+		for (int b=0; b < 4; b++)
+		{
+			if (wu[b]==0)
+				continue;
+			const Complex* line = data + node.nr*(iu[b] + node.nu*iv[c]);
+			Complex acc_u = line[ir[0]]*wr[0] + line[ir[1]]*wr[1] + line[ir[2]]*wr[2] + line[ir[3]]*wr[3];
+			acc_v += acc_u*wu[b];
+		}
+		acc += acc_v*wv[c];
+	}
+	return acc;
+}
+
+// Cartesian point of a node grid sample. Directions outside of the unit disc (guard
+// samples of coarse angular grids) are continued with the nearest physical direction
+// at the same range: left at zero, they would be read through the negative lobes of
+// the cubic kernel and bias the image.
+static inline void ffbp_point(const ffbp_node& node, octave_idx_type i, double* p, double& r)
+{
+	octave_idx_type ir = i % node.nr;
+	octave_idx_type iu = (i / node.nr) % node.nu;
+	octave_idx_type iv = i / (node.nr*node.nu);
+	r = node.r0 + ir*node.dr;
+	double u = node.u0 + iu*node.du;
+	double v = node.v0 + iv*node.dv;
+	double w2= 1.0 - u*u - v*v;
+	if (w2 < 0)
+	{
+		double s = 1.0/sqrt(u*u + v*v);
+		u *= s;
+		v *= s;
+		w2 = 0;
+	}
+	p[0] = node.c[0] + r*u;
+	p[1] = node.c[1] + r*v;
+	p[2] = node.c[2] + r*sqrt(w2);
+}
+
+// Leaf: exact back-projection of the group channels, build_delay_map convention:
+// delay*Re(cin*exp(-j*2*pi*frf*delay)) is the real part of delay*cin*exp(-j*2*pi*frf*delay)
+static void ffbp_leaf(const ffbp_problem& pb, ffbp_node& node)
+{
+	octave_idx_type n_samples = pb.time.numel();
+	octave_idx_type n_tx	  = pb.pos_tx.dim1();
+	double			k		  = 2.0*M_PI*pb.freq;
+	bf_parallel_for(node.data.size(), 256, pb.n_threads, [&](octave_idx_type begin, octave_idx_type end)
+	{
+		for (octave_idx_type i=begin; i < end; i++)
+		{
+			double p[3], r;
+			ffbp_point(node, i, p, r);
+			Complex acc = 0;
+			for (int c : node.channels)
+			{
+				octave_idx_type t = c % n_tx;
+				octave_idx_type q = c / n_tx;
+				double dt = sqrt(sqr(p[0]-pb.pos_tx(t,0)) + sqr(p[1]-pb.pos_tx(t,1)) + sqr(p[2]-pb.pos_tx(t,2)));
+				double dr = sqrt(sqr(p[0]-pb.pos_rx(q,0)) + sqr(p[1]-pb.pos_rx(q,1)) + sqr(p[2]-pb.pos_rx(q,2)));
+				double delay = (dt+dr)/C0;
+				octave_idx_type i0;
+				double			w;
+				if (pb.uniform)
+					bf_sample_position_uniform(pb.t0, pb.inv_ts, n_samples, delay, i0, w);
+				else
+					bf_sample_position(pb.time, delay, i0, w);
+				const Complex* iq_ch = pb.iq + c*n_samples;
+				Complex cin = iq_ch[i0] + (iq_ch[i0+1]-iq_ch[i0])*w;
+				acc += delay*cin*std::polar(1.0, -k*delay);
+			}
+			node.data[i] = acc*std::polar(1.0, k*ffbp_delay_ref(node, p));
+		}
+	});
+}
+
+// Parent: interpolation of the children sub-images on the parent grid
+static void ffbp_merge(const ffbp_problem& pb, ffbp_node& node, const ffbp_node& a, const ffbp_node& b)
+{
+	double k = 2.0*M_PI*pb.freq;
+	bf_parallel_for(node.data.size(), 256, pb.n_threads, [&](octave_idx_type begin, octave_idx_type end)
+	{
+		for (octave_idx_type i=begin; i < end; i++)
+		{
+			double p[3], r;
+			ffbp_point(node, i, p, r);
+			double delay = ffbp_delay_ref(node, p);
+			Complex acc = 0;
+			for (const ffbp_node* ch : {&a, &b})
+			{
+				double dx = p[0]-ch->c[0], dy = p[1]-ch->c[1], dz = p[2]-ch->c[2];
+				double rc = sqrt(dx*dx + dy*dy + dz*dz);
+				acc += ffbp_sample(*ch, rc, dx/rc, dy/rc)*std::polar(1.0, -k*(ffbp_delay_ref(*ch, p)-delay));
+			}
+			node.data[i] = acc;
+		}
+	});
+}
+
+static void ffbp_setup_node(const ffbp_problem& pb, ffbp_node& node)
+{
+	octave_idx_type n_tx = pb.pos_tx.dim1();
+	for (int k=0; k < 3; k++)
+	{
+		node.a[k] = node.b[k] = 0;
+		for (int c : node.channels)
+		{
+			node.a[k] += pb.pos_tx(c % n_tx, k)/node.channels.size();
+			node.b[k] += pb.pos_rx(c / n_tx, k)/node.channels.size();
+		}
+		node.c[k] = 0.5*(node.a[k] + node.b[k]);
+	}
+	// Aperture: largest tx plus rx displacement from the reference antennas,
+	// it bounds the angular bandwidth of the demodulated sub-image
+	node.aperture = 0;
+	for (int c : node.channels)
+	{
+		double dt = sqrt(sqr(pb.pos_tx(c % n_tx,0)-node.a[0]) + sqr(pb.pos_tx(c % n_tx,1)-node.a[1]) + sqr(pb.pos_tx(c % n_tx,2)-node.a[2]));
+		double dr = sqrt(sqr(pb.pos_rx(c / n_tx,0)-node.b[0]) + sqr(pb.pos_rx(c / n_tx,1)-node.b[1]) + sqr(pb.pos_rx(c / n_tx,2)-node.b[2]));
+		node.aperture = std::max(node.aperture, dt+dr);
+	}
+}
+
+// Recursive construction: groups are split at the median of the widest tx or rx coordinate
+static int ffbp_build(const ffbp_problem& pb, std::vector<ffbp_node>& nodes, std::vector<int> channels)
+{
+	octave_idx_type n_tx = pb.pos_tx.dim1();
+	int id = nodes.size();
+	nodes.push_back(ffbp_node());
+	nodes[id].channels = channels;
+	nodes[id].child[0] = nodes[id].child[1] = -1;
+	ffbp_setup_node(pb, nodes[id]);
+	if (channels.size() > 1)
+	{
+		auto center = [&](int c, int k) { return k < 3 ? pb.pos_tx(c % n_tx, k) : pb.pos_rx(c / n_tx, k-3); };
+		int	   axis = 0;
+		double best = -1;
+		for (int k=0; k < 6; k++)
+		{
+			auto mm = std::minmax_element(channels.begin(), channels.end(), [&](int a, int b) { return center(a,k) < center(b,k); });
+			double extent = center(*mm.second,k) - center(*mm.first,k);
+			if (extent > best)
+			{
+				best = extent;
+				axis = k;
+			}
+		}
+		std::sort(channels.begin(), channels.end(), [&](int a, int b) { return center(a,axis) < center(b,axis); });
+		size_t half = channels.size()/2;
+		int a = ffbp_build(pb, nodes, std::vector<int>(channels.begin(), channels.begin()+half));
+		int b = ffbp_build(pb, nodes, std::vector<int>(channels.begin()+half, channels.end()));
+		nodes[id].child[0] = a;
+		nodes[id].child[1] = b;
+	}
+	return id;
+}
+
+// Children first; their sub-images are released once merged
+static void ffbp_process(const ffbp_problem& pb, std::vector<ffbp_node>& nodes, int id)
+{
+	ffbp_node& node = nodes[id];
+	ffbp_grid(pb, node);
+	if (node.child[0] < 0)
+	{
+		ffbp_leaf(pb, node);
+		return;
+	}
+	ffbp_process(pb, nodes, node.child[0]);
+	ffbp_process(pb, nodes, node.child[1]);
+	ffbp_merge(pb, nodes[id], nodes[node.child[0]], nodes[node.child[1]]);
+	std::vector<Complex>().swap(nodes[node.child[0]].data);
+	std::vector<Complex>().swap(nodes[node.child[1]].data);
+}
+
+// Full array image resampled on the (x, y, z) grid
+static void ffbp_image(const ffbp_problem& pb, const NDArray* axes, NDArray& out)
+{
+	octave_idx_type n_ch = pb.pos_tx.dim1()*pb.pos_rx.dim1();
+	std::vector<ffbp_node> nodes;
+	std::vector<int> channels(n_ch);
+	std::iota(channels.begin(), channels.end(), 0);
+	int root = ffbp_build(pb, nodes, channels);
+	ffbp_process(pb, nodes, root);
+
+	// Resampling of the full array sub-image on the output grid
+	octave_idx_type nx = axes[0].numel();
+	octave_idx_type ny = axes[1].numel();
+	octave_idx_type nz = axes[2].numel();
+	double* pout = out.fortran_vec();
+	const ffbp_node& top = nodes[root];
+	double k = 2.0*M_PI*pb.freq;
+	bf_parallel_for(nx*ny*nz, 256, pb.n_threads, [&](octave_idx_type begin, octave_idx_type end)
+	{
+		for (octave_idx_type v=begin; v < end; v++)
+		{
+			double p[3] = {axes[0].xelem(v % nx), axes[1].xelem((v / nx) % ny), axes[2].xelem(v / (nx*ny))};
+			double dx = p[0]-top.c[0], dy = p[1]-top.c[1], dz = p[2]-top.c[2];
+			double r  = sqrt(dx*dx + dy*dy + dz*dz);
+			pout[v] = (ffbp_sample(top, r, dx/r, dy/r)*std::polar(1.0, -k*ffbp_delay_ref(top, p))).real();
+		}
+	});
+}
+
+DEFUN_DLD(signal_ffbp, args, , "-*- texinfo -*-\n\
+@deftypefn {} {@var{map_out} =} signal_ffbp (@var{signals}, @var{time}, @var{x}, @var{y}, @var{z}, @var{frf}, @var{pos_tx}, @var{pos_rx})\n\
+@deftypefnx {} {@var{map_out} =} signal_ffbp (@dots{}, @var{accuracy})\n\
+@deftypefnx {} {@var{map_out} =} signal_ffbp (@dots{}, @var{accuracy}, @var{n_threads})\n\
+Return the DAS radar map with fast factorized back-projection.\n\
+The tx/rx pairs are split recursively into groups of neighbouring tx and rx antennas. Every group \n\
+forms a coarse sub-image on a polar (range, direction cosines) grid centered on its phase center, \n\
+whose angular sampling follows the group aperture; sub-images are merged pairwise up to the full \n\
+array and the final sub-image is resampled on the (@var{x}, @var{y}, @var{z}) grid.\n\
+Delays and phase factors follow build_delay_map, so @var{map_out} approximates \n\
+signal_das (@var{signals}, @var{time}, build_delay_map (@var{x}, @var{y}, @var{z}, @var{frf}, @var{pos_tx}, @var{pos_rx})).\n\
+The scene must lie beyond the antennas along z.\n\
+@var{signals} is the I/Q downsampled data. It must be in (time x n_tx x n_rx) format\n\
+@var{time} is the time support for signals \n\
+@var{x},@var{y},@var{z} are the coordinates  \n\
+@var{frf} is the RF frequency \n\
+@var{pos_tx} is a n x 3 matrix where n is the number of transmitter antennas \n\
+@var{pos_rx} is a n x 3 matrix where n is the number of receiver    antennas \n\
+@var{accuracy} is the oversampling factor of the sub-image grids with respect to the \n\
+range and angular Nyquist steps (default 4): larger values are more accurate and slower.\n\
+The sub-images are interpolated with a cubic kernel; with the default accuracy the map is \n\
+typically within a few percent (rms) of the exact DAS.\n\
+@var{n_threads} is the number of threads (default: all cores).\n\
+@seealso{signal_bf_image, signal_das, build_delay_map}\n\
+@end deftypefn")
+{
+	if ((args.length() < 8)||(args.length() > 10))
+	{
+		print_usage();
+		return octave_value();
+	}
+
+	ffbp_problem pb;
+	pb.accuracy  = 4.0;
+	pb.n_threads = bf_default_threads();
+	if ((args.length() >= 9)&&(!args(8).isempty()))
+	{
+		if ((!args(8).is_real_scalar())||(args(8).double_value() <= 0))
+		{
+			error("accuracy must be a positive value");
+			return octave_value();
+		}
+		pb.accuracy = args(8).double_value();
+	}
+	if ((args.length()==10)&&(!bf_threads_from_value(args(9), pb.n_threads)))
+		return octave_value();
+
+	// Check time
+	bool vector = (args(1).ndims()==2) && (args(1).dims().num_ones()>=1);
+	if ((!args(1).isreal())||(!vector))
+	{
+		error("time must be a real vector");
+		return octave_value();
+	}
+	pb.time = args(1).array_value();
+	octave_idx_type time_samples = pb.time.numel();
+	if (time_samples < 2)
+	{
+		error("time support must contain at least two samples");
+		return octave_value();
+	}
+	double ts;
+	pb.uniform = bf_uniform_time(pb.time, pb.t0, ts);
+	pb.inv_ts  = pb.uniform ? 1.0/ts : 0.0;
+	if (!pb.uniform)
+		ts = (pb.time(time_samples-1)-pb.time(0))/(time_samples-1);
+
+	// Check x, y, z
+	NDArray axes[3];
+	const char* names[] = {"x", "y", "z"};
+	for (int i=0; i < 3; i++)
+	{
+		vector = (args(2+i).ndims()==2) && (args(2+i).dims().num_ones()>=1);
+		if ((!vector)||(!args(2+i).isreal())||(args(2+i).isempty()))
+		{
+			error("%s must be a real vector", names[i]);
+			return octave_value();
+		}
+		axes[i] = args(2+i).array_value();
+		pb.box_min[i] = axes[i].min()(0);
+		pb.box_max[i] = axes[i].max()(0);
+	}
+
+	// Check freq
+	bool number = (args(5).dims().num_ones()==args(5).ndims());
+	if ((!number)||(!args(5).isreal())||(args(5).array_value()(0)<=0))
+	{
+		error("freq must be a single positive value");
+		return octave_value();
+	}
+	pb.freq = args(5).array_value()(0);
+
+	// Check tx-pos
+	if ((args(6).dims()(1)!=3)||(!args(6).isreal()))
+	{
+		error("tx position must be a n by 3 real matrix");
+		return octave_value();
+	}
+	pb.pos_tx = args(6).array_value();
+
+	if ((args(7).dims()(1)!=3)||(!args(7).isreal()))
+	{
+		error("rx position must be a n by 3 real matrix");
+		return octave_value();
+	}
+	pb.pos_rx = args(7).array_value();
+	octave_idx_type n_tx = pb.pos_tx.dim1();
+	octave_idx_type n_rx = pb.pos_rx.dim1();
+
+	for (octave_idx_type a=0; a < n_tx; a++)
+		if (pb.pos_tx(a,2) >= pb.box_min[2])
+		{
+			error("the scene must lie beyond the antennas along z");
+			return octave_value();
+		}
+	for (octave_idx_type a=0; a < n_rx; a++)
+		if (pb.pos_rx(a,2) >= pb.box_min[2])
+		{
+			error("the scene must lie beyond the antennas along z");
+			return octave_value();
+		}
+
+	// Check BB data: (time x n_tx x n_rx)
+	ComplexNDArray iq_signals = args(0).complex_array_value();
+	dim_vector	   iq_dims	  = iq_signals.dims();
+	bool bVector = (n_tx*n_rx==1)&&(iq_dims.ndims()==2)&&(iq_dims.numel()==time_samples)&&(iq_dims.num_ones() >= 1);
+	if ((!bVector)&&((iq_dims.ndims() > 3)||(iq_dims(0)!=time_samples)||(iq_dims(1)!=n_tx)||
+					 ((iq_dims.ndims() > 2 ? iq_dims(2) : 1)!=n_rx)))
+	{
+		error("BB data dimension not consistent with time support and antenna positions");
+		return octave_value();
+	}
+	pb.iq = iq_signals.data();
+
+	// Range step from the sampling period, angular step from the highest frequency
+	pb.dr		  = C0*ts/(2.0*pb.accuracy);
+	pb.lambda_min = C0/(pb.freq + 0.5/ts);
+
+	NDArray out(dim_vector({axes[0].numel(), axes[1].numel(), axes[2].numel()}));
+	ffbp_image(pb, axes, out);
+
+	return octave_value(out);
+}
+
+/*
+%!shared x, y, z, frf, pos_tx, pos_rx, time, iq, ref
+%! x = -0.2 + (0:20)*0.02;
+%! y = x;
+%! z = 0.4 + (0:20)*0.03;
+%! frf = 7.29e9;
+%! pos_tx = [-0.1 + (0:7)'*0.02, -0.02*ones(8, 1), zeros(8, 1)];
+%! pos_rx = [-0.09 + (0:7)'*0.02, 0.02*ones(8, 1), zeros(8, 1)];
+%! time = (0:255)'/1.792e9;
+%! ## Two point targets, Gaussian pulses
+%! iq = complex (zeros (256, 8, 8));
+%! for target = [0.03 -0.02 0.6; -0.05 0.04 0.8]'
+%!   tau = (sqrt (sum ((pos_tx - target').^2, 2)) + sqrt (sum ((pos_rx - target').^2, 2))')/299792458;
+%!   tau = reshape (tau, [1 8 8]);
+%!   iq += exp (-((time - tau)*1e9).^2) .* exp (2i*pi*frf*tau);
+%! endfor
+%! [dm, pf] = build_delay_map (x, y, z, frf, pos_tx, pos_rx);
+%! ref = signal_das (iq, time, dm, pf);
+
+%!test
+%! map = signal_ffbp (iq, time, x, y, z, frf, pos_tx, pos_rx);
+%! assert (size (map), size (ref));
+%! assert (norm (map(:) - ref(:)) < 0.03*norm (ref(:)));
+
+%!test
+%! ## The error decreases with the accuracy factor
+%! err = zeros (1, 4);
+%! accuracy = [1 2 4 8];
+%! for k = 1:4
+%!   map = signal_ffbp (iq, time, x, y, z, frf, pos_tx, pos_rx, accuracy(k));
+%!   err(k) = norm (map(:) - ref(:))/norm (ref(:));
+%! endfor
+%! assert (all (diff (err) < 0));
+%! assert (err(4) < 0.01);
+
+%!test
+%! assert (signal_ffbp (iq, time, x, y, z, frf, pos_tx, pos_rx, [], 1),
+%!         signal_ffbp (iq, time, x, y, z, frf, pos_tx, pos_rx, [], 3));
+
+%!error <BB data dimension not consistent>
+%! signal_ffbp (permute (iq(:,1:2,:), [1 3 2]), time, x, y, z, frf, pos_tx(1:2,:), pos_rx);
+%!error <the scene must lie beyond the antennas along z>
+%! signal_ffbp (iq, time, x, y, z - 1, frf, pos_tx, pos_rx);
+*/
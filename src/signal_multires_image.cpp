@@ -0,0 +1,421 @@
+/* Copyright (C) 2024 Alessio Cacciatori
+##
+## This program is free software: you can redistribute it and/or modify
+## it under the terms of the GNU General Public License as published by
+## the Free Software Foundation, either version 3 of the License, or
+## (at your option) any later version.
+##
+## This program is distributed in the hope that it will be useful,
+## but WITHOUT ANY WARRANTY; without even the implied warranty of
+## MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+## GNU General Public License for more details.
+##
+## You should have received a copy of the GNU General Public License
+## along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+## -*- texinfo -*-
+## @deftypefn {} {[@var{index}, @var{fine}, @var{map_coarse}, @var{map_out}] =} signal_multires_image (@var{signals}, @var{time}, @var{x}, @var{y}, @var{z}, @var{frf}, @var{pos_tx}, @var{pos_rx}, @var{decimation}, @var{selection})\n\
+## Return the radar map refining a coarse image around its strongest cells.\n\
+## @seealso{signal_bf_image, signal_bf_points, signal_ffbp}
+## @end deftypefn
+
+## Author: Alessio Cacciatori <alessioc@alessio-laptop>
+## Created: 2024-11-15
+*/
+
+#include <octave/oct.h>
+#include <octave/ov-struct.h>
+#include <vector>
+#include <algorithm>
+#include "aria_uwb_toolbox.h"
+#include "aria_beamforming.h"
+
+// Coarse axis: every dec-th sample of the fine axis
+static NDArray decimate_axis(const NDArray& axis, octave_idx_type dec)
+{
+	octave_idx_type n = (axis.numel()+dec-1)/dec;
+	NDArray out(dim_vector({n, 1}));
+	for (octave_idx_type i=0; i < n; i++)
+		out(i) = axis(i*dec);
+	return out;
+}
+
+// Nearest coarse sample of a fine index
+static inline octave_idx_type coarse_index(octave_idx_type i, octave_idx_type dec, octave_idx_type n_coarse)
+{
+	return std::min((i + dec/2)/dec, n_coarse-1);
+}
+
+// Envelope of the coarse map, so that the selection does not follow the carrier
+// oscillation of the real map: the magnitude of the DAS image and of its quadrature,
+// the DAS image of -j*iq. F-DMAS and weighted maps are not linear in the BB data,
+// their cells are selected on the DAS envelope of the same coarse grid.
+template <typename T>
+static std::vector<T> coarse_envelope(const typename bf_traits<T>::complex_array& iq_signals, const NDArray& time,
+									  const bf_geometry& geom_c, const bf_options& opts,
+									  const typename bf_traits<T>::real_array& coarse)
+{
+	bf_options opts_das = opts;
+	opts_das.mode	= BF_DAS;
+	opts_das.weight = BF_WEIGHT_NONE;
+	typename bf_traits<T>::real_array in_phase = coarse;
+	if ((opts.mode!=BF_DAS)||(opts.weight!=BF_WEIGHT_NONE))
+		bf_image_geometry<T>(iq_signals, time, geom_c, opts_das, in_phase);
+
+	typename bf_traits<T>::complex_array iq_q(iq_signals.dims());
+	const std::complex<T>* pi = iq_signals.data();
+	std::complex<T>*	   pq = iq_q.fortran_vec();
+	for (octave_idx_type s=0; s < iq_signals.numel(); s++)
+		pq[s] = std::complex<T>(pi[s].imag(), -pi[s].real());
+	typename bf_traits<T>::real_array quad(coarse.dims());
+	bf_image_geometry<T>(iq_q, time, geom_c, opts_das, quad);
+
+	std::vector<T> env(coarse.numel());
+	const T* pc	   = in_phase.data();
+	const T* pquad = quad.data();
+	for (octave_idx_type c=0; c < coarse.numel(); c++)
+		env[c] = std::hypot(pc[c], pquad[c]);
+	return env;
+}
+
+// Local maxima of the envelope over the adjacent coarse cells, one per target
+// rather than a cluster of cells around the strongest one
+template <typename T>
+static bool coarse_peak(const std::vector<T>& env, const octave_idx_type* nc, octave_idx_type c)
+{
+	octave_idx_type i = c % nc[0], j = (c / nc[0]) % nc[1], k = c / (nc[0]*nc[1]);
+	for (octave_idx_type kk=std::max<octave_idx_type>(k-1, 0); kk <= std::min(k+1, nc[2]-1); kk++)
+		for (octave_idx_type jj=std::max<octave_idx_type>(j-1, 0); jj <= std::min(j+1, nc[1]-1); jj++)
+			for (octave_idx_type ii=std::max<octave_idx_type>(i-1, 0); ii <= std::min(i+1, nc[0]-1); ii++)
+				if (env[ii + nc[0]*(jj + nc[1]*kk)] > env[c])
+					return false;
+	return true;
+}
+
+// Coarse map and sparse fine image: the fine values of the voxels (map order)
+// in the neighborhood of the selected coarse cells
+template <typename T>
+static void multires_image(const typename bf_traits<T>::complex_array& iq_signals, const NDArray& time, const bf_geometry& geom,
+						   const octave_idx_type* dec, double selection, const bf_options& opts,
+						   std::vector<octave_idx_type>& voxels, typename bf_traits<T>::real_array& fine,
+						   typename bf_traits<T>::real_array& coarse)
+{
+	octave_idx_type n[3]  = {geom.x.numel(), geom.y.numel(), geom.z.numel()};
+	const NDArray*	ax[3] = {&geom.x, &geom.y, &geom.z};
+
+	// Coarse image
+	bf_geometry geom_c = geom;
+	geom_c.x = decimate_axis(geom.x, dec[0]);
+	geom_c.y = decimate_axis(geom.y, dec[1]);
+	geom_c.z = decimate_axis(geom.z, dec[2]);
+	octave_idx_type nc[3] = {geom_c.x.numel(), geom_c.y.numel(), geom_c.z.numel()};
+	coarse = typename bf_traits<T>::real_array(dim_vector({nc[0], nc[1], nc[2]}));
+	bf_image_geometry<T>(iq_signals, time, geom_c, opts, coarse);
+
+	// Selection on the envelope: top-K local maxima (selection >= 1) or cells above a fraction of the peak
+	octave_idx_type n_coarse = coarse.numel();
+	std::vector<T>	env		 = coarse_envelope<T>(iq_signals, time, geom_c, opts, coarse);
+	std::vector<octave_idx_type> cells;
+	if (selection >= 1)
+	{
+		for (octave_idx_type c=0; c < n_coarse; c++)
+			if (coarse_peak(env, nc, c))
+				cells.push_back(c);
+		octave_idx_type k = std::min((octave_idx_type)selection, (octave_idx_type)cells.size());
+		std::nth_element(cells.begin(), cells.begin()+(k-1), cells.end(),
+						 [&](octave_idx_type a, octave_idx_type b) { return env[a] > env[b]; });
+		cells.resize(k);
+	}
+	else
+	{
+		T peak = *std::max_element(env.begin(), env.end());
+		for (octave_idx_type c=0; c < n_coarse; c++)
+			if (env[c] >= selection*peak)
+				cells.push_back(c);
+	}
+
+	// Neighborhoods: fine voxels up to the adjacent coarse samples
+	std::vector<bool> mask(n[0]*n[1]*n[2], false);
+	for (octave_idx_type c : cells)
+	{
+		octave_idx_type ic[3] = {c % nc[0], (c / nc[0]) % nc[1], c / (nc[0]*nc[1])};
+		octave_idx_type lo[3], hi[3];
+		for (int k=0; k < 3; k++)
+		{
+			lo[k] = std::max<octave_idx_type>(ic[k]*dec[k] - dec[k], 0);
+			hi[k] = std::min<octave_idx_type>(ic[k]*dec[k] + dec[k], n[k]-1);
+		}
+		for (octave_idx_type k=lo[2]; k <= hi[2]; k++)
+			for (octave_idx_type j=lo[1]; j <= hi[1]; j++)
+				for (octave_idx_type i=lo[0]; i <= hi[0]; i++)
+					mask[i + n[0]*(j + n[1]*k)] = true;
+	}
+
+	// Fine evaluation of the refined voxels as a point list
+	voxels.clear();
+	for (octave_idx_type v=0; v < (octave_idx_type)mask.size(); v++)
+		if (mask[v])
+			voxels.push_back(v);
+	octave_idx_type n_pts = voxels.size();
+	NDArray points(dim_vector({n_pts, 3}));
+	for (octave_idx_type m=0; m < n_pts; m++)
+	{
+		octave_idx_type v = voxels[m];
+		points(m,0) = ax[0]->xelem(v % n[0]);
+		points(m,1) = ax[1]->xelem((v / n[0]) % n[1]);
+		points(m,2) = ax[2]->xelem(v / (n[0]*n[1]));
+	}
+	fine = typename bf_traits<T>::real_array(dim_vector({n_pts, 1}));
+	bf_image_points<T>(iq_signals, time, geom.freq, geom.pos_tx, geom.pos_rx, points, opts, fine);
+}
+
+// Dense map: nearest coarse sample as background, refined voxels at full resolution
+template <typename T>
+static typename bf_traits<T>::real_array multires_dense(const octave_idx_type* n, const octave_idx_type* dec,
+														 const std::vector<octave_idx_type>& voxels,
+														 const typename bf_traits<T>::real_array& fine,
+														 const typename bf_traits<T>::real_array& coarse)
+{
+	octave_idx_type nc[3] = {coarse.dim1(), coarse.dim2(), coarse.dim3()};
+	const T*		pc	  = coarse.data();
+	typename bf_traits<T>::real_array out(dim_vector({n[0], n[1], n[2]}));
+	T* pout = out.fortran_vec();
+	for (octave_idx_type k=0; k < n[2]; k++)
+		for (octave_idx_type j=0; j < n[1]; j++)
+			for (octave_idx_type i=0; i < n[0]; i++)
+				pout[i + n[0]*(j + n[1]*k)] = pc[coarse_index(i, dec[0], nc[0]) +
+												  nc[0]*(coarse_index(j, dec[1], nc[1]) + nc[1]*coarse_index(k, dec[2], nc[2]))];
+	for (octave_idx_type m=0; m < (octave_idx_type)voxels.size(); m++)
+		pout[voxels[m]] = fine(m);
+	return out;
+}
+
+// [index, fine, map_coarse, map_out] outputs
+template <typename T>
+static octave_value_list multires_outputs(const typename bf_traits<T>::complex_array& iq_signals, const NDArray& time,
+										  const bf_geometry& geom, const octave_idx_type* dec, double selection,
+										  const bf_options& opts, int nargout)
+{
+	std::vector<octave_idx_type>	  voxels;
+	typename bf_traits<T>::real_array fine, coarse;
+	multires_image<T>(iq_signals, time, geom, dec, selection, opts, voxels, fine, coarse);
+
+	octave_value_list out;
+	NDArray index(dim_vector({(octave_idx_type)voxels.size(), 1}));
+	for (octave_idx_type m=0; m < index.numel(); m++)
+		index(m) = voxels[m] + 1;
+	out(0) = index;
+	if (nargout >= 2)
+		out(1) = fine;
+	if (nargout >= 3)
+		out(2) = coarse;
+	if (nargout >= 4)
+	{
+		octave_idx_type n[3] = {geom.x.numel(), geom.y.numel(), geom.z.numel()};
+		out(3) = multires_dense<T>(n, dec, voxels, fine, coarse);
+	}
+	return out;
+}
+
+DEFUN_DLD(signal_multires_image, args, nargout, "-*- texinfo -*-\n\
+@deftypefn {} {[@var{index}, @var{fine}, @var{map_coarse}, @var{map_out}] =} signal_multires_image (@var{signals}, @var{time}, @var{x}, @var{y}, @var{z}, @var{frf}, @var{pos_tx}, @var{pos_rx}, @var{decimation}, @var{selection})\n\
+@deftypefnx {} {[@dots{}] =} signal_multires_image (@dots{}, @var{options})\n\
+Return the radar map refining a coarse image around its strongest cells.\n\
+A coarse map is computed on x(1:d:end), y(1:d:end), z(1:d:end); the fine grid is then \n\
+evaluated only in the neighborhood of the selected coarse cells (up to the adjacent coarse \n\
+samples). Cells are selected on the envelope of the coarse map, not on its real value that \n\
+oscillates at the carrier: the magnitude of the coarse DAS image and of its quadrature (the \n\
+image of -j * @var{signals}), also for F-DMAS and weighted maps.\n\
+Delays and phase factors are computed on the fly as in signal_bf_image.\n\
+@var{signals} is the I/Q downsampled data. It must be in (time x n_tx x n_rx) format\n\
+@var{time} is the time support for signals \n\
+@var{x},@var{y},@var{z} are the fine grid coordinates  \n\
+@var{frf} is the RF frequency \n\
+@var{pos_tx} is a n x 3 matrix where n is the number of transmitter antennas \n\
+@var{pos_rx} is a n x 3 matrix where n is the number of receiver    antennas \n\
+@var{decimation} is the coarse grid decimation, a positive integer or one per axis [dx dy dz]. \n\
+The coarse step should stay below the resolution cell, otherwise targets may fall between samples.\n\
+@var{selection} is the number of strongest local maxima of the coarse envelope to refine \n\
+when it is >= 1, or the threshold relative to the envelope peak when it is in (0, 1).\n\
+@var{options} are the optional arguments of signal_bf_image.\n\
+The fine image is sparse: @var{index} are the linear indices (one based, in map order) of \n\
+the voxels evaluated at full resolution and @var{fine} their values. @var{map_coarse} is the \n\
+coarse background. @var{map_out}, the dense fine map with the nearest coarse value outside \n\
+the refined voxels (map_out(index) = fine), is only assembled when requested.\n\
+@seealso{signal_bf_image, signal_bf_points, signal_ffbp}\n\
+@end deftypefn")
+{
+	if (args.length() < 10)
+	{
+		print_usage();
+		return octave_value();
+	}
+
+	bf_options opts;
+	if (!bf_parse_options(args, 10, BF_DAS, true, opts))
+		return octave_value();
+
+	// Check time
+	bool vector = (args(1).ndims()==2) && (args(1).dims().num_ones()>=1);
+	if ((!args(1).isreal())||(!vector))
+	{
+		error("time must be a real vector");
+		return octave_value();
+	}
+	NDArray time = args(1).array_value();
+	octave_idx_type time_samples = time.numel();
+	if (time_samples < 2)
+	{
+		error("time support must contain at least two samples");
+		return octave_value();
+	}
+
+	bf_geometry geom;
+	NDArray*	axes[3] = {&geom.x, &geom.y, &geom.z};
+	const char* names[] = {"x", "y", "z"};
+	for (int i=0; i < 3; i++)
+	{
+		vector = (args(2+i).ndims()==2) && (args(2+i).dims().num_ones()>=1);
+		if ((!vector)||(!args(2+i).isreal())||(args(2+i).isempty()))
+		{
+			error("%s must be a real vector", names[i]);
+			return octave_value();
+		}
+		*axes[i] = args(2+i).array_value();
+	}
+
+	// Check freq
+	bool number = (args(5).dims().num_ones()==args(5).ndims());
+	if ((!number)||(!args(5).isreal())||(args(5).array_value()(0)<=0))
+	{
+		error("freq must be a single positive value");
+		return octave_value();
+	}
+	geom.freq = args(5).array_value()(0);
+
+	// Check tx-pos
+	if ((args(6).dims()(1)!=3)||(!args(6).isreal()))
+	{
+		error("tx position must be a n by 3 real matrix");
+		return octave_value();
+	}
+	geom.pos_tx = args(6).array_value();
+
+	if ((args(7).dims()(1)!=3)||(!args(7).isreal()))
+	{
+		error("rx position must be a n by 3 real matrix");
+		return octave_value();
+	}
+	geom.pos_rx = args(7).array_value();
+
+	// Check decimation
+	NDArray dec_value = args(8).array_value();
+	if ((!args(8).isreal())||((dec_value.numel()!=1)&&(dec_value.numel()!=3)))
+	{
+		error("decimation must be a positive integer or a 3 elements vector");
+		return octave_value();
+	}
+	octave_idx_type dec[3];
+	for (int i=0; i < 3; i++)
+	{
+		double d = dec_value(dec_value.numel()==1 ? 0 : i);
+		if ((d < 1)||(d!=std::round(d)))
+		{
+			error("decimation must be a positive integer or a 3 elements vector");
+			return octave_value();
+		}
+		dec[i] = (octave_idx_type)d;
+	}
+
+	// Check selection
+	if ((!args(9).is_real_scalar())||(args(9).double_value() <= 0))
+	{
+		error("selection must be a positive value");
+		return octave_value();
+	}
+	double selection = args(9).double_value();
+	if ((selection >= 1)&&(selection!=std::round(selection)))
+	{
+		error("selection must be an integer count or a threshold in (0, 1)");
+		return octave_value();
+	}
+
+	// Check BB data: (time x n_tx x n_rx)
+	dim_vector iq_dims = args(0).dims();
+	octave_idx_type n_tx = geom.pos_tx.dim1();
+	octave_idx_type n_rx = geom.pos_rx.dim1();
+	bool bVector = (n_tx*n_rx==1)&&(iq_dims.ndims()==2)&&(iq_dims.numel()==time_samples)&&(iq_dims.num_ones() >= 1);
+	if ((!bVector)&&((iq_dims.ndims() > 3)||(iq_dims(0)!=time_samples)||(iq_dims(1)!=n_tx)||
+					 ((iq_dims.ndims() > 2 ? iq_dims(2) : 1)!=n_rx)))
+	{
+		error("BB data dimension not consistent with time support and antenna positions");
+		return octave_value();
+	}
+
+	if (args(0).is_single_type())
+		return multires_outputs<float>(args(0).float_complex_array_value(), time, geom, dec, selection, opts, nargout);
+	return multires_outputs<double>(args(0).complex_array_value(), time, geom, dec, selection, opts, nargout);
+}
+
+/*
+%!shared x, y, z, frf, pos_tx, pos_rx, time, iq, map, v1, v2
+%! x = -0.2 + (0:20)*0.02;
+%! y = x;
+%! z = 0.4 + (0:20)*0.03;
+%! frf = 7.29e9;
+%! pos_tx = [-0.07 + (0:7)'*0.02, -0.09*ones(8, 1), zeros(8, 1)];
+%! pos_rx = [-0.09*ones(8, 1), -0.07 + (0:7)'*0.02, zeros(8, 1)];
+%! time = (0:255)'/1.792e9;
+%! ## Two point targets on the fine grid, Gaussian pulses
+%! iq = complex (zeros (256, 8, 8));
+%! for target = [0.1 -0.1 0.52 1; -0.12 0.12 0.94 0.6]'
+%!   tau = (sqrt (sum ((pos_tx - target(1:3)').^2, 2)) + sqrt (sum ((pos_rx - target(1:3)').^2, 2))')/299792458;
+%!   tau = reshape (tau, [1 8 8]);
+%!   iq += target(4) * exp (-((time - tau)*1e9).^2) .* exp (2i*pi*frf*tau);
+%! endfor
+%! map = signal_bf_image (iq, time, x, y, z, frf, pos_tx, pos_rx);
+%! v1 = sub2ind (size (map), 16, 6, 5);
+%! v2 = sub2ind (size (map), 5, 17, 19);
+
+%!test
+%! ## Refined voxels are the full resolution image, the background the decimated one
+%! [index, fine, map_coarse, map_out] = signal_multires_image (iq, time, x, y, z, frf, pos_tx, pos_rx, 2, 2);
+%! assert (size (index), [numel(index) 1]);
+%! assert (all (diff (index) > 0) && index(1) >= 1 && index(end) <= numel (map));
+%! assert (fine, map(index), 1e-12*max (abs (map(:))));
+%! assert (map_coarse, signal_bf_image (iq, time, x(1:2:end), y(1:2:end), z(1:2:end), frf, pos_tx, pos_rx));
+%! assert (size (map_out), size (map));
+%! assert (map_out(index), fine);
+%! ## Outside the refined voxels: nearest coarse sample
+%! near = min (floor ((1:21)/2) + 1, 11);
+%! background = map_coarse(near, near, near);
+%! outside = true (size (map));
+%! outside(index) = false;
+%! assert (map_out(outside), background(outside));
+%! assert (signal_multires_image (iq, time, x, y, z, frf, pos_tx, pos_rx, 2, 2), index);
+
+%!test
+%! ## Top-K: the neighborhood of the strongest local maximum, then of both targets
+%! idx1 = signal_multires_image (iq, time, x, y, z, frf, pos_tx, pos_rx, 2, 1);
+%! idx2 = signal_multires_image (iq, time, x, y, z, frf, pos_tx, pos_rx, 2, 2);
+%! assert (numel (idx1), 125);
+%! assert (any (idx1 == v2) && ! any (idx1 == v1));
+%! assert (any (idx2 == v1) && any (idx2 == v2));
+%! assert (all (ismember (idx1, idx2)));
+
+%!test
+%! ## Threshold relative to the envelope peak
+%! idx_hi = signal_multires_image (iq, time, x, y, z, frf, pos_tx, pos_rx, 2, 0.9);
+%! idx_lo = signal_multires_image (iq, time, x, y, z, frf, pos_tx, pos_rx, 2, 0.5);
+%! assert (any (idx_hi == v1) && any (idx_hi == v2));
+%! assert (all (ismember (idx_hi, idx_lo)) && numel (idx_lo) > numel (idx_hi));
+%! [~, fine] = signal_multires_image (iq, time, x, y, z, frf, pos_tx, pos_rx, 2, 0.5);
+%! assert (fine, map(idx_lo), 1e-12*max (abs (map(:))));
+
+%!error <decimation must be a positive integer>
+%! signal_multires_image (iq, time, x, y, z, frf, pos_tx, pos_rx, 1.5, 1);
+%!error <selection must be an integer count or a threshold>
+%! signal_multires_image (iq, time, x, y, z, frf, pos_tx, pos_rx, 2, 1.5);
+%!error <BB data dimension not consistent>
+%! signal_multires_image (iq(:,:,1:4), time, x, y, z, frf, pos_tx, pos_rx, 2, 1);
+*/
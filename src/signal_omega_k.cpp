@@ -0,0 +1,385 @@
+/* Copyright (C) 2024 Alessio Cacciatori
+##
+## This program is free software: you can redistribute it and/or modify
+## it under the terms of the GNU General Public License as published by
+## the Free Software Foundation, either version 3 of the License, or
+## (at your option) any later version.
+##
+## This program is distributed in the hope that it will be useful,
+## but WITHOUT ANY WARRANTY; without even the implied warranty of
+## MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+## GNU General Public License for more details.
+##
+## You should have received a copy of the GNU General Public License
+## along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+## -*- texinfo -*-
+## @deftypefn {} {@var{map_out} =} signal_omega_k (@var{signals}, @var{time}, @var{frf}, @var{pos_tx}, @var{pos_rx}, @var{x}, @var{y}, @var{z})\n\
+## Return the range-migration (omega-k) radar map of a planar array.\n\
+## @seealso{signal_das, build_delay_map}
+## @end deftypefn
+
+## Author: Alessio Cacciatori <alessioc@alessio-laptop>
+## Created: 2024-11-15
+*/
+
+#include <octave/oct.h>
+#include <octave/ov-struct.h>
+#include "aria_uwb_toolbox.h"
+#include "aria_beamforming.h"
+
+inline double sqr(double x) {return x*x;}
+
+// Signed frequency index of FFT bin k over n points
+static inline octave_idx_type fft_signed(octave_idx_type k, octave_idx_type n)
+{
+	return k <= (n-1)/2 ? k : k-n;
+}
+
+// Uniform axis check: spacing (0 for a single point)
+static bool uniform_axis(const NDArray& axis, double& step)
+{
+	step = 0;
+	if (axis.numel() < 2)
+		return true;
+	double t0;
+	return bf_uniform_time(axis, t0, step) && (step > 0);
+}
+
+// Nearest cell of a uniform axis; clamped, as the rounding of step may push a value
+// lying on the last node one cell past it
+static inline octave_idx_type grid_cell(double v, double a0, double step, octave_idx_type n)
+{
+	if (n < 2)
+		return 0;
+	octave_idx_type i = (octave_idx_type)floor((v - a0)/step + 0.5);
+	return std::min(std::max(i, (octave_idx_type)0), n-1);
+}
+
+// Range migration of the (time x n_tx x n_rx) data on the (x, y, z) grid
+static ComplexNDArray omega_k_image(const ComplexNDArray& iq_signals, double t0, double ts, double freq,
+									const NDArray& pos_tx, const NDArray& pos_rx, const NDArray* axes, const double* step,
+									int n_threads)
+{
+	octave_idx_type nt	 = iq_signals.dim1();
+	octave_idx_type n_tx = pos_tx.dim1();
+	octave_idx_type n_rx = pos_rx.dim1();
+	octave_idx_type nx	 = axes[0].numel();
+	octave_idx_type ny	 = axes[1].numel();
+	octave_idx_type nz	 = axes[2].numel();
+	double			z0	 = pos_tx(0,2);
+
+	//---------------------------------------------------
+	// Range FFT. Bin q holds the baseband frequency q*df, which is the RF
+	// frequency freq - q*df in the build_delay_map convention: the conjugate
+	// spectrum behaves as exp(-j*2*pi*f*delay).
+	double df = 1.0/(nt*ts);
+	ComplexNDArray spectrum = iq_signals.reshape(dim_vector({nt, n_tx*n_rx})).fourier(0);
+
+	// Gridding of the phase centers, averaged when several fall in the same cell
+	double r_ref = 0.5*(axes[2](0) + axes[2](nz-1)) - z0;
+	ComplexNDArray grid(dim_vector({nx, ny, nt}), Complex(0));
+	Array<int>	   count(dim_vector({nx, ny}), 0);
+	for (octave_idx_type r=0; r < n_rx; r++)
+	{
+		for (octave_idx_type t=0; t < n_tx; t++)
+		{
+			double vx = 0.5*(pos_tx(t,0) + pos_rx(r,0));
+			double vy = 0.5*(pos_tx(t,1) + pos_rx(r,1));
+			octave_idx_type ix = grid_cell(vx, axes[0](0), step[0], nx);
+			octave_idx_type iy = grid_cell(vy, axes[1](0), step[1], ny);
+			// Tx + Rx path ~ twice the phase center range + |tx-rx|^2/(4R)
+			double bistatic = (sqr(pos_tx(t,0)-pos_rx(r,0)) + sqr(pos_tx(t,1)-pos_rx(r,1)))/(4.0*r_ref*C0);
+			octave_idx_type c = t + n_tx*r;
+			for (octave_idx_type k=0; k < nt; k++)
+			{
+				double fbb = fft_signed(k, nt)*df;
+				double f   = freq - fbb;
+				Complex s  = std::conj(spectrum.xelem(k + nt*c) * std::polar(1.0, -2.0*M_PI*fbb*t0));
+				grid.xelem(ix + nx*(iy + ny*k)) += s * std::polar(1.0, 2.0*M_PI*f*bistatic);
+			}
+			count.xelem(ix + nx*iy)++;
+		}
+	}
+	for (octave_idx_type i=0; i < nx*ny; i++)
+		if (count.xelem(i) > 1)
+			for (octave_idx_type k=0; k < nt; k++)
+				grid.xelem(i + nx*ny*k) /= (double)count.xelem(i);
+
+	// Spatial FFT of every frequency page
+	grid = grid.fourier2d();
+
+	//---------------------------------------------------
+	// Stolt mapping: for every (kx, ky) the frequency samples are interpolated
+	// on kz = kzc + m*dkz, with kzc = sqrt(4k^2 - kx^2 - ky^2) at the RF frequency,
+	// and the range profile is recovered with an inverse FFT along kz.
+	double dz  = step[2];
+	double dkz = 2.0*M_PI/(nz*dz);
+	double kc  = 2.0*M_PI*freq/C0;
+	double dkx = nx > 1 ? 2.0*M_PI/(nx*step[0]) : 0;
+	double dky = ny > 1 ? 2.0*M_PI/(ny*step[1]) : 0;
+	octave_idx_type q_min = -(nt/2);
+	octave_idx_type q_max = (nt-1)/2;
+	ComplexNDArray stolt(dim_vector({nx, ny, nz}), Complex(0));
+	Array<double>  kz_center(dim_vector({nx, ny}), 0.0);
+	const Complex* pg = grid.data();
+	Complex*	   ps = stolt.fortran_vec();
+	double*		   pc = kz_center.fortran_vec();
+
+	bf_parallel_for(nx*ny, 64, n_threads, [&](octave_idx_type begin, octave_idx_type end)
+	{
+		for (octave_idx_type i=begin; i < end; i++)
+		{
+			double kx	 = fft_signed(i % nx, nx)*dkx;
+			double ky	 = fft_signed(i / nx, ny)*dky;
+			double kperp2= kx*kx + ky*ky;
+			double kzc	 = 4.0*kc*kc - kperp2;
+			if (kzc <= 0)
+				continue;
+			kzc   = sqrt(kzc);
+			pc[i] = kzc;
+			for (octave_idx_type m=-(nz/2); m <= (nz-1)/2; m++)
+			{
+				double kz = kzc + m*dkz;
+				if (kz <= 0)
+					continue;
+				double k2 = sqrt(kz*kz + kperp2);		// 2k
+				double f  = k2*C0/(4.0*M_PI);
+				double q  = (freq - f)/df;
+				octave_idx_type q0 = (octave_idx_type)floor(q);
+				if ((q0 < q_min)||(q0+1 > q_max))
+					continue;
+				double	w  = q-q0;
+				Complex a0 = pg[i + nx*ny*((q0 + nt) % nt)];
+				Complex a1 = pg[i + nx*ny*((q0 + 1 + nt) % nt)];
+				// df/dkz Jacobian
+				double	jac= kz/k2;
+				// Phase of the first range sample relative to the array plane
+				ps[i + nx*ny*((m + nz) % nz)] = (a0 + (a1-a0)*w) * jac * std::polar(1.0, m*dkz*(axes[2](0) - z0));
+			}
+		}
+	});
+
+	// Range IFFT, range carrier, lateral IFFT
+	stolt = stolt.ifourier(2);
+	for (octave_idx_type n=0; n < nz; n++)
+		for (octave_idx_type i=0; i < nx*ny; i++)
+			if (pc[i] > 0)
+				stolt.xelem(i + nx*ny*n) *= std::polar(1.0, pc[i]*(axes[2](n) - z0));
+	stolt = stolt.ifourier2d();
+
+	// Back to the signal_das convention. The plane wave expansion of the spherical
+	// wave carries a pi/4 stationary phase term per lateral dimension.
+	int		n_lateral = (nx > 1) + (ny > 1);
+	Complex stationary = std::polar(1.0, -0.25*M_PI*n_lateral);
+	ComplexNDArray out(dim_vector({nx, ny, nz}));
+	for (octave_idx_type i=0; i < out.numel(); i++)
+		out.xelem(i) = std::conj(stolt.xelem(i))*stationary;
+	return out;
+}
+
+
+DEFUN_DLD(signal_omega_k, args, , "-*- texinfo -*-\n\
+@deftypefn {} {@var{map_out} =} signal_omega_k (@var{signals}, @var{time}, @var{frf}, @var{pos_tx}, @var{pos_rx}, @var{x}, @var{y}, @var{z})\n\
+@deftypefnx {} {@var{map_out} =} signal_omega_k (@dots{}, @var{n_threads})\n\
+Return the complex range-migration (omega-k) radar map of a planar MIMO array.\n\
+The antennas must lie on a plane z = z0. Every tx/rx pair is replaced by its phase center \n\
+(with a bistatic phase correction at the middle of @var{z}), the virtual array is gridded \n\
+on the (@var{x}, @var{y}) grid, then the map is obtained with a range FFT, a 2D spatial FFT, \n\
+the Stolt mapping onto a uniform kz grid and the inverse FFTs, in O(N log N).\n\
+@var{signals} is the I/Q downsampled data. It must be in (time x n_tx x n_rx) format\n\
+@var{time} is the time support for signals, it must be uniform \n\
+@var{frf} is the RF frequency \n\
+@var{pos_tx} is a n x 3 matrix where n is the number of transmitter antennas \n\
+@var{pos_rx} is a n x 3 matrix where n is the number of receiver    antennas \n\
+@var{x},@var{y} are the uniform lateral coordinates. They are also the aperture grid: \n\
+the spacing should not exceed a quarter wavelength and the extent should cover the scene \n\
+(the lateral axes are circular). @var{y} can be a single value for linear arrays.\n\
+@var{z} are the uniform range coordinates, z > z0 (the range axis is circular with period numel(z)*dz).\n\
+@var{n_threads} is the number of threads of the Stolt mapping (default: all cores).\n\
+The phase convention is the one of build_delay_map and signal_das: real(@var{map_out}) \n\
+matches the DAS map up to the delay amplitude weighting of the phase factor and a constant scale.\n\
+@seealso{signal_das, build_delay_map}\n\
+@end deftypefn")
+{
+	if ((args.length() < 8)||(args.length() > 9))
+	{
+		print_usage();
+		return octave_value();
+	}
+	int n_threads = bf_default_threads();
+	if ((args.length()==9)&&(!bf_threads_from_value(args(8), n_threads)))
+		return octave_value();
+
+	// Check time
+	bool vector = (args(1).ndims()==2) && (args(1).dims().num_ones()>=1);
+	if ((!args(1).isreal())||(!vector))
+	{
+		error("time must be a real vector");
+		return octave_value();
+	}
+	NDArray time = args(1).array_value();
+	double t0, ts;
+	if ((time.numel() < 2)||(!bf_uniform_time(time, t0, ts)))
+	{
+		error("time support must be uniform");
+		return octave_value();
+	}
+	octave_idx_type nt = time.numel();
+
+	// Check freq
+	bool number = (args(2).dims().num_ones()==args(2).ndims());
+	if ((!number)||(!args(2).isreal())||(args(2).array_value()(0)<=0))
+	{
+		error("freq must be a single positive value");
+		return octave_value();
+	}
+	double freq = args(2).array_value()(0);
+
+	// Check antennas
+	if ((args(3).dims()(1)!=3)||(!args(3).isreal()))
+	{
+		error("tx position must be a n by 3 real matrix");
+		return octave_value();
+	}
+	if ((args(4).dims()(1)!=3)||(!args(4).isreal()))
+	{
+		error("rx position must be a n by 3 real matrix");
+		return octave_value();
+	}
+	NDArray pos_tx = args(3).array_value();
+	NDArray pos_rx = args(4).array_value();
+	octave_idx_type n_tx = pos_tx.dim1();
+	octave_idx_type n_rx = pos_rx.dim1();
+
+	double z0 = pos_tx(0,2);
+	double tol= 1e-3*C0/freq;
+	for (octave_idx_type a=0; a < n_tx; a++)
+		if (fabs(pos_tx(a,2)-z0) > tol)
+		{
+			error("antennas must lie on a plane z = const");
+			return octave_value();
+		}
+	for (octave_idx_type a=0; a < n_rx; a++)
+		if (fabs(pos_rx(a,2)-z0) > tol)
+		{
+			error("antennas must lie on a plane z = const");
+			return octave_value();
+		}
+
+	// Check grid
+	NDArray axes[3];
+	double	step[3];
+	const char* names[] = {"x", "y", "z"};
+	for (int i=0; i < 3; i++)
+	{
+		vector = (args(5+i).ndims()==2) && (args(5+i).dims().num_ones()>=1);
+		if ((!vector)||(!args(5+i).isreal())||(args(5+i).isempty()))
+		{
+			error("%s must be a real vector", names[i]);
+			return octave_value();
+		}
+		axes[i] = args(5+i).array_value();
+		if (!uniform_axis(axes[i], step[i]))
+		{
+			error("%s must be uniform", names[i]);
+			return octave_value();
+		}
+	}
+	octave_idx_type nx = axes[0].numel();
+	octave_idx_type ny = axes[1].numel();
+	octave_idx_type nz = axes[2].numel();
+	if ((nz < 2)||(axes[2](0) <= z0))
+	{
+		error("z must contain at least two values beyond the array plane");
+		return octave_value();
+	}
+
+	// Check BB data: (time x n_tx x n_rx)
+	ComplexNDArray iq_signals = args(0).complex_array_value();
+	dim_vector	   iq_dims	  = iq_signals.dims();
+	if ((iq_signals.numel()!=nt*n_tx*n_rx)||(iq_dims(0)!=nt)||(iq_dims(1)!=n_tx)||
+		((iq_dims.ndims() > 2 ? iq_dims(2) : 1)!=n_rx))
+	{
+		error("BB data dimension not consistent with time support and antenna positions");
+		return octave_value();
+	}
+
+	// The phase centers must fall on the x/y grid
+	for (octave_idx_type r=0; r < n_rx; r++)
+	{
+		for (octave_idx_type t=0; t < n_tx; t++)
+		{
+			double vx = 0.5*(pos_tx(t,0) + pos_rx(r,0));
+			double vy = 0.5*(pos_tx(t,1) + pos_rx(r,1));
+			if (((nx > 1)&&((vx < axes[0](0) - 0.5*step[0])||(vx >= axes[0](nx-1) + 0.5*step[0])))||
+				((ny > 1)&&((vy < axes[1](0) - 0.5*step[1])||(vy >= axes[1](ny-1) + 0.5*step[1]))))
+			{
+				error("virtual array outside of the x/y grid");
+				return octave_value();
+			}
+		}
+	}
+
+	return octave_value(omega_k_image(iq_signals, t0, ts, freq, pos_tx, pos_rx, axes, step, n_threads));
+}
+
+/*
+%!function [ok, das_c] = omega_k_vs_das (pos_tx, pos_rx, x, y, z, target)
+%! ## Point target, Gaussian pulse of 1 GHz at 8 GHz, 4 GS/s
+%! frf = 8e9;
+%! time = 2e-9 + (0:255)'*0.25e-9;
+%! tau = (sqrt (sum ((pos_tx - target).^2, 2)) + sqrt (sum ((pos_rx - target).^2, 2))')/299792458;
+%! tau = reshape (tau, [1, size(tau)]);
+%! iq = exp (-((time - tau)*2e9).^2) .* exp (2i*pi*frf*tau);
+%! ok = signal_omega_k (iq, time, frf, pos_tx, pos_rx, x, y, z);
+%! ## Complex DAS map with the unit phasors (no delay weighting of the phase factor)
+%! [dm, pf] = build_delay_map (x, y, z, frf, pos_tx, pos_rx);
+%! pf = pf ./ dm;
+%! das_c = signal_das (iq, time, dm, pf) + 1i*signal_das (-1i*iq, time, dm, pf);
+%!endfunction
+
+%!function check_omega_k (ok, das_c, rho_abs, rho_real)
+%! ## The envelope peak spans several voxels: the peaks agree within one voxel
+%! [~, k_ok] = max (abs (ok(:)));
+%! [~, k_das] = max (abs (das_c(:)));
+%! [i1, j1, l1] = ind2sub (size (ok), k_ok);
+%! [i2, j2, l2] = ind2sub (size (das_c), k_das);
+%! assert (abs ([i1 j1 l1] - [i2 j2 l2]) <= 1);
+%! a = abs (ok(:));
+%! b = abs (das_c(:));
+%! assert (sum (a.*b)/sqrt (sum (a.^2)*sum (b.^2)) > rho_abs);
+%! ## Phase convention: real(map_out) follows the signal_das map, fringes included
+%! a = real (ok(:));
+%! b = real (das_c(:));
+%! assert (sum (a.*b)/sqrt (sum (a.^2)*sum (b.^2)) > rho_real);
+%! assert (abs (arg (ok(k_das)*conj (das_c(k_das)))) < 0.2);
+%!endfunction
+
+%!test
+%! ## Linear array: 16 tx at lambda/2, 2 rx, phase centres every lambda/8
+%! dx = 299792458/8e9/4;
+%! pos_tx = [((0:15)' - 8)*2*dx, zeros(16, 2)];
+%! pos_rx = [0 0 0; dx 0 0];
+%! x = (-32:31)*dx;
+%! z = 0.5 + (0:47)*0.0125;
+%! [ok, das_c] = omega_k_vs_das (pos_tx, pos_rx, x, 0, z, [5*dx 0 0.8]);
+%! assert (size (ok), [64 1 48]);
+%! check_omega_k (ok, das_c, 0.97, 0.95);
+
+%!test
+%! ## Planar array: 12 tx along x, 12 rx along y, 12 x 12 phase centres at lambda/4
+%! dx = 299792458/8e9/4;
+%! pos_tx = [((0:11)' - 6)*2*dx, zeros(12, 2)];
+%! pos_rx = [zeros(12, 1), ((0:11)' - 6)*2*dx, zeros(12, 1)];
+%! x = (-12:11)*dx;
+%! z = 0.4 + (0:15)*0.0125;
+%! [ok, das_c] = omega_k_vs_das (pos_tx, pos_rx, x, x, z, [3*dx -4*dx 0.5]);
+%! assert (size (ok), [24 24 16]);
+%! check_omega_k (ok, das_c, 0.93, 0.9);
+
+%!error <antennas must lie on a plane z = const>
+%! signal_omega_k (zeros (16, 1, 2), (0:15)'*1e-10, 8e9, [0 0 0], [0 0 0; 0.01 0 0.01], -0.1:0.01:0.1, 0, 0.5:0.1:1);
+%!error <virtual array outside of the x/y grid>
+%! signal_omega_k (zeros (16, 1, 1), (0:15)'*1e-10, 8e9, [1 0 0], [1 0 0], -0.1:0.01:0.1, 0, 0.5:0.1:1);
+*/
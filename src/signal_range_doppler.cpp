@@ -0,0 +1,431 @@
+/* Copyright (C) 2024 Alessio Cacciatori
+##
+## This program is free software: you can redistribute it and/or modify
+## it under the terms of the GNU General Public License as published by
+## the Free Software Foundation, either version 3 of the License, or
+## (at your option) any later version.
+##
+## This program is distributed in the hope that it will be useful,
+## but WITHOUT ANY WARRANTY; without even the implied warranty of
+## MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+## GNU General Public License for more details.
+##
+## You should have received a copy of the GNU General Public License
+## along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+## -*- texinfo -*-
+## @deftypefn {} {@var{h} =} signal_range_doppler (@var{window}, @var{n_frames})\n\
+## @deftypefnx {} {[@var{rd}, @var{ready}] =} signal_range_doppler (@var{h}, @var{frame})\n\
+## Streaming range-Doppler processing over the last frames.\n\
+## @seealso{signal_clutter_filter, set_fps}
+## @end deftypefn
+
+## Author: Alessio Cacciatori <alessioc@alessio-laptop>
+## Created: 2024-11-15
+*/
+
+#include <octave/oct.h>
+#include <octave/ov-struct.h>
+#include <map>
+#include <algorithm>
+#include <vector>
+#include "aria_uwb_toolbox.h"
+
+// Slow-time spectrum of every element (channel x range bin) over a sliding window
+// of n_frames frames. Cosine-sum windows without zero padding update the DFT of the
+// window in O(n_frames) per element and frame (sliding DFT) and apply the window
+// as a convolution of the bins; the other configurations run a windowed FFT per frame.
+struct rd_engine
+{
+	octave_idx_type			n_frames;
+	octave_idx_type			n_fft;
+	std::vector<double>		window;		// n_frames, oldest frame first
+	std::vector<double>		cosine;		// a0, a1, a2 of a0 - a1 cos(2 pi n/N) + a2 cos(4 pi n/N)
+	bool					sliding;
+	bool					single;
+	dim_vector				dims;
+	octave_idx_type			n_elem;
+	std::vector<Complex>	ring;		// (n_elem x n_frames) frame slots
+	std::vector<Complex>	spectrum;	// (n_elem x n_frames) DFT of the window, sliding only
+	std::vector<Complex>	twiddle;	// exp(j 2 pi k / n_frames)
+	octave_idx_type			head;		// slot of the oldest frame
+	octave_idx_type			count;		// frames received since the last reset
+};
+
+// Engines of the session, released by "clear" or when the oct-file is cleared
+static std::map<int, rd_engine> engines;
+static int						next_handle = 1;
+
+static bool rd_cosine_window(const std::string& name, std::vector<double>& a)
+{
+	if (name=="rect")		{ a = {1.0, 0.0, 0.0};		return true; }
+	if (name=="hann")		{ a = {0.5, 0.5, 0.0};		return true; }
+	if (name=="hamming")	{ a = {0.54, 0.46, 0.0};	return true; }
+	if (name=="blackman")	{ a = {0.42, 0.5, 0.08};	return true; }
+	return false;
+}
+
+// DFT of the window from the ring, oldest frame at index 0, zero padded to len
+static void rd_windowed_fft(const rd_engine& e, const double* w, octave_idx_type len, ComplexNDArray& out)
+{
+	out = ComplexNDArray(dim_vector({e.n_elem, len}), Complex(0));
+	Complex* po = out.fortran_vec();
+	for (octave_idx_type n=0; n < e.n_frames; n++)
+	{
+		const Complex* slot = e.ring.data() + ((e.head+n) % e.n_frames)*e.n_elem;
+		double		   wn	= w ? w[n] : 1.0;
+		for (octave_idx_type i=0; i < e.n_elem; i++)
+			po[i + e.n_elem*n] = wn*slot[i];
+	}
+	out = out.fourier(1);
+}
+
+static void rd_push(rd_engine& e, const Complex* x)
+{
+	if (e.ring.empty())
+	{
+		e.ring.assign(e.n_elem*e.n_frames, Complex(0));
+		if (e.sliding)
+			e.spectrum.assign(e.n_elem*e.n_frames, Complex(0));
+		e.head	= 0;
+		e.count = 0;
+	}
+	Complex* old = e.ring.data() + e.head*e.n_elem;
+	if (e.sliding)
+	{
+		// X_k <- (X_k - x_old + x_new) exp(j 2 pi k / N)
+		for (octave_idx_type k=0; k < e.n_frames; k++)
+		{
+			Complex* s	= e.spectrum.data() + k*e.n_elem;
+			Complex	 tw = e.twiddle[k];
+			for (octave_idx_type i=0; i < e.n_elem; i++)
+				s[i] = (s[i] - old[i] + x[i])*tw;
+		}
+	}
+	std::copy(x, x+e.n_elem, old);
+	e.head = (e.head+1) % e.n_frames;
+	e.count++;
+
+	// The recursion accumulates rounding errors: the spectrum is recomputed
+	// from the ring every time the window wraps, the cost is O(log N) per frame
+	if ((e.sliding)&&(e.head==0))
+	{
+		ComplexNDArray fresh;
+		rd_windowed_fft(e, nullptr, e.n_frames, fresh);
+		std::copy(fresh.data(), fresh.data()+fresh.numel(), e.spectrum.begin());
+	}
+}
+
+// Range-Doppler map (n_elem x n_fft), zero Doppler at index floor(n_fft/2)
+static void rd_map(const rd_engine& e, Complex* out)
+{
+	octave_idx_type n_fft = e.n_fft;
+	octave_idx_type shift = n_fft/2;
+	if (!e.sliding)
+	{
+		ComplexNDArray spec;
+		rd_windowed_fft(e, e.window.data(), n_fft, spec);
+		for (octave_idx_type k=0; k < n_fft; k++)
+			std::copy(spec.data() + k*e.n_elem, spec.data() + (k+1)*e.n_elem, out + ((k+shift) % n_fft)*e.n_elem);
+		return;
+	}
+	// Cosine-sum window: Y_k = a0 X_k - a1/2 (X_k-1 + X_k+1) + a2/2 (X_k-2 + X_k+2)
+	octave_idx_type N  = e.n_frames;
+	double			a0 = e.cosine[0], a1 = 0.5*e.cosine[1], a2 = 0.5*e.cosine[2];
+	for (octave_idx_type k=0; k < N; k++)
+	{
+		const Complex* x0  = e.spectrum.data() + k*e.n_elem;
+		const Complex* xm1 = e.spectrum.data() + ((k+N-1) % N)*e.n_elem;
+		const Complex* xp1 = e.spectrum.data() + ((k+1) % N)*e.n_elem;
+		const Complex* xm2 = e.spectrum.data() + ((k+2*N-2) % N)*e.n_elem;
+		const Complex* xp2 = e.spectrum.data() + ((k+2) % N)*e.n_elem;
+		Complex*	   y   = out + ((k+shift) % N)*e.n_elem;
+		if (a2==0)
+			for (octave_idx_type i=0; i < e.n_elem; i++)
+				y[i] = a0*x0[i] - a1*(xm1[i] + xp1[i]);
+		else
+			for (octave_idx_type i=0; i < e.n_elem; i++)
+				y[i] = a0*x0[i] - a1*(xm1[i] + xp1[i]) + a2*(xm2[i] + xp2[i]);
+	}
+}
+
+static bool rd_handle(const octave_value& value, int& handle)
+{
+	if ((!value.is_real_scalar())||(engines.find(value.int_value())==engines.end()))
+	{
+		error("invalid range-Doppler handle");
+		return false;
+	}
+	handle = value.int_value();
+	return true;
+}
+
+// Output dimensions: the frame dimensions followed by Doppler
+static dim_vector rd_dims(const dim_vector& frame, octave_idx_type n_fft)
+{
+	if ((frame.ndims()==2)&&(frame(1)==1))
+		return dim_vector({frame(0), n_fft});
+	dim_vector out = frame;
+	out.resize(frame.ndims()+1);
+	out(frame.ndims()) = n_fft;
+	return out;
+}
+
+DEFUN_DLD(signal_range_doppler, args, , "-*- texinfo -*-\n\
+@deftypefn {} {@var{h} =} signal_range_doppler (@var{window}, @var{n_frames})\n\
+@deftypefnx {} {@var{h} =} signal_range_doppler (@var{window}, @var{n_frames}, @var{n_fft})\n\
+@deftypefnx {} {@var{h} =} signal_range_doppler (\"window\", @var{w})\n\
+@deftypefnx {} {@var{h} =} signal_range_doppler (\"window\", @var{w}, @var{n_fft})\n\
+@deftypefnx {} {[@var{rd}, @var{ready}] =} signal_range_doppler (@var{h}, @var{frame})\n\
+@deftypefnx {} {@var{f} =} signal_range_doppler (\"freq\", @var{h}, @var{fps})\n\
+@deftypefnx {} {} signal_range_doppler (\"reset\", @var{h})\n\
+@deftypefnx {} {} signal_range_doppler (\"clear\", @var{h})\n\
+Streaming slow-time FFT over the last @var{n_frames} frames of every channel and range bin.\n\
+The first forms create an engine and return its handle; the engine keeps a ring buffer \n\
+of the last @var{n_frames} frames and every new frame returns the updated range-Doppler map.\n\
+@var{window} is the slow-time window: \"rect\", \"hann\", \"hamming\" or \"blackman\" \n\
+(periodic definitions); \"window\" uses the real vector @var{w}, whose length sets @var{n_frames}.\n\
+@var{n_fft} (default: @var{n_frames}) zero pads the window to @var{n_fft} Doppler bins.\n\
+With the named windows and no zero padding the spectrum is updated by a sliding DFT in \n\
+O(@var{n_frames}) operations per element and frame, and recomputed from the ring buffer \n\
+every @var{n_frames} frames; the other configurations run a windowed FFT on every frame.\n\
+@var{frame} is a complex frame of any size, e.g. the raw data of read_raw_data_multiple \n\
+(channels x samples) or the I/Q data (time x n_tx x n_rx) of the imaging functions; all the \n\
+frames of an engine must have the same size. @var{rd} has the dimensions of @var{frame} \n\
+followed by the @var{n_fft} Doppler bins, zero Doppler at index floor(@var{n_fft}/2)+1 as \n\
+after fftshift, and is single when @var{frame} is single.\n\
+Until @var{n_frames} frames have been received the missing frames are zeros and \n\
+@var{ready} is false.\n\
+\"freq\" returns the Doppler frequencies of the bins for the frame rate @var{fps} (see set_fps).\n\
+\"reset\" empties the ring buffer; \"clear\" releases the engine.\n\
+Clearing the oct-file (clear signal_range_doppler) releases all the engines.\n\
+@seealso{signal_clutter_filter, set_fps}\n\
+@end deftypefn")
+{
+	octave_value_list retval;
+	if (args.length() < 1)
+	{
+		print_usage();
+		return octave_value();
+	}
+
+	// Frame update
+	if (!args(0).is_string())
+	{
+		int handle;
+		if (args.length()!=2)
+		{
+			print_usage();
+			return octave_value();
+		}
+		if (!rd_handle(args(0), handle))
+			return octave_value();
+		rd_engine& e = engines[handle];
+		if (!args(1).isnumeric())
+		{
+			error("frame must be a numeric array");
+			return octave_value();
+		}
+		dim_vector dims = args(1).dims();
+		if ((!e.ring.empty())&&(dims!=e.dims))
+		{
+			error("frame size differs from the previous frames");
+			return octave_value();
+		}
+		e.dims	 = dims;
+		e.n_elem = dims.numel();
+		e.single = args(1).is_single_type();
+
+		ComplexNDArray frame = args(1).complex_array_value();
+		rd_push(e, frame.data());
+
+		ComplexNDArray out(rd_dims(dims, e.n_fft));
+		rd_map(e, out.fortran_vec());
+		if (e.single)
+			retval(0) = octave_value(FloatComplexNDArray(out));
+		else
+			retval(0) = octave_value(out);
+		retval(1) = octave_value(e.count >= e.n_frames);
+		return retval;
+	}
+
+	std::string key = args(0).string_value();
+	std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+
+	if ((key=="reset")||(key=="clear"))
+	{
+		int handle;
+		if (args.length()!=2)
+		{
+			print_usage();
+			return octave_value();
+		}
+		if (!rd_handle(args(1), handle))
+			return octave_value();
+		if (key=="clear")
+		{
+			engines.erase(handle);
+			return octave_value();
+		}
+		rd_engine& e = engines[handle];
+		std::vector<Complex>().swap(e.ring);
+		std::vector<Complex>().swap(e.spectrum);
+		e.head	= 0;
+		e.count = 0;
+		return octave_value();
+	}
+
+	if (key=="freq")
+	{
+		int handle;
+		if (args.length()!=3)
+		{
+			print_usage();
+			return octave_value();
+		}
+		if (!rd_handle(args(1), handle))
+			return octave_value();
+		if ((!args(2).is_real_scalar())||(args(2).double_value() <= 0))
+		{
+			error("fps must be a positive value");
+			return octave_value();
+		}
+		const rd_engine& e	 = engines[handle];
+		double			 fps = args(2).double_value();
+		NDArray f(dim_vector({1, e.n_fft}));
+		for (octave_idx_type k=0; k < e.n_fft; k++)
+			f(k) = (k - e.n_fft/2)*fps/e.n_fft;
+		return octave_value(f);
+	}
+
+	rd_engine e;
+	e.single = false;
+	e.n_elem = 0;
+	e.head	 = 0;
+	e.count	 = 0;
+	if ((args.length() < 2)||(args.length() > 3))
+	{
+		print_usage();
+		return octave_value();
+	}
+	if (key=="window")
+	{
+		if ((!args(1).isreal())||(args(1).isempty()))
+		{
+			error("window requires a real vector w");
+			return octave_value();
+		}
+		NDArray w = args(1).array_value();
+		e.window.assign(w.data(), w.data()+w.numel());
+		e.n_frames = w.numel();
+		e.sliding  = false;
+	}
+	else if (rd_cosine_window(key, e.cosine))
+	{
+		if ((!args(1).is_real_scalar())||(args(1).double_value() < 1))
+		{
+			error("n_frames must be a positive integer");
+			return octave_value();
+		}
+		e.n_frames = args(1).idx_type_value();
+		e.window.resize(e.n_frames);
+		for (octave_idx_type n=0; n < e.n_frames; n++)
+			e.window[n] = e.cosine[0] - e.cosine[1]*cos(2.0*M_PI*n/e.n_frames) + e.cosine[2]*cos(4.0*M_PI*n/e.n_frames);
+		e.sliding = true;
+	}
+	else
+	{
+		error("unknown window \"%s\"", key.c_str());
+		return octave_value();
+	}
+
+	e.n_fft = e.n_frames;
+	if (args.length()==3)
+	{
+		if ((!args(2).is_real_scalar())||(args(2).idx_type_value() < e.n_frames))
+		{
+			error("n_fft must be an integer not smaller than n_frames");
+			return octave_value();
+		}
+		e.n_fft = args(2).idx_type_value();
+	}
+	// The bin convolution of the sliding DFT needs the unpadded spectrum
+	if (e.n_fft!=e.n_frames)
+		e.sliding = false;
+	if (e.sliding)
+	{
+		e.twiddle.resize(e.n_frames);
+		for (octave_idx_type k=0; k < e.n_frames; k++)
+			e.twiddle[k] = std::polar(1.0, 2.0*M_PI*k/e.n_frames);
+	}
+
+	int handle = next_handle++;
+	engines[handle] = e;
+	return octave_value(handle);
+}
+
+/*
+%!function ref = rd_ref (frames, k, w, n_fft)
+%! ## fftshift (fft (w .* last N frames, n_fft)) along the frame dimension,
+%! ## oldest frame first, missing frames as zeros
+%! N = numel (w);
+%! last = zeros ([size(frames)(1:end-1), N]);
+%! last(:,:,N-min(k,N)+1:N) = frames(:,:,max(1,k-N+1):k);
+%! ref = fftshift (fft (last .* reshape (w, 1, 1, N), n_fft, 3), 3);
+%!endfunction
+
+%!shared frames
+%! frames = complex (randn (5, 3, 40), randn (5, 3, 40));
+
+%!test
+%! ## Sliding DFT and cosine-window bin convolution, over several wraps of the ring
+%! N = 8;
+%! n = 0:N-1;
+%! windows = {"rect", ones(1, N); "hann", 0.5 - 0.5*cos(2*pi*n/N);
+%!            "hamming", 0.54 - 0.46*cos(2*pi*n/N);
+%!            "blackman", 0.42 - 0.5*cos(2*pi*n/N) + 0.08*cos(4*pi*n/N)};
+%! for i = 1:rows (windows)
+%!   h = signal_range_doppler (windows{i,1}, N);
+%!   for k = 1:size (frames, 3)
+%!     [rd, ready] = signal_range_doppler (h, frames(:,:,k));
+%!     assert (ready, k >= N);
+%!     assert (rd, rd_ref (frames, k, windows{i,2}, N), 1e-10*max (abs (rd(:))));
+%!   endfor
+%!   signal_range_doppler ("clear", h);
+%! endfor
+
+%!test
+%! ## User window and zero padding: windowed FFT of every frame
+%! w = 0.5 + rand (1, 6);
+%! n = 0:5;
+%! for cfg = {{"window", w}, w, 6; {"window", w, 16}, w, 16; {"hann", 6, 15}, 0.5 - 0.5*cos(2*pi*n/6), 15}'
+%!   h = signal_range_doppler (cfg{1}{:});
+%!   for k = 1:20
+%!     rd = signal_range_doppler (h, frames(:,:,k));
+%!     assert (size (rd), [5 3 cfg{3}]);
+%!     assert (rd, rd_ref (frames, k, cfg{2}, cfg{3}), 1e-10*max (abs (rd(:))));
+%!   endfor
+%!   assert (signal_range_doppler ("freq", h, 100), ((0:cfg{3}-1) - floor (cfg{3}/2))*100/cfg{3}, 1e-12);
+%!   signal_range_doppler ("clear", h);
+%! endfor
+
+%!test
+%! ## Column frames, single frames and reset
+%! h = signal_range_doppler ("hann", 4);
+%! for k = 1:6
+%!   rd = signal_range_doppler (h, single (frames(:,1,k)));
+%! endfor
+%! assert (class (rd), "single");
+%! assert (size (rd), [5 4]);
+%! ref = squeeze (rd_ref (frames(:,1,:), 6, 0.5 - 0.5*cos(2*pi*(0:3)/4), 4));
+%! assert (double (rd), ref, 1e-5*max (abs (ref(:))));
+%! signal_range_doppler ("reset", h);
+%! [rd, ready] = signal_range_doppler (h, frames(:,1,1));
+%! assert (ready, false);
+%! assert (rd, squeeze (rd_ref (frames(:,1,:), 1, 0.5 - 0.5*cos(2*pi*(0:3)/4), 4)), 1e-12);
+%! signal_range_doppler ("clear", h);
+
+%!error <invalid range-Doppler handle> signal_range_doppler (-1, 1)
+%!error <unknown window> signal_range_doppler ("kaiser", 8)
+%!error <n_fft must be an integer not smaller than n_frames> signal_range_doppler ("hann", 8, 4)
+*/
@@ -0,0 +1,789 @@
+/* Copyright (C) 2024 Alessio Cacciatori
+##
+## This program is free software: you can redistribute it and/or modify
+## it under the terms of the GNU General Public License as published by
+## the Free Software Foundation, either version 3 of the License, or
+## (at your option) any later version.
+##
+## This program is distributed in the hope that it will be useful,
+## but WITHOUT ANY WARRANTY; without even the implied warranty of
+## MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+## GNU General Public License for more details.
+##
+## You should have received a copy of the GNU General Public License
+## along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+## -*- texinfo -*-
+## @deftypefn {} {@var{h} =} signal_tracker (@var{model}, @var{params})\n\
+## @deftypefnx {} {[@var{detOut}, @var{detFullState}] =} signal_tracker (@var{h}, @var{detections})\n\
+## Host-side multi-target 2D Kalman tracker.\n\
+## @seealso{set_kalman_2D, get_detection_2D, signal_cfar}
+## @end deftypefn
+
+## Author: Alessio Cacciatori <alessioc@alessio-laptop>
+## Created: 2024-11-15
+*/
+
+#include <octave/oct.h>
+#include <octave/ov-struct.h>
+#include <map>
+#include <algorithm>
+#include <numeric>
+#include <limits>
+#include <vector>
+#include "aria_uwb_toolbox.h"
+
+enum trk_model {TRK_CV, TRK_CA};
+enum trk_assoc {TRK_GNN, TRK_HUNGARIAN};
+
+// Parameters of set_kalman_2D, plus the frame period and the gate
+struct trk_params
+{
+	double	meas_unc;		// measurement std (m)
+	double	speed_unc;		// initial speed std (m/s)
+	double	pos_unc;		// initial position std (m)
+	double	acc_unc;		// process noise: acceleration std (CV), acceleration increment std (CA)
+	int		gate_in;		// hits before a track is confirmed
+	int		gate_out;		// misses before a confirmed track is released
+	int		par_run;		// frames two confirmed tracks may run together before the younger is pruned
+	double	dt;				// frame period (s)
+	double	gate;			// squared Mahalanobis gate
+};
+
+// x and y are filtered independently (diagonal measurement noise, separable
+// motion model), so every axis holds its own (p, v[, a]) state and covariance
+struct trk_axis
+{
+	double x[3];
+	double P[3][3];
+};
+
+struct trk_track
+{
+	int				id;
+	trk_axis		ax[2];
+	double			S[2];		// innovation variances of the prediction
+	int				hits;
+	int				misses;
+	int				parallel;
+	octave_idx_type age;
+	bool			confirmed;
+};
+
+struct tracker
+{
+	trk_model				model;
+	trk_assoc				assoc;
+	trk_params				par;
+	std::vector<trk_track>	tracks;
+	int						next_id;
+};
+
+// Trackers of the session, released by "clear" or when the oct-file is cleared
+static std::map<int, tracker> trackers;
+static int					  next_handle = 1;
+
+static int trk_order(const tracker& t) { return t.model==TRK_CA ? 3 : 2; }
+
+//---------------------------------------------------
+// Kalman filter on one axis
+static void trk_predict(const tracker& t, trk_axis& a, double dt)
+{
+	int	   m  = trk_order(t);
+	double q  = t.par.acc_unc*t.par.acc_unc;
+	double F[3][3] = {{1, dt, 0.5*dt*dt}, {0, 1, dt}, {0, 0, 1}};
+	// Discrete white noise acceleration (CV) / Wiener acceleration (CA)
+	double G[3]	   = {0.5*dt*dt, dt, 1};
+	double x[3]	   = {0, 0, 0};
+	double FP[3][3];
+	for (int i=0; i < m; i++)
+	{
+		for (int k=0; k < m; k++)
+			x[i] += F[i][k]*a.x[k];
+		for (int j=0; j < m; j++)
+		{
+			FP[i][j] = 0;
+			for (int k=0; k < m; k++)
+				FP[i][j] += F[i][k]*a.P[k][j];
+		}
+	}
+	for (int i=0; i < m; i++)
+	{
+		a.x[i] = x[i];
+		for (int j=0; j < m; j++)
+		{
+			double s = q*G[i]*G[j];
+			for (int k=0; k < m; k++)
+				s += FP[i][k]*F[j][k];
+			a.P[i][j] = s;
+		}
+	}
+}
+
+static void trk_update(const tracker& t, trk_axis& a, double z)
+{
+	int	   m = trk_order(t);
+	double S = a.P[0][0] + t.par.meas_unc*t.par.meas_unc;
+	double K[3];
+	for (int i=0; i < m; i++)
+		K[i] = a.P[i][0]/S;
+	double y  = z - a.x[0];
+	double P0[3];
+	for (int j=0; j < m; j++)
+		P0[j] = a.P[0][j];
+	for (int i=0; i < m; i++)
+	{
+		a.x[i] += K[i]*y;
+		for (int j=0; j < m; j++)
+			a.P[i][j] -= K[i]*P0[j];
+	}
+}
+
+static trk_track trk_new(tracker& t, double px, double py)
+{
+	trk_track tr;
+	tr.id		 = t.next_id++;
+	tr.hits		 = 1;
+	tr.misses	 = 0;
+	tr.parallel	 = 0;
+	tr.age		 = 0;
+	tr.confirmed = tr.hits >= t.par.gate_in;
+	double p[2] = {px, py};
+	for (int k=0; k < 2; k++)
+	{
+		trk_axis& a = tr.ax[k];
+		for (int i=0; i < 3; i++)
+		{
+			a.x[i] = 0;
+			for (int j=0; j < 3; j++)
+				a.P[i][j] = 0;
+		}
+		a.x[0]	  = p[k];
+		a.P[0][0] = t.par.pos_unc*t.par.pos_unc;
+		a.P[1][1] = t.par.speed_unc*t.par.speed_unc;
+		a.P[2][2] = t.par.acc_unc*t.par.acc_unc;
+		tr.S[k]	  = a.P[0][0] + t.par.meas_unc*t.par.meas_unc;
+	}
+	return tr;
+}
+
+//---------------------------------------------------
+// Spatial hash of 2D points: cells of the largest gate radius, so the
+// candidates of a point are in the 3 x 3 cells around it
+struct trk_hash
+{
+	double							cell;
+	double							x0, y0;		// origin: lower corner of the points
+	long long						ncx, ncy;	// cells spanned by the points
+	std::vector<long long>			keys;		// sorted
+	std::vector<octave_idx_type>	items;		// item of every key
+
+	// Cell coordinates relative to the origin, queries clamped one cell beyond the
+	// points: the keys of a row keep clear of the neighbour rows and cannot overflow
+	long long cell_x(double x) const { return (long long)std::fmin(std::fmax(std::floor((x - x0)/cell), -1.0), (double)ncx); }
+	long long cell_y(double y) const { return (long long)std::fmin(std::fmax(std::floor((y - y0)/cell), -1.0), (double)ncy); }
+
+	// Sorted by cx then cy: the 3 cells of a row are one contiguous range
+	long long key(long long cx, long long cy) const { return cx*(ncy + 4) + (cy + 2); }
+
+	trk_hash(const double* px, const double* py, octave_idx_type n, double cell_size)
+		: cell(cell_size), x0(0), y0(0), ncx(1), ncy(1)
+	{
+		if (n > 0)
+		{
+			double x1 = *std::max_element(px, px+n), y1 = *std::max_element(py, py+n);
+			x0 = *std::min_element(px, px+n);
+			y0 = *std::min_element(py, py+n);
+			// At most 2^30 cells per axis: larger cells only add candidates
+			cell = std::max(cell, std::max(x1-x0, y1-y0)/(double)(1LL << 30));
+			ncx	 = (long long)std::floor((x1-x0)/cell) + 1;
+			ncy	 = (long long)std::floor((y1-y0)/cell) + 1;
+		}
+		std::vector<std::pair<long long, octave_idx_type>> kv(n);
+		for (octave_idx_type i=0; i < n; i++)
+			kv[i] = {key(cell_x(px[i]), cell_y(py[i])), i};
+		std::sort(kv.begin(), kv.end());
+		keys.resize(n);
+		items.resize(n);
+		for (octave_idx_type i=0; i < n; i++)
+		{
+			keys[i]	 = kv[i].first;
+			items[i] = kv[i].second;
+		}
+	}
+
+	template <typename F>
+	void query(double x, double y, F fn) const
+	{
+		long long cx = cell_x(x);
+		long long cy = cell_y(y);
+		for (long long i=cx-1; i <= cx+1; i++)
+		{
+			auto first = std::lower_bound(keys.begin(), keys.end(), key(i, cy-1));
+			auto last  = std::upper_bound(first, keys.end(), key(i, cy+1));
+			for (auto it=first; it!=last; ++it)
+				fn(items[it-keys.begin()]);
+		}
+	}
+};
+
+struct trk_pair
+{
+	double			d2;
+	octave_idx_type track;
+	octave_idx_type det;
+	bool operator<(const trk_pair& o) const { return d2 < o.d2; }
+};
+
+//---------------------------------------------------
+// Optimal assignment (Hungarian, O(n^3)) of a square cost matrix; row_of[c] is
+// the row assigned to column c
+static void trk_hungarian(const std::vector<double>& cost, int n, std::vector<int>& row_of)
+{
+	const double inf = std::numeric_limits<double>::infinity();
+	std::vector<double> u(n+1, 0), v(n+1, 0), minv(n+1);
+	std::vector<int>	p(n+1, 0), way(n+1, 0);
+	std::vector<char>	used(n+1);
+	for (int i=1; i <= n; i++)
+	{
+		p[0]	= i;
+		int j0	= 0;
+		std::fill(minv.begin(), minv.end(), inf);
+		std::fill(used.begin(), used.end(), 0);
+		do
+		{
+			used[j0]	 = 1;
+			int	   i0	 = p[j0], j1 = 0;
+			double delta = inf;
+			for (int j=1; j <= n; j++)
+			{
+				if (used[j])
+					continue;
+				double cur = cost[(i0-1)*n + (j-1)] - u[i0] - v[j];
+				if (cur < minv[j])
+				{
+					minv[j] = cur;
+					way[j]	= j0;
+				}
+				if (minv[j] < delta)
+				{
+					delta = minv[j];
+					j1	  = j;
+				}
+			}
+			for (int j=0; j <= n; j++)
+			{
+				if (used[j])
+				{
+					u[p[j]] += delta;
+					v[j]	-= delta;
+				}
+				else
+					minv[j] -= delta;
+			}
+			j0 = j1;
+		} while (p[j0]!=0);
+		do
+		{
+			int j1 = way[j0];
+			p[j0]  = p[j1];
+			j0	   = j1;
+		} while (j0);
+	}
+	row_of.assign(n, -1);
+	for (int j=1; j <= n; j++)
+		row_of[j-1] = p[j]-1;
+}
+
+static octave_idx_type trk_find(std::vector<octave_idx_type>& parent, octave_idx_type i)
+{
+	while (parent[i]!=i)
+	{
+		parent[i] = parent[parent[i]];
+		i		  = parent[i];
+	}
+	return i;
+}
+
+// Hungarian assignment solved independently on every connected component of the
+// gating graph: components are small, so the cost stays far below O(n^3) of the frame
+static void trk_assign_hungarian(const tracker& t, const std::vector<trk_pair>& pairs, octave_idx_type n_tracks,
+								 octave_idx_type n_dets, std::vector<octave_idx_type>& det_of)
+{
+	std::vector<octave_idx_type> parent(n_tracks+n_dets);
+	std::iota(parent.begin(), parent.end(), 0);
+	for (const trk_pair& pr : pairs)
+	{
+		octave_idx_type a = trk_find(parent, pr.track), b = trk_find(parent, n_tracks+pr.det);
+		if (a!=b)
+			parent[a] = b;
+	}
+	// Pairs grouped by component
+	std::vector<std::pair<octave_idx_type, const trk_pair*>> order(pairs.size());
+	for (size_t i=0; i < pairs.size(); i++)
+		order[i] = {trk_find(parent, pairs[i].track), &pairs[i]};
+	std::sort(order.begin(), order.end(), [](const std::pair<octave_idx_type, const trk_pair*>& a,
+											 const std::pair<octave_idx_type, const trk_pair*>& b) { return a.first < b.first; });
+
+	// Unassigned track cost: the gate, so every gated pair is preferred to a miss
+	double miss = t.par.gate;
+	double big	= 1e6*(miss+1);
+	for (size_t first=0, last; first < order.size(); first=last)
+	{
+		std::vector<const trk_pair*> comp;
+		for (last=first; (last < order.size())&&(order[last].first==order[first].first); last++)
+			comp.push_back(order[last].second);
+		std::vector<octave_idx_type> tr, de;
+		std::map<octave_idx_type, int> ti, di;
+		for (const trk_pair* pr : comp)
+		{
+			if (ti.insert({pr->track, (int)tr.size()}).second) tr.push_back(pr->track);
+			if (di.insert({pr->det,	 (int)de.size()}).second) de.push_back(pr->det);
+		}
+		int nt = tr.size(), nd = de.size(), n = nt+nd;
+		// rows: tracks, then dummy rows of unassigned detections
+		// columns: detections, then dummy columns of unassigned tracks
+		std::vector<double> cost(n*n, 0.0);
+		for (int r=0; r < nt; r++)
+			for (int c=0; c < n; c++)
+				cost[r*n + c] = c < nd ? big : (c-nd==r ? miss : big);
+		for (const trk_pair* pr : comp)
+			cost[ti[pr->track]*n + di[pr->det]] = pr->d2;
+		std::vector<int> row_of;
+		trk_hungarian(cost, n, row_of);
+		for (int c=0; c < nd; c++)
+		{
+			int r = row_of[c];
+			if ((r < nt)&&(cost[r*n + c] < big))
+				det_of[tr[r]] = de[c];
+		}
+	}
+}
+
+static void trk_assign_gnn(std::vector<trk_pair>& pairs, octave_idx_type n_dets, std::vector<octave_idx_type>& det_of)
+{
+	std::sort(pairs.begin(), pairs.end());
+	std::vector<char> used(n_dets, 0);
+	for (const trk_pair& pr : pairs)
+	{
+		if ((det_of[pr.track] >= 0)||(used[pr.det]))
+			continue;
+		det_of[pr.track] = pr.det;
+		used[pr.det]	 = 1;
+	}
+}
+
+//---------------------------------------------------
+// Frame: predict, gate, associate, update, manage the tracks
+static void trk_step(tracker& t, const double* dx, const double* dy, octave_idx_type n_dets, double dt)
+{
+	octave_idx_type n_tracks = t.tracks.size();
+	double			R		 = t.par.meas_unc*t.par.meas_unc;
+	double			radius	 = 0;
+	for (trk_track& tr : t.tracks)
+	{
+		for (int k=0; k < 2; k++)
+		{
+			trk_predict(t, tr.ax[k], dt);
+			tr.S[k] = tr.ax[k].P[0][0] + R;
+		}
+		radius = std::max(radius, sqrt(t.par.gate*std::max(tr.S[0], tr.S[1])));
+	}
+
+	// Gating through the spatial hash of the detections
+	std::vector<trk_pair> pairs;
+	if ((n_tracks > 0)&&(n_dets > 0))
+	{
+		trk_hash hash(dx, dy, n_dets, radius);
+		for (octave_idx_type i=0; i < n_tracks; i++)
+		{
+			const trk_track& tr = t.tracks[i];
+			hash.query(tr.ax[0].x[0], tr.ax[1].x[0], [&](octave_idx_type d)
+			{
+				double ex = dx[d] - tr.ax[0].x[0];
+				double ey = dy[d] - tr.ax[1].x[0];
+				double d2 = ex*ex/tr.S[0] + ey*ey/tr.S[1];
+				if (d2 <= t.par.gate)
+					pairs.push_back({d2, i, d});
+			});
+		}
+	}
+
+	// Confirmed tracks are served first: the wide covariance of the tentative
+	// ones would otherwise let them steal the detections of established targets
+	std::vector<octave_idx_type> det_of(n_tracks, -1);
+	std::vector<char>			 used(n_dets, 0);
+	for (int pass=0; pass < 2; pass++)
+	{
+		std::vector<trk_pair> stage;
+		for (const trk_pair& pr : pairs)
+			if ((t.tracks[pr.track].confirmed==(pass==0))&&(!used[pr.det]))
+				stage.push_back(pr);
+		if (t.assoc==TRK_HUNGARIAN)
+			trk_assign_hungarian(t, stage, n_tracks, n_dets, det_of);
+		else
+			trk_assign_gnn(stage, n_dets, det_of);
+		for (octave_idx_type i=0; i < n_tracks; i++)
+			if (det_of[i] >= 0)
+				used[det_of[i]] = 1;
+	}
+
+	// Update and release
+	std::vector<trk_track> kept;
+	kept.reserve(n_tracks + n_dets);
+	for (octave_idx_type i=0; i < n_tracks; i++)
+	{
+		trk_track& tr = t.tracks[i];
+		tr.age++;
+		octave_idx_type d = det_of[i];
+		if (d >= 0)
+		{
+			trk_update(t, tr.ax[0], dx[d]);
+			trk_update(t, tr.ax[1], dy[d]);
+			tr.hits++;
+			tr.misses	  = 0;
+			tr.confirmed |= tr.hits >= t.par.gate_in;
+		}
+		else
+		{
+			tr.misses++;
+			// Tentative tracks are dropped at the first miss
+			if ((!tr.confirmed)||(tr.misses > t.par.gate_out))
+				continue;
+		}
+		kept.push_back(tr);
+	}
+	t.tracks.swap(kept);
+
+	// Confirmed tracks running on the same target: the younger one is pruned
+	// after par_run frames
+	std::vector<octave_idx_type> conf;
+	for (octave_idx_type i=0; i < (octave_idx_type)t.tracks.size(); i++)
+		if (t.tracks[i].confirmed)
+			conf.push_back(i);
+	if (!conf.empty())
+	{
+		std::vector<double> px(conf.size()), py(conf.size());
+		double				r2 = 0;
+		for (size_t c=0; c < conf.size(); c++)
+		{
+			const trk_track& tr = t.tracks[conf[c]];
+			px[c] = tr.ax[0].x[0];
+			py[c] = tr.ax[1].x[0];
+			r2	  = std::max(r2, std::max(tr.ax[0].P[0][0], tr.ax[1].P[0][0]));
+		}
+		trk_hash hash(px.data(), py.data(), conf.size(), std::max(sqrt(2.0*t.par.gate*r2), 1e-9));
+		std::vector<char> prune(t.tracks.size(), 0);
+		for (size_t c=0; c < conf.size(); c++)
+		{
+			trk_track& tr	 = t.tracks[conf[c]];
+			bool	   close = false;
+			hash.query(px[c], py[c], [&](octave_idx_type o)
+			{
+				const trk_track& other = t.tracks[conf[o]];
+				if ((other.age < tr.age)||((other.age==tr.age)&&(other.id >= tr.id)))
+					return;
+				double ex = other.ax[0].x[0] - tr.ax[0].x[0];
+				double ey = other.ax[1].x[0] - tr.ax[1].x[0];
+				double d2 = ex*ex/(other.ax[0].P[0][0] + tr.ax[0].P[0][0]) + ey*ey/(other.ax[1].P[0][0] + tr.ax[1].P[0][0]);
+				close |= d2 <= t.par.gate;
+			});
+			tr.parallel = close ? tr.parallel+1 : 0;
+			prune[conf[c]] = tr.parallel > t.par.par_run;
+		}
+		kept.clear();
+		for (size_t i=0; i < t.tracks.size(); i++)
+			if (!prune[i])
+				kept.push_back(t.tracks[i]);
+		t.tracks.swap(kept);
+	}
+
+	// New tracks from the unassigned detections
+	for (octave_idx_type d=0; d < n_dets; d++)
+		if (!used[d])
+			t.tracks.push_back(trk_new(t, dx[d], dy[d]));
+}
+
+static bool trk_handle(const octave_value& value, int& handle)
+{
+	if ((!value.is_real_scalar())||(trackers.find(value.int_value())==trackers.end()))
+	{
+		error("invalid tracker handle");
+		return false;
+	}
+	handle = value.int_value();
+	return true;
+}
+
+static bool trk_field(const octave_scalar_map& map, const char* name, double def, double min, double& value)
+{
+	value = def;
+	if (!map.isfield(name))
+		return true;
+	octave_value v = map.getfield(name);
+	if ((!v.is_real_scalar())||(v.double_value() < min))
+	{
+		error("params.%s must be a real scalar not smaller than %g", name, min);
+		return false;
+	}
+	value = v.double_value();
+	return true;
+}
+
+DEFUN_DLD(signal_tracker, args, nargout, "-*- texinfo -*-\n\
+@deftypefn {} {@var{h} =} signal_tracker (@var{model}, @var{params})\n\
+@deftypefnx {} {@var{h} =} signal_tracker (@var{model}, @var{params}, @var{association})\n\
+@deftypefnx {} {[@var{detOut}, @var{detFullState}] =} signal_tracker (@var{h}, @var{detections})\n\
+@deftypefnx {} {[@var{detOut}, @var{detFullState}] =} signal_tracker (@var{h}, @var{detections}, @var{dt})\n\
+@deftypefnx {} {} signal_tracker (\"reset\", @var{h})\n\
+@deftypefnx {} {} signal_tracker (\"clear\", @var{h})\n\
+Host-side multi-target 2D Kalman tracker, for offline reprocessing or for detections \n\
+merged from several radars.\n\
+The first forms create a tracker and return its handle. @var{model} is \"cv\" (constant \n\
+velocity) or \"ca\" (constant acceleration); x and y are filtered independently.\n\
+@var{params} has the fields of set_kalman_2D, all optional: meas_unc (measurement std, \n\
+default 0.1 m), speed_unc and pos_unc (initial speed and position std, 1 m/s and 0.5 m), \n\
+acc_unc (process noise acceleration std, 1 m/s^2), gateInTicks (hits before a track is \n\
+reported, 3), gateOutTicks (misses before a track is released, 5), parRunTicks (frames two \n\
+tracks may follow the same target before the younger one is pruned, 10), and \n\
+dt (frame period, 1 s) and gate (squared Mahalanobis gate, 9.21: 99% for 2 dof).\n\
+@var{association} is \"gnn\" (default, greedy global nearest neighbour) or \"hungarian\" \n\
+(optimal assignment, solved on every connected group of gated tracks and detections).\n\
+Gating looks up the detections around every track in a spatial hash grid.\n\
+@var{detections} is a N x 2 (or wider) matrix of [x y] positions, e.g. the blobs of \n\
+get_detection_2D (board, 0); an empty matrix only predicts the tracks. @var{dt} overrides \n\
+the frame period for this frame.\n\
+@var{detOut} and @var{detFullState} use the layout of get_detection_2D type 3/4: one row \n\
+[x y ID] and one struct with StateVector [x; vx; y; vy], P (4 x 4) and ID per confirmed \n\
+track; \"ca\" trackers add the field Acceleration [ax; ay].\n\
+\"reset\" drops all the tracks; \"clear\" releases the tracker.\n\
+Clearing the oct-file (clear signal_tracker) releases all the trackers.\n\
+@seealso{set_kalman_2D, get_detection_2D, signal_cfar}\n\
+@end deftypefn")
+{
+	octave_value_list retval;
+	if (args.length() < 1)
+	{
+		print_usage();
+		return octave_value();
+	}
+
+	// Frame update
+	if (!args(0).is_string())
+	{
+		int handle;
+		if ((args.length() < 2)||(args.length() > 3))
+		{
+			print_usage();
+			return octave_value();
+		}
+		if (!trk_handle(args(0), handle))
+			return octave_value();
+		tracker& t = trackers[handle];
+
+		NDArray			det;
+		octave_idx_type n_dets = 0;
+		if (!args(1).isempty())
+		{
+			if ((!args(1).isreal())||(args(1).ndims()!=2)||(args(1).columns() < 2))
+			{
+				error("detections must be a N x 2 real matrix");
+				return octave_value();
+			}
+			det	   = args(1).array_value();
+			n_dets = det.rows();
+		}
+		double dt = t.par.dt;
+		if (args.length()==3)
+		{
+			if ((!args(2).is_real_scalar())||(args(2).double_value() <= 0))
+			{
+				error("dt must be a positive value");
+				return octave_value();
+			}
+			dt = args(2).double_value();
+		}
+		trk_step(t, det.data(), det.data() + n_dets, n_dets, dt);
+
+		// Confirmed tracks, in the get_detection_2D type 3/4 layout
+		std::vector<const trk_track*> out;
+		for (const trk_track& tr : t.tracks)
+			if (tr.confirmed)
+				out.push_back(&tr);
+		octave_idx_type n_out = out.size();
+		NDArray detOut(dim_vector(n_out, 3));
+		Cell   sv(dim_vector(1, n_out)), cov(dim_vector(1, n_out)), id(dim_vector(1, n_out)), acc(dim_vector(1, n_out));
+		for (octave_idx_type i=0; i < n_out; i++)
+		{
+			const trk_track& tr = *out[i];
+			NDArray s(dim_vector(4, 1));
+			NDArray P(dim_vector(4, 4), 0.0);
+			for (int k=0; k < 2; k++)
+				for (int a=0; a < 2; a++)
+				{
+					s(2*k+a) = tr.ax[k].x[a];
+					for (int b=0; b < 2; b++)
+						P(2*k+a, 2*k+b) = tr.ax[k].P[a][b];
+				}
+			detOut(i, 0) = s(0);
+			detOut(i, 1) = s(2);
+			detOut(i, 2) = tr.id;
+			sv(i)  = octave_value(s);
+			cov(i) = octave_value(P);
+			id(i)  = octave_value((double)tr.id);
+			NDArray a(dim_vector(2, 1));
+			a(0)   = tr.ax[0].x[2];
+			a(1)   = tr.ax[1].x[2];
+			acc(i) = octave_value(a);
+		}
+		retval(0) = octave_value(detOut);
+		if (nargout > 1)
+		{
+			octave_map full(dim_vector(1, n_out));
+			full.setfield("StateVector", sv);
+			full.setfield("P", cov);
+			full.setfield("ID", id);
+			if (t.model==TRK_CA)
+				full.setfield("Acceleration", acc);
+			retval(1) = octave_value(full);
+		}
+		return retval;
+	}
+
+	std::string key = args(0).string_value();
+	std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+
+	if ((key=="reset")||(key=="clear"))
+	{
+		int handle;
+		if (args.length()!=2)
+		{
+			print_usage();
+			return octave_value();
+		}
+		if (!trk_handle(args(1), handle))
+			return octave_value();
+		if (key=="clear")
+			trackers.erase(handle);
+		else
+			trackers[handle].tracks.clear();
+		return octave_value();
+	}
+
+	tracker t;
+	if ((key!="cv")&&(key!="ca"))
+	{
+		error("unknown model \"%s\"", key.c_str());
+		return octave_value();
+	}
+	t.model	  = key=="ca" ? TRK_CA : TRK_CV;
+	t.assoc	  = TRK_GNN;
+	t.next_id = 1;
+	if ((args.length() < 2)||(args.length() > 3))
+	{
+		print_usage();
+		return octave_value();
+	}
+	if ((!args(1).isstruct())&&(!args(1).isempty()))
+	{
+		error("params must be a structure");
+		return octave_value();
+	}
+	octave_scalar_map params = args(1).isstruct() ? args(1).scalar_map_value() : octave_scalar_map();
+	double gate_in, gate_out, par_run;
+	if ((!trk_field(params, "meas_unc", 0.1, 1e-12, t.par.meas_unc))||
+		(!trk_field(params, "speed_unc", 1.0, 0, t.par.speed_unc))||
+		(!trk_field(params, "pos_unc", 0.5, 0, t.par.pos_unc))||
+		(!trk_field(params, "acc_unc", 1.0, 0, t.par.acc_unc))||
+		(!trk_field(params, "gateInTicks", 3, 1, gate_in))||
+		(!trk_field(params, "gateOutTicks", 5, 0, gate_out))||
+		(!trk_field(params, "parRunTicks", 10, 0, par_run))||
+		(!trk_field(params, "dt", 1.0, 1e-12, t.par.dt))||
+		(!trk_field(params, "gate", 9.21, 1e-12, t.par.gate)))
+		return octave_value();
+	t.par.gate_in  = (int)gate_in;
+	t.par.gate_out = (int)gate_out;
+	t.par.par_run  = (int)par_run;
+
+	if (args.length()==3)
+	{
+		std::string assoc = args(2).is_string() ? args(2).string_value() : "";
+		std::transform(assoc.begin(), assoc.end(), assoc.begin(), ::tolower);
+		if ((assoc!="gnn")&&(assoc!="hungarian"))
+		{
+			error("association must be \"gnn\" or \"hungarian\"");
+			return octave_value();
+		}
+		t.assoc = assoc=="hungarian" ? TRK_HUNGARIAN : TRK_GNN;
+	}
+
+	int handle = next_handle++;
+	trackers[handle] = t;
+	return octave_value(handle);
+}
+
+/*
+%!test
+%! ## Two constant velocity targets: confirmed at the gateInTicks-th hit, stable IDs
+%! h = signal_tracker ("cv", struct ("gateInTicks", 3, "gateOutTicks", 5));
+%! for k = 0:19
+%!   truth = [1 + 0.5*k, 2; -1, 3 - 0.3*k];
+%!   [detOut, detFullState] = signal_tracker (h, truth);
+%!   if (k < 2)
+%!     assert (size (detOut), [0 3]);
+%!   else
+%!     assert (detOut(:,3), [1; 2]);
+%!     if (k >= 7)
+%!       assert (detOut(:,1:2), truth, 1e-3);
+%!     endif
+%!   endif
+%! endfor
+%! assert (detOut(:,1:2), truth, 1e-4);
+%! ## Output layout of get_detection_2D type 3/4
+%! assert (numel (detFullState), 2);
+%! assert ([detFullState.ID], [1 2]);
+%! for i = 1:2
+%!   assert (size (detFullState(i).StateVector), [4 1]);
+%!   assert (size (detFullState(i).P), [4 4]);
+%!   assert (detOut(i,1:2), detFullState(i).StateVector([1 3])');
+%! endfor
+%! assert (detFullState(1).StateVector([2 4]), [0.5; 0], 1e-3);
+%! assert (detFullState(2).StateVector([2 4]), [0; -0.3], 1e-3);
+%! ## Released after gateOutTicks missed frames
+%! for k = 1:5
+%!   assert (rows (signal_tracker (h, [])), 2);
+%! endfor
+%! assert (rows (signal_tracker (h, zeros (0, 2))), 0);
+%! signal_tracker ("clear", h);
+
+%!test
+%! ## Two stationary tracks at x = 0 and x = 0.4, then an ambiguous frame: the
+%! ## detection at 0.14 is the nearest of both tracks, the one at -0.16 is only
+%! ## gated by the first. GNN gives 0.14 to the first track and misses the second,
+%! ## Hungarian swaps the pair.
+%! for assoc = {"gnn", "hungarian"}
+%!   h = signal_tracker ("cv", struct ("acc_unc", 0.01), assoc{1});
+%!   for k = 1:8
+%!     signal_tracker (h, [0 0; 0.4 0]);
+%!   endfor
+%!   detOut = signal_tracker (h, [0.14 0; -0.16 0]);
+%!   assert (detOut(:,3), [1; 2]);
+%!   if (strcmp (assoc{1}, "gnn"))
+%!     assert (detOut(1,1) > 0);
+%!     assert (detOut(2,1), 0.4, 1e-12);
+%!   else
+%!     assert (detOut(1,1) < 0);
+%!     assert (detOut(2,1) < 0.4);
+%!   endif
+%!   signal_tracker ("reset", h);
+%!   assert (rows (signal_tracker (h, [])), 0);
+%!   signal_tracker ("clear", h);
+%! endfor
+
+%!error <invalid tracker handle> signal_tracker (-1, [0 0])
+%!error <invalid tracker handle> signal_tracker ("clear", -1)
+%!error <params.meas_unc must be a real scalar> signal_tracker ("cv", struct ("meas_unc", -1))
+%!error <params must be a structure> signal_tracker ("cv", 1)
+%!error <unknown model> signal_tracker ("xy", struct ())
+%!error <association must be> signal_tracker ("cv", struct (), "nn")
+*/
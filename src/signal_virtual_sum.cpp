@@ -0,0 +1,155 @@
+/* Copyright (C) 2024 Alessio Cacciatori
+##
+## This program is free software: you can redistribute it and/or modify
+## it under the terms of the GNU General Public License as published by
+## the Free Software Foundation, either version 3 of the License, or
+## (at your option) any later version.
+##
+## This program is distributed in the hope that it will be useful,
+## but WITHOUT ANY WARRANTY; without even the implied warranty of
+## MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+## GNU General Public License for more details.
+##
+## You should have received a copy of the GNU General Public License
+## along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+## -*- texinfo -*-
+## @deftypefn {} {@var{virtual_signals} =} signal_virtual_sum (@var{signals}, @var{group})\n\
+## Coherent sum of the BB data of the redundant pairs of a virtual array.\n\
+## @seealso{build_delay_map, signal_das}
+## @end deftypefn
+
+## Author: Alessio Cacciatori <alessioc@alessio-laptop>
+## Created: 2024-11-15
+*/
+
+#include <octave/oct.h>
+#include <octave/ov-struct.h>
+#include <vector>
+#include "aria_uwb_toolbox.h"
+
+// out(:, 1, group(t,r), f) += in(:, t, r, f), every pair is a contiguous run of samples
+template <typename A>
+static octave_value virtual_sum(const A& in, octave_idx_type n_time, octave_idx_type n_pairs, octave_idx_type n_frames,
+								const std::vector<octave_idx_type>& group, octave_idx_type n_v)
+{
+	dim_vector dims = n_frames > 1 ? dim_vector({n_time, 1, n_v, n_frames}) : dim_vector({n_time, 1, n_v});
+	A out(dims, 0);
+	const auto* pi = in.data();
+	auto*		po = out.fortran_vec();
+	for (octave_idx_type f=0; f < n_frames; f++)
+		for (octave_idx_type c=0; c < n_pairs; c++)
+		{
+			const auto* src = pi + n_time*(c + n_pairs*f);
+			auto*		dst = po + n_time*(group[c] + n_v*f);
+			for (octave_idx_type s=0; s < n_time; s++)
+				dst[s] += src[s];
+		}
+	return octave_value(out);
+}
+
+DEFUN_DLD(signal_virtual_sum, args, , "-*- texinfo -*-\n\
+@deftypefn {} {@var{virtual_signals} =} signal_virtual_sum (@var{signals}, @var{group})\n\
+Coherent sum of the BB data of the redundant (tx, rx) pairs of a virtual array.\n\
+@var{signals} is the BB data in (time x n_tx x n_rx) or (time x n_tx x n_rx x frames) format.\n\
+@var{group} is the n_tx x n_rx matrix of the virtual element of every pair returned by \n\
+build_delay_map (@dots{}, \"virtual\").\n\
+@var{virtual_signals} is the (time x 1 x n_v) (or (time x 1 x n_v x frames)) sum of the \n\
+pairs of every element, to be beamformed with the maps of the virtual elements: \n\
+signal_das is linear in the channels, so the image is the one of the n_tx * n_rx pairs \n\
+at n_v/(n_tx * n_rx) of the cost.\n\
+@seealso{build_delay_map, signal_das, signal_fdmas}\n\
+@end deftypefn")
+{
+	if (args.length()!=2)
+	{
+		print_usage();
+		return octave_value();
+	}
+
+	if ((!args(0).isnumeric())||(args(0).ndims() > 4))
+	{
+		error("BB data must be in (time x n_tx x n_rx) or (time x n_tx x n_rx x frames) format");
+		return octave_value();
+	}
+	dim_vector		iq_dims	 = args(0).dims();
+	octave_idx_type n_time	 = iq_dims(0);
+	octave_idx_type n_tx	 = iq_dims(1);
+	octave_idx_type n_rx	 = iq_dims.ndims() > 2 ? iq_dims(2) : 1;
+	octave_idx_type n_frames = iq_dims.ndims() > 3 ? iq_dims(3) : 1;
+
+	if ((!args(1).isreal())||(args(1).ndims()!=2)||(args(1).dims()(0)!=n_tx)||(args(1).dims()(1)!=n_rx))
+	{
+		error("group must be a n_tx x n_rx matrix consistent with BB data");
+		return octave_value();
+	}
+	NDArray						 g = args(1).array_value();
+	std::vector<octave_idx_type> group(n_tx*n_rx);
+	octave_idx_type				 n_v = 0;
+	for (octave_idx_type c=0; c < n_tx*n_rx; c++)
+	{
+		double v = g(c);
+		if ((v < 1)||(v!=std::floor(v)))
+		{
+			error("group must contain positive integer indices");
+			return octave_value();
+		}
+		group[c] = (octave_idx_type)v - 1;
+		n_v		 = std::max(n_v, group[c]+1);
+	}
+
+	octave_idx_type n_pairs = n_tx*n_rx;
+	if (args(0).iscomplex())
+	{
+		if (args(0).is_single_type())
+			return virtual_sum(args(0).float_complex_array_value(), n_time, n_pairs, n_frames, group, n_v);
+		return virtual_sum(args(0).complex_array_value(), n_time, n_pairs, n_frames, group, n_v);
+	}
+	if (args(0).is_single_type())
+		return virtual_sum(args(0).float_array_value(), n_time, n_pairs, n_frames, group, n_v);
+	return virtual_sum(args(0).array_value(), n_time, n_pairs, n_frames, group, n_v);
+}
+
+/*
+%!shared x, y, z, frf, pos, time, iq
+%! x = linspace (-0.2, 0.2, 9);
+%! y = linspace (-0.1, 0.1, 7);
+%! z = linspace (0.5, 1, 5);
+%! frf = 7.29e9;
+%! ## Uniform linear array used for both tx and rx: 6 pairs, 4 phase centres
+%! pos = [0 0 0; 0.02 0 0; 0.04 0 0];
+%! time = (0:255)'/1.792e9;
+%! iq = complex (randn (256, 2, 3), randn (256, 2, 3));
+
+%!test
+%! [dmv, pfv, group] = build_delay_map (x, y, z, frf, pos(1:2,:), pos, "virtual");
+%! assert (group, [1 2 3; 2 3 4]);
+%! assert (size (dmv), [9 7 5 1 4]);
+%! ## Pair maps of the virtual elements: DAS is linear in the channels, so the
+%! ## pre-summed data give the image of all the pairs
+%! dm = reshape (dmv(:,:,:,1,group(:)), [9 7 5 2 3]);
+%! pf = reshape (pfv(:,:,:,1,group(:)), [9 7 5 2 3]);
+%! ref = signal_das (iq, time, dm, pf);
+%! iq_v = signal_virtual_sum (iq, group);
+%! assert (size (iq_v), [256 1 4]);
+%! assert (signal_das (iq_v, time, dmv, pfv), ref, 1e-10*max (abs (ref(:))));
+
+%!test
+%! ## Frames and single data
+%! [~, ~, group] = build_delay_map (x, y, z, frf, pos(1:2,:), pos, "virtual");
+%! frames = cat (4, iq, 2*iq);
+%! iq_v = signal_virtual_sum (single (frames), group);
+%! assert (class (iq_v), "single");
+%! assert (iq_v(:,:,:,2), 2*signal_virtual_sum (single (iq), group), 1e-5);
+%! assert (iq_v(:,1,2,1), single (iq(:,1,2) + iq(:,2,1)), 1e-5);
+
+%!test
+%! ## Monostatic-equivalent delays of the diagonal pairs are exact
+%! [dmv, ~, group] = build_delay_map (x, y, z, frf, pos, pos, "virtual");
+%! dm = build_delay_map (x, y, z, frf, pos, pos);
+%! for t = 1:3
+%!   assert (dmv(:,:,:,1,group(t,t)), dm(:,:,:,t,t), 1e-18);
+%! endfor
+
+%!error <group must be a n_tx x n_rx matrix> signal_virtual_sum (iq, [1 2; 2 3])
+*/